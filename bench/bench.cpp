@@ -0,0 +1,531 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AllocationCounter.hpp"
+#include "AstSerializer.hpp"
+#include "Batch.hpp"
+#include "Engine.hpp"
+#include "Interpreter.hpp"
+#include "LoxMap.hpp"
+#include "OutputSink.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "Session.hpp"
+
+// Microbenchmarks for each pipeline stage over the programs in bench/corpus.
+//
+//   lox_bench [--filter TEXT] [--min-time SECONDS] [--corpus DIR]
+//             [--json OUT.json] [--baseline BASELINE.json]
+//
+// Every corpus file is benchmarked as <file>/scan, <file>/parse and, when it
+// parses cleanly, <file>/load (rebuilding the AST from its AstCache payload)
+// and <file>/interpret. batch/<n>-threads runs four copies of the whole
+// corpus through runBatch on an n-thread pool (allocs/op there only counts
+// the calling thread). session/snippet submits one REPL-sized line to a
+// Session that already holds a few definitions; engine/snippet gets the same
+// result from a fresh Engine, which has to run the definitions again each
+// time. tasks/sequential computes eight independent fib(16)s in one thread;
+// tasks/spawned spawns one task per fib on the shared task pool, so their
+// ratio is the scaling on this host. arrays/loop and arrays/kernel both fill
+// a 10k-element array, then sum it with an indexed while loop or sum().
+// maps/<table>-<keys> runs a Lox loop making 10^6 inserts and then 10^6
+// lookups through two natives, put(key, value) and get(key), backed by either
+// LoxMap (swiss) or std::unordered_map (std) with the same hash and
+// equality. Keys are numbers or strings made by a key(i) native, so only
+// the table differs between a swiss run and its std run.
+// nesting/sum-<n> and nesting/parens-<n> run one expression n levels deep,
+// (1 + (1 + ...)) or ((((1)))), to check parsing and evaluating it stays
+// linear in n.
+// errors/syntax-<n> scans and parses n lines, every other one a syntax error,
+// so it times reporting and recovering from errors. errors/runtime runs a
+// two-statement program whose second statement is a type error.
+// --json writes the results; --baseline reads an earlier --json file and
+// prints the change in ns/op.
+
+namespace {
+  struct Options {
+    std::string filter;
+    double minSeconds = 0.5;
+    std::filesystem::path corpus = LOX_BENCH_CORPUS_DIR;
+    std::optional<std::string> jsonPath;
+    std::optional<std::string> baselinePath;
+  };
+
+  struct Measurement {
+    std::string name;
+    std::uint64_t iterations;
+    double nsPerOp;
+    double mbPerSec;
+    double allocsPerOp;
+  };
+
+  // Keeps `print` in the measurement without timing a terminal or file
+  class NullSink : public lox::OutputSink {
+  public:
+    auto write(std::string_view /*text*/) -> void override {}
+  };
+
+  // Runs `op` once to warm up, then repeatedly until `minSeconds` have passed
+  // (and at least three times)
+  template <typename Op>
+  auto measure(std::string name, std::size_t bytes, double minSeconds, Op &&op)
+      -> Measurement {
+    using Clock = std::chrono::steady_clock;
+
+    op();
+
+    auto const allocationsBefore =
+        lox::AllocationCounter::current().allocations;
+    auto const start = Clock::now();
+    auto iterations = std::uint64_t{0};
+    auto elapsed = std::chrono::duration<double>{};
+
+    do {
+      op();
+      iterations++;
+      elapsed = Clock::now() - start;
+    } while (iterations < 3 || elapsed.count() < minSeconds);
+
+    auto const allocations =
+        lox::AllocationCounter::current().allocations - allocationsBefore;
+    auto const seconds = elapsed.count();
+
+    return Measurement{
+        .name = std::move(name),
+        .iterations = iterations,
+        .nsPerOp = seconds * 1e9 / static_cast<double>(iterations),
+        .mbPerSec = static_cast<double>(bytes) *
+                    static_cast<double>(iterations) / seconds / 1e6,
+        .allocsPerOp =
+            static_cast<double>(allocations) / static_cast<double>(iterations),
+    };
+  }
+
+  auto readFile(std::filesystem::path const &path) -> std::string {
+    auto input = std::ifstream{path, std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{input}, {}};
+  }
+
+  auto benchFile(std::filesystem::path const &path, Options const &options,
+                 std::vector<Measurement> &results) -> void {
+    auto const stem = path.stem().string();
+    auto const source = readFile(path);
+    auto const wanted = [&](std::string const &name) {
+      return name.find(options.filter) != std::string::npos;
+    };
+
+    if (wanted(stem + "/scan")) {
+      results.push_back(
+          measure(stem + "/scan", source.size(), options.minSeconds, [&] {
+            auto scanner = lox::Scanner{source};
+            auto result = scanner.scanTokens();
+            return result.first.size();
+          }));
+    }
+
+    auto [tokens, scannerReport] = lox::Scanner{source}.scanTokens();
+
+    if (wanted(stem + "/parse")) {
+      results.push_back(
+          measure(stem + "/parse", source.size(), options.minSeconds, [&] {
+            auto parser = lox::Parser{tokens};
+            auto result = parser.parse();
+            return result.first.size();
+          }));
+    }
+
+    auto [statements, parserReport] = lox::Parser{tokens}.parse();
+    if (scannerReport.status != lox::ScannerStatus::SUCCESS ||
+        parserReport.status != lox::ParserStatus::SUCCESS) {
+      return;
+    }
+
+    // Programs nested too deeply to cache have no payload to load
+    if (auto const payload = lox::AstWriter::write(statements);
+        payload && wanted(stem + "/load")) {
+      results.push_back(
+          measure(stem + "/load", source.size(), options.minSeconds,
+                  [&] { return lox::AstReader::read(*payload).has_value(); }));
+    }
+
+    if (wanted(stem + "/interpret")) {
+      auto sink = std::make_shared<NullSink>();
+      results.push_back(
+          measure(stem + "/interpret", source.size(), options.minSeconds, [&] {
+            auto interpreter = lox::Interpreter{sink};
+            return interpreter.interpret(statements).status;
+          }));
+    }
+  }
+
+  auto benchBatch(std::vector<std::filesystem::path> const &files,
+                  Options const &options, std::vector<Measurement> &results)
+      -> void {
+    auto sources = std::vector<std::string>{};
+    auto bytes = std::size_t{0};
+    for (int copy = 0; copy < 4; copy++) {
+      for (auto const &file : files) {
+        sources.push_back(readFile(file));
+        bytes += sources.back().size();
+      }
+    }
+
+    auto const cores = std::max(1U, std::thread::hardware_concurrency());
+    for (auto const threads : {1U, cores}) {
+      auto const name = "batch/" + std::to_string(threads) + "-threads";
+      if (name.find(options.filter) == std::string::npos) {
+        continue;
+      }
+
+      auto pool = lox::WorkStealingPool{threads};
+      results.push_back(measure(name, bytes, options.minSeconds, [&] {
+        return lox::runBatch(sources, pool).size();
+      }));
+
+      if (threads == cores) {
+        break; // Single-core host: both runs are the same
+      }
+    }
+  }
+
+  auto benchSnippets(Options const &options,
+                     std::vector<Measurement> &results) -> void {
+    auto const definitions = std::string{
+        "class Point { init(x, y) { this.x = x; this.y = y; } "
+        "norm() { return this.x * this.x + this.y * this.y; } } "
+        "fun square(n) { return n * n; } var total = 0;"};
+    auto const snippet = std::string{
+        "var p = Point(3, 4); total = total + p.norm() + square(2);"};
+    auto const sink = std::make_shared<NullSink>();
+
+    if (std::string_view{"session/snippet"}.find(options.filter) !=
+        std::string_view::npos) {
+      auto session = lox::Session{sink};
+      session.submit(definitions);
+      results.push_back(measure("session/snippet", snippet.size(),
+                                options.minSeconds, [&] {
+                                  return session.submit(snippet).status;
+                                }));
+    }
+
+    if (std::string_view{"engine/snippet"}.find(options.filter) !=
+        std::string_view::npos) {
+      auto const source = definitions + '\n' + snippet;
+      results.push_back(measure("engine/snippet", snippet.size(),
+                                options.minSeconds, [&] {
+                                  auto engine = lox::Engine{sink};
+                                  return engine.run(source).status;
+                                }));
+    }
+  }
+
+  // Runs each whole program in a fresh Engine
+  auto benchPrograms(
+      std::span<std::pair<std::string, std::string> const> programs,
+      Options const &options, std::vector<Measurement> &results) -> void {
+    auto const sink = std::make_shared<NullSink>();
+
+    for (auto const &[name, source] : programs) {
+      if (name.find(options.filter) == std::string::npos) {
+        continue;
+      }
+      results.push_back(
+          measure(name, source.size(), options.minSeconds, [&] {
+            auto engine = lox::Engine{sink};
+            return engine.run(source).status;
+          }));
+    }
+  }
+
+  auto benchTasks(Options const &options, std::vector<Measurement> &results)
+      -> void {
+    auto const fib = std::string{
+        "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+        "fun work() { return fib(16); }"};
+    auto const programs = std::array<std::pair<std::string, std::string>, 2>{{
+        {"tasks/sequential",
+         fib + "var sum = 0; var i = 0;"
+               "while (i < 8) { sum = sum + work(); i = i + 1; }"},
+        {"tasks/spawned",
+         fib + "var t0 = spawn(work); var t1 = spawn(work);"
+               "var t2 = spawn(work); var t3 = spawn(work);"
+               "var t4 = spawn(work); var t5 = spawn(work);"
+               "var t6 = spawn(work); var t7 = spawn(work);"
+               "var sum = t0() + t1() + t2() + t3() + t4() + t5() + t6() +"
+               "  t7();"},
+    }};
+    benchPrograms(programs, options, results);
+  }
+
+  auto benchArrays(Options const &options, std::vector<Measurement> &results)
+      -> void {
+    auto const fill = std::string{
+        "var xs = array(10000); var i = 0;"
+        "while (i < 10000) { xs[i] = i; i = i + 1; }"};
+    auto const programs = std::array<std::pair<std::string, std::string>, 2>{{
+        {"arrays/loop",
+         fill + "var total = 0; i = 0;"
+                "while (i < 10000) { total = total + xs[i]; i = i + 1; }"},
+        {"arrays/kernel", fill + "var total = sum(xs);"},
+    }};
+    benchPrograms(programs, options, results);
+  }
+
+  auto benchNesting(Options const &options, std::vector<Measurement> &results)
+      -> void {
+    auto programs = std::vector<std::pair<std::string, std::string>>{};
+    for (auto const depth : {1000, 100000}) {
+      auto sum = std::string{"print "};
+      auto parens = std::string{"print "};
+      for (auto i = 0; i < depth; i++) {
+        sum += "(1 + ";
+        parens += '(';
+      }
+      sum += '1' + std::string(depth, ')') + ';';
+      parens += '1' + std::string(depth, ')') + ';';
+      programs.emplace_back("nesting/sum-" + std::to_string(depth), sum);
+      programs.emplace_back("nesting/parens-" + std::to_string(depth), parens);
+    }
+    benchPrograms(programs, options, results);
+  }
+
+  auto benchErrors(Options const &options, std::vector<Measurement> &results)
+      -> void {
+    auto const lines = 20000;
+    auto const name = "errors/syntax-" + std::to_string(lines);
+    if (name.find(options.filter) != std::string::npos) {
+      constexpr auto mistakes = std::to_array<std::string_view>(
+          {"if (x { }", "fun (a) {}", "x + * 3;", "var a = (1;"});
+      auto source = std::string{};
+      for (auto i = 0; i < lines; i += 2) {
+        source += mistakes[static_cast<std::size_t>(i / 2) % mistakes.size()];
+        source += "\nvar v" + std::to_string(i + 1) + " = 1;\n";
+      }
+      results.push_back(measure(name, source.size(), options.minSeconds, [&] {
+        auto [tokens, scannerReport] = lox::Scanner{source}.scanTokens();
+        auto [statements, parserReport] = lox::Parser{tokens}.parse();
+        return parserReport.errors.size();
+      }));
+    }
+
+    if (std::string_view{"errors/runtime"}.find(options.filter) !=
+        std::string_view::npos) {
+      auto const source = std::string{"var a = 1;\nprint a + \"x\";\n"};
+      auto [tokens, scannerReport] = lox::Scanner{source}.scanTokens();
+      auto [statements, parserReport] = lox::Parser{tokens}.parse();
+      auto const sink = std::make_shared<NullSink>();
+      results.push_back(
+          measure("errors/runtime", source.size(), options.minSeconds, [&] {
+            auto interpreter = lox::Interpreter{sink};
+            return interpreter.interpret(statements).status;
+          }));
+    }
+  }
+
+  // Adapts std::unordered_map to the part of LoxMap's interface put/get use
+  class StdTable {
+  private:
+    std::unordered_map<lox::LiteralVal, lox::LiteralVal, lox::ValueHash,
+                       lox::ValueEqual>
+        table;
+
+  public:
+    auto set(lox::LiteralVal const &key, lox::LiteralVal value) -> void {
+      table.insert_or_assign(key, std::move(value));
+    }
+
+    auto find(lox::LiteralVal const &key) -> lox::LiteralVal * {
+      auto found = table.find(key);
+      return found != table.end() ? &found->second : nullptr;
+    }
+  };
+
+  template <typename Table>
+  auto benchTable(std::string const &name, std::string const &key,
+                  Options const &options, std::vector<Measurement> &results)
+      -> void {
+    if (name.find(options.filter) == std::string::npos) {
+      return;
+    }
+
+    auto const source =
+        "var n = 1000000; var i = 0;"
+        "while (i < n) { put(" + key + ", i); i = i + 1; }"
+        "var found = 0; i = 0;"
+        "while (i < n) { if (get(" + key + ") != nil) found = found + 1;"
+        "  i = i + 1; }";
+    auto const sink = std::make_shared<NullSink>();
+
+    results.push_back(measure(name, source.size(), options.minSeconds, [&] {
+      auto table = Table{};
+      auto session = lox::Session{sink};
+      session.registerNative<void(lox::LiteralVal const &,
+                                  lox::LiteralVal const &)>(
+          "put", [&](lox::LiteralVal const &key, lox::LiteralVal const &value) {
+            table.set(key, value);
+          });
+      session.registerNative<lox::LiteralVal(lox::LiteralVal const &)>(
+          "get", [&](lox::LiteralVal const &key) {
+            auto const *value = table.find(key);
+            return value != nullptr ? *value : lox::LiteralVal{};
+          });
+      session.registerNative<std::string(double)>("key", [](double i) {
+        auto buffer = std::array<char, 32>{};
+        return "key" + std::string{lox::formatNumber(i, buffer)};
+      });
+      return session.submit(source).status;
+    }));
+  }
+
+  auto benchMaps(Options const &options, std::vector<Measurement> &results)
+      -> void {
+    benchTable<lox::LoxMap>("maps/swiss-numbers", "i", options, results);
+    benchTable<StdTable>("maps/std-numbers", "i", options, results);
+    benchTable<lox::LoxMap>("maps/swiss-strings", "key(i)", options, results);
+    benchTable<StdTable>("maps/std-strings", "key(i)", options, results);
+  }
+
+  auto writeJson(std::string const &path,
+                 std::vector<Measurement> const &results) -> void {
+    auto out = std::ofstream{path};
+    out << std::setprecision(12);
+    out << "{\n  \"benchmarks\": [\n";
+
+    for (std::size_t i = 0; i < results.size(); i++) {
+      auto const &result = results[i];
+      out << "    {\"name\": \"" << result.name
+          << "\", \"iterations\": " << result.iterations
+          << ", \"ns_per_op\": " << result.nsPerOp
+          << ", \"mb_per_s\": " << result.mbPerSec
+          << ", \"allocs_per_op\": " << result.allocsPerOp << "}"
+          << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+
+    out << "  ]\n}\n";
+  }
+
+  // Only understands the files writeJson produces
+  auto readBaseline(std::string const &path)
+      -> std::unordered_map<std::string, double> {
+    auto baseline = std::unordered_map<std::string, double>{};
+    auto const json = readFile(path);
+
+    constexpr std::string_view nameKey = "\"name\": \"";
+    constexpr std::string_view nsKey = "\"ns_per_op\": ";
+
+    for (auto pos = json.find(nameKey); pos != std::string::npos;
+         pos = json.find(nameKey, pos)) {
+      auto const nameStart = pos + nameKey.size();
+      auto const nameEnd = json.find('"', nameStart);
+      auto const nsStart = json.find(nsKey, nameEnd);
+      if (nameEnd == std::string::npos || nsStart == std::string::npos) {
+        break;
+      }
+
+      baseline[json.substr(nameStart, nameEnd - nameStart)] =
+          std::strtod(json.c_str() + nsStart + nsKey.size(), nullptr);
+      pos = nsStart;
+    }
+
+    return baseline;
+  }
+
+  auto parseArgs(int argc, char **argv) -> std::optional<Options> {
+    auto options = Options{};
+    auto const args = std::vector<std::string_view>(argv + 1, argv + argc);
+
+    for (std::size_t i = 0; i < args.size(); i++) {
+      auto const hasValue = i + 1 < args.size();
+
+      if (args[i] == "--filter" && hasValue) {
+        options.filter = args[++i];
+      } else if (args[i] == "--min-time" && hasValue) {
+        options.minSeconds =
+            std::strtod(std::string{args[++i]}.c_str(), nullptr);
+      } else if (args[i] == "--corpus" && hasValue) {
+        options.corpus = args[++i];
+      } else if (args[i] == "--json" && hasValue) {
+        options.jsonPath = args[++i];
+      } else if (args[i] == "--baseline" && hasValue) {
+        options.baselinePath = args[++i];
+      } else {
+        std::cerr << "Usage: lox_bench [--filter TEXT] [--min-time SECONDS] "
+                     "[--corpus DIR] [--json OUT] [--baseline JSON]\n";
+        return std::nullopt;
+      }
+    }
+
+    return options;
+  }
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  auto options = parseArgs(argc, argv);
+  if (!options) {
+    return 64;
+  }
+
+#ifndef __OPTIMIZE__
+  std::cerr << "warning: lox_bench was built without optimizations\n";
+#endif
+
+  auto files = std::vector<std::filesystem::path>{};
+  for (auto const &entry :
+       std::filesystem::directory_iterator{options->corpus}) {
+    if (entry.path().extension() == ".lox") {
+      files.push_back(entry.path());
+    }
+  }
+  std::ranges::sort(files);
+
+  auto results = std::vector<Measurement>{};
+  for (auto const &file : files) {
+    benchFile(file, *options, results);
+  }
+  benchBatch(files, *options, results);
+  benchSnippets(*options, results);
+  benchTasks(*options, results);
+  benchArrays(*options, results);
+  benchMaps(*options, results);
+  benchNesting(*options, results);
+  benchErrors(*options, results);
+
+  auto const baseline = options->baselinePath
+                            ? readBaseline(*options->baselinePath)
+                            : std::unordered_map<std::string, double>{};
+
+  std::printf("%-28s %14s %10s %12s %10s\n", "benchmark", "ns/op", "MB/s",
+              "allocs/op", "vs base");
+  for (auto const &result : results) {
+    std::printf("%-28s %14.0f %10.2f %12.1f", result.name.c_str(),
+                result.nsPerOp, result.mbPerSec, result.allocsPerOp);
+
+    if (auto base = baseline.find(result.name); base != baseline.end()) {
+      std::printf(" %+9.1f%%",
+                  (result.nsPerOp - base->second) / base->second * 100);
+    }
+    std::printf("\n");
+  }
+
+  if (options->jsonPath) {
+    writeJson(*options->jsonPath, results);
+  }
+
+  return 0;
+}
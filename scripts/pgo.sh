@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Two-stage profile-guided build in build/pgo: instrument, train on
+# bench/corpus, then rebuild with the profile. Uses whichever GCC or Clang
+# CMake finds (override with CC/CXX).
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+build=build/pgo
+profiles=$build/pgo-data
+
+cmake --preset pgo-generate
+cmake --build --preset pgo-generate
+rm -rf "$profiles"
+mkdir -p "$profiles"
+
+# Training: every stage of every corpus program through lox_bench, plus a
+# plain run of each script through the interpreter's own entry point
+"$build/lox_bench" --min-time 0.2 >/dev/null
+for script in bench/corpus/*.lox; do
+  "$build/cpp_lox" "$script" >/dev/null 2>&1 || true
+done
+
+# Clang leaves raw per-process profiles that need merging; GCC's .gcda files
+# are read as they are
+if compgen -G "$profiles/*.profraw" >/dev/null; then
+  cxx=$(sed -n 's/^CMAKE_CXX_COMPILER:[A-Z]*=//p' "$build/CMakeCache.txt")
+  profdata=${LLVM_PROFDATA:-$(dirname "$cxx")/llvm-profdata}
+  [[ -x "$profdata" ]] || profdata=llvm-profdata
+  "$profdata" merge -output="$profiles/lox.profdata" "$profiles"/*.profraw
+fi
+
+cmake --preset pgo-use
+cmake --build --preset pgo-use
+echo "PGO build: $build/cpp_lox"
@@ -0,0 +1,59 @@
+#include "AllocationCounter.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define LOX_USABLE_SIZE malloc_size
+#else
+#include <malloc.h>
+#define LOX_USABLE_SIZE malloc_usable_size
+#endif
+
+namespace {
+  thread_local lox::AllocationCounter counter;
+
+  auto allocate(std::size_t size) -> void * {
+    counter.allocations++;
+    counter.bytes += size;
+
+    auto *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+      throw std::bad_alloc{};
+    }
+
+    if (counter.trackLiveBytes) {
+      counter.liveBytes += static_cast<std::int64_t>(LOX_USABLE_SIZE(ptr));
+      counter.peakLiveBytes =
+          std::max(counter.peakLiveBytes, counter.liveBytes);
+    }
+
+    return ptr;
+  }
+
+  auto deallocate(void *ptr) -> void {
+    if (counter.trackLiveBytes && ptr != nullptr) {
+      counter.liveBytes -= static_cast<std::int64_t>(LOX_USABLE_SIZE(ptr));
+    }
+
+    std::free(ptr);
+  }
+} // namespace
+
+auto lox::AllocationCounter::current() -> AllocationCounter & {
+  return counter;
+}
+
+auto operator new(std::size_t size) -> void * { return allocate(size); }
+auto operator new[](std::size_t size) -> void * { return allocate(size); }
+
+auto operator delete(void *ptr) noexcept -> void { deallocate(ptr); }
+auto operator delete[](void *ptr) noexcept -> void { deallocate(ptr); }
+auto operator delete(void *ptr, std::size_t /*size*/) noexcept -> void {
+  deallocate(ptr);
+}
+auto operator delete[](void *ptr, std::size_t /*size*/) noexcept -> void {
+  deallocate(ptr);
+}
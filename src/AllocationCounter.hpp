@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lox {
+  // Per-thread tally of heap allocations, kept by the replacement global
+  // operator new in AllocationCounter.cpp. Thread-local so counting costs a
+  // plain increment, and so concurrent interpreters don't share a cache line.
+  struct AllocationCounter {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+
+    // Live and peak heap bytes cost a malloc_usable_size() on every
+    // allocation and free, so they are only kept while this is set. Blocks
+    // allocated before it was set are not subtracted when freed.
+    bool trackLiveBytes = false;
+    std::int64_t liveBytes = 0;
+    std::int64_t peakLiveBytes = 0;
+
+    static auto current() -> AllocationCounter &;
+  };
+
+  // Tracks live bytes on this thread, when `track` is set, until it goes
+  // out of scope, then puts tracking back the way it was. Runs with a heap
+  // limit hold one on each thread they run on, including pool workers.
+  class LiveBytesTracking {
+  private:
+    bool const wasTracking;
+
+  public:
+    explicit LiveBytesTracking(bool track)
+        : wasTracking{AllocationCounter::current().trackLiveBytes} {
+      if (track) {
+        AllocationCounter::current().trackLiveBytes = true;
+      }
+    }
+    ~LiveBytesTracking() {
+      AllocationCounter::current().trackLiveBytes = wasTracking;
+    }
+    LiveBytesTracking(LiveBytesTracking const &) = delete;
+    auto operator=(LiveBytesTracking const &) -> LiveBytesTracking & = delete;
+  };
+} // namespace lox
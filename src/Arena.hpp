@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace lox {
+  // Memory for the scopes of one run. Small blocks are carved out of large
+  // chunks and kept on a free list per size once freed, for reuse within
+  // the run; the chunks all go back upstream at once when it's destroyed.
+  // It belongs to a global scope, but lives on until the last block
+  // allocated from it is freed too, since closures can keep scopes alive
+  // after their global scope is gone.
+  //
+  // Not thread-safe: a run's scopes are only ever created and destroyed on
+  // the thread running it. Tasks work on deep copies that don't use it.
+  class Arena final : public std::pmr::memory_resource {
+  private:
+    static constexpr std::size_t GRAIN = alignof(std::max_align_t);
+    static constexpr std::size_t LARGEST = 256; // Bigger blocks go upstream
+    static constexpr std::size_t CHUNK = 64 * 1024;
+
+    struct Free {
+      Free *next;
+    };
+
+    std::array<Free *, LARGEST / GRAIN + 1> free{};
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    std::byte *next = nullptr; // Unused rest of the newest chunk
+    std::byte *end = nullptr;
+    std::size_t live = 0; // Blocks allocated and not yet freed
+    bool owned = true;
+
+    Arena() = default;
+    ~Arena() override = default;
+
+    static auto sizeClass(std::size_t bytes) -> std::size_t {
+      return (bytes + GRAIN - 1) / GRAIN;
+    }
+
+    auto carve(std::size_t bytes) -> void * {
+      if (static_cast<std::size_t>(end - next) < bytes) {
+        chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(CHUNK));
+        next = chunks.back().get();
+        end = next + CHUNK;
+      }
+      return std::exchange(next, next + bytes);
+    }
+
+    auto do_allocate(std::size_t bytes, std::size_t alignment)
+        -> void * override {
+      live++;
+      if (bytes > LARGEST || alignment > GRAIN) {
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+      }
+      auto const size = sizeClass(bytes);
+      if (auto *block = free[size]) {
+        free[size] = block->next;
+        return block;
+      }
+      return carve(size * GRAIN);
+    }
+
+    auto do_deallocate(void *block, std::size_t bytes, std::size_t alignment)
+        -> void override {
+      if (bytes > LARGEST || alignment > GRAIN) {
+        std::pmr::new_delete_resource()->deallocate(block, bytes, alignment);
+      } else {
+        auto const size = sizeClass(bytes);
+        free[size] = new (block) Free{free[size]};
+      }
+      if (--live == 0 && !owned) {
+        delete this;
+      }
+    }
+
+    [[nodiscard]] auto do_is_equal(std::pmr::memory_resource const &other)
+        const noexcept -> bool override {
+      return this == &other;
+    }
+
+  public:
+    Arena(Arena const &) = delete;
+    auto operator=(Arena const &) -> Arena & = delete;
+
+    // For std::unique_ptr: the owner is done with the arena, which goes
+    // once nothing allocated from it is left
+    struct Release {
+      auto operator()(Arena *arena) const -> void {
+        arena->owned = false;
+        if (arena->live == 0) {
+          delete arena;
+        }
+      }
+    };
+
+    static auto create() -> std::unique_ptr<Arena, Release> {
+      return std::unique_ptr<Arena, Release>{new Arena};
+    }
+  };
+} // namespace lox
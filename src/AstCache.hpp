@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "AstSerializer.hpp"
+#include "MappedFile.hpp"
+#include "Stmt.hpp"
+
+namespace lox {
+  // Parsed programs stored on disk by source hash, so running an unchanged
+  // script again skips scanning and parsing. A file is a fixed header
+  // followed by the source it was parsed from and the AstWriter payload:
+  //
+  //   magic "LOXAST\0\0", build id, source hash, source size,
+  //   payload size, payload checksum
+  //
+  // Anything that doesn't match (another build, a different source, a
+  // truncated or corrupted payload) is treated as a miss and the script is
+  // parsed normally, which then overwrites the file. The source is compared
+  // byte for byte, so a hash collision can't run the wrong program.
+  class AstCache {
+  public:
+    // Only the build that wrote a file reads it back: any rebuild may change
+    // the AST or AstWriter's layout. Nothing records a build, so the
+    // compiler and the time this file was compiled stand in for one.
+    static constexpr std::uint64_t BUILD_ID =
+        fnv1a(__VERSION__ " " __DATE__ " " __TIME__);
+
+  private:
+    static constexpr auto MAGIC = std::array<char, 8>{'L', 'O', 'X', 'A',
+                                                      'S', 'T', 0,   0};
+
+    struct Header {
+      std::array<char, 8> magic;
+      std::uint64_t build;
+      std::uint64_t sourceHash;
+      std::uint64_t sourceSize;
+      std::uint64_t payloadSize;
+      std::uint64_t payloadHash;
+    };
+
+    std::filesystem::path directory;
+
+    [[nodiscard]] auto pathFor(std::uint64_t sourceHash) const
+        -> std::filesystem::path {
+      auto name = std::array<char, 48>{};
+      std::snprintf(name.data(), name.size(), "%016llx-%016llx.loxast",
+                    static_cast<unsigned long long>(sourceHash),
+                    static_cast<unsigned long long>(BUILD_ID));
+      return directory / name.data();
+    }
+
+  public:
+    explicit AstCache(std::filesystem::path directory)
+        : directory{std::move(directory)} {}
+
+    // $LOX_CACHE_DIR, else $XDG_CACHE_HOME/cpp_lox, else ~/.cache/cpp_lox
+    static auto defaultDirectory() -> std::optional<std::filesystem::path> {
+      if (auto const *dir = std::getenv("LOX_CACHE_DIR")) {
+        return std::filesystem::path{dir};
+      }
+      if (auto const *dir = std::getenv("XDG_CACHE_HOME")) {
+        return std::filesystem::path{dir} / "cpp_lox";
+      }
+      if (auto const *home = std::getenv("HOME")) {
+        return std::filesystem::path{home} / ".cache" / "cpp_lox";
+      }
+      return std::nullopt;
+    }
+
+    [[nodiscard]] auto load(std::string_view source) const
+        -> std::optional<std::vector<std::unique_ptr<stmt::Stmt>>> {
+      auto const sourceHash = fnv1a(source);
+      auto const file = MappedFile::open(pathFor(sourceHash));
+      if (!file) {
+        return std::nullopt;
+      }
+
+      auto const bytes = file->bytes();
+      auto header = Header{};
+      if (bytes.size() < sizeof header) {
+        return std::nullopt;
+      }
+      std::memcpy(&header, bytes.data(), sizeof header);
+
+      auto const body = bytes.substr(sizeof header);
+      if (header.magic != MAGIC || header.build != BUILD_ID ||
+          header.sourceHash != sourceHash ||
+          header.sourceSize != source.size() ||
+          body.size() < source.size() ||
+          body.substr(0, source.size()) != source) {
+        return std::nullopt;
+      }
+
+      auto const payload = body.substr(source.size());
+      if (header.payloadSize != payload.size() ||
+          header.payloadHash != fnv1a(payload)) {
+        return std::nullopt;
+      }
+
+      return AstReader::read(payload);
+    }
+
+    // Best effort: a cache that can't be written just stays cold. The file
+    // is written aside and renamed into place so a concurrent reader never
+    // maps a half-written one.
+    auto store(std::string_view source,
+               std::vector<std::unique_ptr<stmt::Stmt>> const &program) const
+        -> void {
+      auto const written = AstWriter::write(program);
+      if (!written) {
+        return;
+      }
+
+      auto const &payload = *written;
+      auto const header =
+          Header{MAGIC,         BUILD_ID,       fnv1a(source),
+                 source.size(), payload.size(), fnv1a(payload)};
+
+      auto error = std::error_code{};
+      std::filesystem::create_directories(directory, error);
+      if (error) {
+        return;
+      }
+
+      auto const path = pathFor(header.sourceHash);
+      auto temporary = path;
+      temporary += ".tmp" + std::to_string(getpid());
+
+      {
+        auto out = std::ofstream{temporary, std::ios::binary};
+        out.write(reinterpret_cast<char const *>(&header), sizeof header);
+        out.write(source.data(), static_cast<std::streamsize>(source.size()));
+        out.write(payload.data(),
+                  static_cast<std::streamsize>(payload.size()));
+        if (!out) {
+          out.close();
+          std::filesystem::remove(temporary, error);
+          return;
+        }
+      }
+
+      std::filesystem::rename(temporary, path, error);
+      if (error) {
+        std::filesystem::remove(temporary, error);
+      }
+    }
+  };
+} // namespace lox
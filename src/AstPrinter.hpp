@@ -62,6 +62,22 @@ namespace lox {
       return parenthesize(expr.name.lexeme, *expr.object, *expr.value);
     }
 
+    VISIT_EXPR(expr::Array) {
+      auto result = std::string{"(array"};
+      for (auto const &element : expr.elements) {
+        result += " " + std::get<std::string>(visit(*element));
+      }
+      return result + ")";
+    }
+
+    VISIT_EXPR(expr::Index) {
+      return parenthesize("[]", *expr.object, *expr.index);
+    }
+
+    VISIT_EXPR(expr::SetIndex) {
+      return parenthesize("[]=", *expr.object, *expr.index, *expr.value);
+    }
+
     VISIT_EXPR(expr::This) { return expr.keyword.lexeme; }
 
     VISIT_EXPR(expr::Super) { return expr.keyword.lexeme; }
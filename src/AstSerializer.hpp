@@ -0,0 +1,565 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // 64-bit FNV-1a
+  constexpr auto fnv1a(std::string_view bytes,
+                       std::uint64_t hash = 0xcbf29ce484222325) {
+    for (auto const byte : bytes) {
+      hash = (hash ^ static_cast<std::uint8_t>(byte)) * 0x100000001b3;
+    }
+    return hash;
+  }
+
+  // Tag written in place of an empty node pointer
+  constexpr std::uint8_t NO_NODE = 0xff;
+
+  // AstWriter and AstReader recurse once per level of nesting, so they
+  // refuse programs nested deeper than this. Those are parsed every run.
+  constexpr std::size_t MAX_AST_DEPTH = 1000;
+
+  // Host-byte-order primitives shared by the AST and snapshot formats
+  class ByteWriter {
+  protected:
+    std::string out;
+
+  public:
+    template <typename Int> auto putInt(Int value) -> void {
+      out.append(reinterpret_cast<char const *>(&value), sizeof value);
+    }
+
+    auto putString(std::string const &text) -> void {
+      putInt(static_cast<std::uint32_t>(text.size()));
+      out += text;
+    }
+  };
+
+  // Every read is bounds checked; past the end, reads return zero values and
+  // `failed` is set
+  class ByteReader {
+  protected:
+    std::string_view in;
+    std::size_t position = 0;
+    bool failed = false;
+
+  public:
+    explicit ByteReader(std::string_view in) : in{in} {}
+
+    auto fail() -> void {
+      failed = true;
+      position = in.size();
+    }
+
+    template <typename Int> auto getInt() -> Int {
+      auto value = Int{};
+      if (in.size() - position < sizeof value) {
+        fail();
+        return value;
+      }
+
+      std::memcpy(&value, in.data() + position, sizeof value);
+      position += sizeof value;
+      return value;
+    }
+
+    auto getString() -> std::string {
+      auto const size = getInt<std::uint32_t>();
+      if (in.size() - position < size) {
+        fail();
+        return {};
+      }
+
+      auto text = std::string{in.substr(position, size)};
+      position += size;
+      return text;
+    }
+
+    [[nodiscard]] auto ok() const -> bool { return !failed; }
+    [[nodiscard]] auto atEnd() const -> bool { return position == in.size(); }
+  };
+
+  // Writes a parsed program as flat bytes. Every node is a one-byte tag, its
+  // index in expr::Expr / stmt::Stmt, followed by its fields in declaration
+  // order. Integers and doubles are in host byte order. Reordering either
+  // variant or any node's fields changes the format, which AstCache::BUILD_ID
+  // tracks by rebuilding.
+  class AstWriter : ByteWriter {
+  private:
+    std::size_t depth = 0;
+    bool tooDeep = false;
+
+    auto putLiteral(LiteralVal const &value) -> void {
+      putInt(static_cast<std::uint8_t>(value.index()));
+      std::visit(overloaded{[](std::monostate const &) {},
+                            [this](std::string const &arg) { putString(arg); },
+                            [this](bool const &arg) {
+                              putInt(static_cast<std::uint8_t>(arg));
+                            },
+                            [this](double const &arg) { putInt(arg); },
+                            // Runtime objects never appear in a parsed AST
+                            [](auto const &) {}},
+                 value);
+    }
+
+    auto putToken(Token const &token) -> void {
+      putInt(static_cast<std::uint8_t>(token.type));
+      putString(token.lexeme);
+      putLiteral(token.literal);
+      putInt(static_cast<std::int32_t>(token.line));
+    }
+
+    template <typename Node> auto put(std::unique_ptr<Node> const &node) {
+      if (!node) {
+        putInt(NO_NODE);
+        return;
+      }
+
+      if (depth == MAX_AST_DEPTH) {
+        tooDeep = true;
+        return;
+      }
+
+      putInt(static_cast<std::uint8_t>(node->index()));
+      depth++;
+      std::visit(*this, *node);
+      depth--;
+    }
+
+    template <typename Item> auto putAll(std::vector<Item> const &items) {
+      putInt(static_cast<std::uint32_t>(items.size()));
+      for (auto const &item : items) {
+        if constexpr (std::is_same_v<Item, Token>) {
+          putToken(item);
+        } else {
+          put(item);
+        }
+      }
+    }
+
+  public:
+    /* #region Expr */
+    auto operator()(expr::Array const &expr) -> void {
+      putToken(expr.bracket);
+      putAll(expr.elements);
+    }
+    auto operator()(expr::Assign const &expr) -> void {
+      putToken(expr.name);
+      put(expr.value);
+    }
+    auto operator()(expr::Binary const &expr) -> void {
+      put(expr.left);
+      putToken(expr.op);
+      put(expr.right);
+    }
+    auto operator()(expr::Call const &expr) -> void {
+      put(expr.callee);
+      putToken(expr.paren);
+      putAll(expr.arguments);
+    }
+    auto operator()(expr::Get const &expr) -> void {
+      put(expr.object);
+      putToken(expr.name);
+    }
+    auto operator()(expr::Grouping const &expr) -> void {
+      put(expr.expression);
+    }
+    auto operator()(expr::Index const &expr) -> void {
+      put(expr.object);
+      putToken(expr.bracket);
+      put(expr.index);
+    }
+    auto operator()(expr::Literal const &expr) -> void {
+      putLiteral(expr.value);
+    }
+    auto operator()(expr::Logical const &expr) -> void {
+      put(expr.left);
+      putToken(expr.op);
+      put(expr.right);
+    }
+    auto operator()(expr::Set const &expr) -> void {
+      put(expr.object);
+      putToken(expr.name);
+      put(expr.value);
+    }
+    auto operator()(expr::SetIndex const &expr) -> void {
+      put(expr.object);
+      putToken(expr.bracket);
+      put(expr.index);
+      put(expr.value);
+    }
+    auto operator()(expr::Super const &expr) -> void {
+      putToken(expr.keyword);
+      putToken(expr.method);
+    }
+    auto operator()(expr::This const &expr) -> void { putToken(expr.keyword); }
+    auto operator()(expr::Unary const &expr) -> void {
+      putToken(expr.op);
+      put(expr.right);
+    }
+    auto operator()(expr::Variable const &expr) -> void {
+      putToken(expr.name);
+    }
+    /* #endregion */
+
+    /* #region Stmt */
+    VISIT_STMT(stmt::Print) { put(stmt.expression); }
+    VISIT_STMT(stmt::Expression) { put(stmt.expression); }
+    VISIT_STMT(stmt::Var) {
+      putToken(stmt.name);
+      put(stmt.initializer);
+    }
+    VISIT_STMT(stmt::Block) { putAll(stmt.statements); }
+    VISIT_STMT(stmt::If) {
+      put(stmt.condition);
+      put(stmt.thenBranch);
+      put(stmt.elseBranch);
+    }
+    VISIT_STMT(stmt::While) {
+      putToken(stmt.keyword);
+      put(stmt.condition);
+      put(stmt.body);
+    }
+    VISIT_STMT(stmt::Function) {
+      putToken(stmt.name);
+      putAll(stmt.params);
+      putAll(stmt.body);
+      putInt(static_cast<std::uint8_t>(stmt.isGenerator));
+    }
+    VISIT_STMT(stmt::Return) {
+      putToken(stmt.keyword);
+      put(stmt.value);
+    }
+    VISIT_STMT(stmt::Class) {
+      putToken(stmt.name);
+      put(stmt.superclass);
+      putAll(stmt.methods);
+    }
+    VISIT_STMT(stmt::Yield) {
+      putToken(stmt.keyword);
+      put(stmt.value);
+    }
+    VISIT_STMT(stmt::Import) {
+      putToken(stmt.keyword);
+      putToken(stmt.path);
+    }
+    /* #endregion */
+
+    // Nullopt for a program nested deeper than MAX_AST_DEPTH
+    static auto
+    write(std::vector<std::unique_ptr<stmt::Stmt>> const &program)
+        -> std::optional<std::string> {
+      auto writer = AstWriter{};
+      writer.putAll(program);
+      if (writer.tooDeep) {
+        return std::nullopt;
+      }
+      return std::move(writer.out);
+    }
+  };
+
+  // Rebuilds a program written by AstWriter. Every read is bounds checked and
+  // the shape the interpreter relies on (required children present, class
+  // methods being functions, superclasses being variables) is validated, so
+  // malformed input yields nullopt rather than a tree that crashes later.
+  class AstReader : ByteReader {
+  private:
+    using ExprPtr = std::unique_ptr<expr::Expr>;
+    using StmtPtr = std::unique_ptr<stmt::Stmt>;
+
+    std::size_t depth = 0;
+
+    using ByteReader::ByteReader;
+
+    auto getLiteral() -> LiteralVal {
+      switch (getInt<std::uint8_t>()) {
+        case variant_index_v<LiteralVal, std::monostate>:
+          return {};
+        case variant_index_v<LiteralVal, std::string>:
+          return getString();
+        case variant_index_v<LiteralVal, bool>:
+          return getInt<std::uint8_t>() != 0;
+        case variant_index_v<LiteralVal, double>:
+          return getInt<double>();
+        default:
+          fail();
+          return {};
+      }
+    }
+
+    auto getToken() -> Token {
+      auto const type = getInt<std::uint8_t>();
+      if (type > static_cast<std::uint8_t>(TokenType::END_OF_FILE)) {
+        fail();
+      }
+
+      auto lexeme = getString();
+      auto literal = getLiteral();
+      return Token{static_cast<TokenType>(type), std::move(lexeme),
+                   std::move(literal), getInt<std::int32_t>()};
+    }
+
+    auto getTokens() -> std::vector<Token> {
+      auto const count = getInt<std::uint32_t>();
+      auto tokens = std::vector<Token>{};
+      for (std::uint32_t i = 0; i < count && !failed; i++) {
+        tokens.push_back(getToken());
+      }
+      return tokens;
+    }
+
+    // Required children fail the read when absent
+    auto getExpr(bool required = true) -> ExprPtr {
+      auto const tag = getInt<std::uint8_t>();
+      if (tag == NO_NODE && !required) {
+        return nullptr;
+      }
+
+      if (depth == MAX_AST_DEPTH) {
+        fail();
+        return nullptr;
+      }
+
+      depth++;
+      auto expr = getExprBody(tag);
+      depth--;
+      if (!expr) {
+        fail();
+      }
+      return expr;
+    }
+
+    auto getStmt(bool required = true) -> StmtPtr {
+      auto const tag = getInt<std::uint8_t>();
+      if (tag == NO_NODE && !required) {
+        return nullptr;
+      }
+
+      if (depth == MAX_AST_DEPTH) {
+        fail();
+        return nullptr;
+      }
+
+      depth++;
+      auto stmt = getStmtBody(tag);
+      depth--;
+      if (!stmt) {
+        fail();
+      }
+      return stmt;
+    }
+
+    auto getExprs() -> std::vector<ExprPtr> {
+      auto const count = getInt<std::uint32_t>();
+      auto exprs = std::vector<ExprPtr>{};
+      for (std::uint32_t i = 0; i < count && !failed; i++) {
+        exprs.push_back(getExpr());
+      }
+      return exprs;
+    }
+
+    auto getStmts() -> std::vector<StmtPtr> {
+      auto const count = getInt<std::uint32_t>();
+      auto stmts = std::vector<StmtPtr>{};
+      for (std::uint32_t i = 0; i < count && !failed; i++) {
+        stmts.push_back(getStmt());
+      }
+      return stmts;
+    }
+
+    auto getExprBody(std::uint8_t tag) -> ExprPtr {
+      if (failed) {
+        return nullptr;
+      }
+
+      switch (tag) {
+        case variant_index_v<expr::Expr, expr::Array>: {
+          auto bracket = getToken();
+          return make_unique_variant<expr::Expr, expr::Array>(
+              std::move(bracket), getExprs());
+        }
+        case variant_index_v<expr::Expr, expr::Assign>: {
+          auto name = getToken();
+          auto value = getExpr();
+          return make_unique_variant<expr::Expr, expr::Assign>(name, value);
+        }
+        case variant_index_v<expr::Expr, expr::Binary>: {
+          auto left = getExpr();
+          auto op = getToken();
+          auto right = getExpr();
+          return make_unique_variant<expr::Expr, expr::Binary>(left, op,
+                                                               right);
+        }
+        case variant_index_v<expr::Expr, expr::Call>: {
+          auto callee = getExpr();
+          auto paren = getToken();
+          return make_unique_variant<expr::Expr, expr::Call>(callee, paren,
+                                                             getExprs());
+        }
+        case variant_index_v<expr::Expr, expr::Get>: {
+          auto object = getExpr();
+          return make_unique_variant<expr::Expr, expr::Get>(object,
+                                                            getToken());
+        }
+        case variant_index_v<expr::Expr, expr::Grouping>: {
+          auto expression = getExpr();
+          return make_unique_variant<expr::Expr, expr::Grouping>(expression);
+        }
+        case variant_index_v<expr::Expr, expr::Index>: {
+          auto object = getExpr();
+          auto bracket = getToken();
+          auto index = getExpr();
+          return make_unique_variant<expr::Expr, expr::Index>(object, bracket,
+                                                              index);
+        }
+        case variant_index_v<expr::Expr, expr::Literal>:
+          return make_unique_variant<expr::Expr, expr::Literal>(getLiteral());
+        case variant_index_v<expr::Expr, expr::Logical>: {
+          auto left = getExpr();
+          auto op = getToken();
+          auto right = getExpr();
+          return make_unique_variant<expr::Expr, expr::Logical>(left, op,
+                                                                right);
+        }
+        case variant_index_v<expr::Expr, expr::Set>: {
+          auto object = getExpr();
+          auto name = getToken();
+          auto value = getExpr();
+          return make_unique_variant<expr::Expr, expr::Set>(object, name,
+                                                            value);
+        }
+        case variant_index_v<expr::Expr, expr::SetIndex>: {
+          auto object = getExpr();
+          auto bracket = getToken();
+          auto index = getExpr();
+          auto value = getExpr();
+          return make_unique_variant<expr::Expr, expr::SetIndex>(
+              object, bracket, index, value);
+        }
+        case variant_index_v<expr::Expr, expr::Super>: {
+          auto keyword = getToken();
+          return make_unique_variant<expr::Expr, expr::Super>(keyword,
+                                                              getToken());
+        }
+        case variant_index_v<expr::Expr, expr::This>:
+          return make_unique_variant<expr::Expr, expr::This>(getToken());
+        case variant_index_v<expr::Expr, expr::Unary>: {
+          auto op = getToken();
+          auto right = getExpr();
+          return make_unique_variant<expr::Expr, expr::Unary>(op, right);
+        }
+        case variant_index_v<expr::Expr, expr::Variable>:
+          return make_unique_variant<expr::Expr, expr::Variable>(getToken());
+        default:
+          return nullptr;
+      }
+    }
+
+    auto getStmtBody(std::uint8_t tag) -> StmtPtr {
+      if (failed) {
+        return nullptr;
+      }
+
+      switch (tag) {
+        case variant_index_v<stmt::Stmt, stmt::Print>: {
+          auto expression = getExpr();
+          return make_unique_variant<stmt::Stmt, stmt::Print>(expression);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Expression>: {
+          auto expression = getExpr();
+          return make_unique_variant<stmt::Stmt, stmt::Expression>(
+              expression);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Var>: {
+          auto name = getToken();
+          auto initializer = getExpr(false);
+          return make_unique_variant<stmt::Stmt, stmt::Var>(name, initializer);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Block>:
+          return make_unique_variant<stmt::Stmt, stmt::Block>(getStmts());
+        case variant_index_v<stmt::Stmt, stmt::If>: {
+          auto condition = getExpr();
+          auto thenBranch = getStmt();
+          auto elseBranch = getStmt(false);
+          return make_unique_variant<stmt::Stmt, stmt::If>(
+              condition, thenBranch, elseBranch);
+        }
+        case variant_index_v<stmt::Stmt, stmt::While>: {
+          auto keyword = getToken();
+          auto condition = getExpr();
+          auto body = getStmt();
+          return make_unique_variant<stmt::Stmt, stmt::While>(
+              keyword, condition, body);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Function>: {
+          auto name = getToken();
+          auto params = getTokens();
+          auto body = getStmts();
+          auto const isGenerator = getInt<std::uint8_t>() != 0;
+          return make_unique_variant<stmt::Stmt, stmt::Function>(
+              std::move(name), std::move(params), std::move(body),
+              isGenerator);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Return>: {
+          auto keyword = getToken();
+          auto value = getExpr(false);
+          return make_unique_variant<stmt::Stmt, stmt::Return>(keyword, value);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Class>: {
+          auto name = getToken();
+          auto superclass = getExpr(false);
+          auto methods = getStmts();
+
+          if (superclass &&
+              !std::holds_alternative<expr::Variable>(*superclass)) {
+            return nullptr;
+          }
+          for (auto const &method : methods) {
+            if (!method || !std::holds_alternative<stmt::Function>(*method)) {
+              return nullptr;
+            }
+          }
+
+          return make_unique_variant<stmt::Stmt, stmt::Class>(
+              name, superclass, std::move(methods));
+        }
+        case variant_index_v<stmt::Stmt, stmt::Yield>: {
+          auto keyword = getToken();
+          auto value = getExpr(false);
+          return make_unique_variant<stmt::Stmt, stmt::Yield>(keyword, value);
+        }
+        case variant_index_v<stmt::Stmt, stmt::Import>: {
+          auto keyword = getToken();
+          auto path = getToken();
+          return make_unique_variant<stmt::Stmt, stmt::Import>(keyword, path);
+        }
+        default:
+          return nullptr;
+      }
+    }
+
+  public:
+    static auto read(std::string_view bytes)
+        -> std::optional<std::vector<StmtPtr>> {
+      auto reader = AstReader{bytes};
+      auto program = reader.getStmts();
+      if (reader.failed || reader.position != bytes.size()) {
+        return std::nullopt;
+      }
+      return program;
+    }
+  };
+} // namespace lox
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AstCache.hpp"
+#include "Engine.hpp"
+#include "OutputSink.hpp"
+#include "ThreadPool.hpp"
+
+namespace lox {
+  struct BatchResult {
+    RunResult result;
+    std::string output; // Everything the script printed
+  };
+
+  // Runs every source on its own Engine across `pool` and returns the
+  // results in the order of `sources`, whatever order they finished in.
+  // Each script gets `limits` to itself, and imports relative to the
+  // directory of its entry in `files` (the working directory if it has
+  // none).
+  inline auto runBatch(std::vector<std::string> const &sources,
+                       WorkStealingPool &pool,
+                       AstCache const *cache = nullptr,
+                       RunLimits const &limits = {},
+                       std::vector<std::filesystem::path> const &files = {})
+      -> std::vector<BatchResult> {
+    auto results = std::vector<BatchResult>(sources.size());
+
+    for (std::size_t i = 0; i < sources.size(); i++) {
+      pool.submit([&sources, &results, cache, &limits, &files, i] {
+        auto sink = std::make_shared<CaptureSink>();
+        auto const file =
+            i < files.size() ? files[i] : std::filesystem::path{};
+        auto engine = Engine{sink,
+                             {.cache = cache,
+                              .limits = limits,
+                              .directory = file.parent_path(),
+                              .file = file}};
+        results[i].result = engine.run(sources[i]);
+        results[i].output = sink->take();
+      });
+    }
+
+    pool.wait();
+    return results;
+  }
+} // namespace lox
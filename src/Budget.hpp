@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <string>
+
+#include "Report.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // Caps on what one run may use, for running scripts that can't be
+  // trusted to finish; zero means no cap
+  struct RunLimits {
+    std::uint64_t steps = 0; // Loop iterations and calls
+    std::chrono::milliseconds time{0};
+    std::uint64_t heapBytes = 0; // Live heap allocated on the run's thread
+    std::uint64_t outputBytes = 0;
+
+    [[nodiscard]] auto any() const -> bool {
+      return steps != 0 || time.count() != 0 || heapBytes != 0 ||
+             outputBytes != 0;
+    }
+  };
+
+  // What's left of a run's limits, shared by the interpreter running it and
+  // those running the tasks it spawns. Interpreters take steps from it
+  // CHUNK at a time, so the shared counter and the clock are looked at once
+  // per CHUNK steps. Once any limit is exceeded, every interpreter of the
+  // run stops at its next look.
+  class Budget {
+  public:
+    static constexpr std::uint64_t CHUNK = 1024;
+
+  private:
+    RunLimits const limits;
+    std::chrono::steady_clock::time_point const deadline;
+    std::atomic<std::uint64_t> steps;  // Not yet handed out
+    std::atomic<std::uint64_t> output; // Bytes that may still be printed
+    std::atomic<bool> exceeded = false;
+
+    auto stop(std::string const &limit) -> std::unexpected<ReportError> {
+      exceeded = true;
+      return std::unexpected(ReportError{limit + " limit exceeded."});
+    }
+
+    // Takes up to `wanted` from `left`, or nothing once it's empty
+    static auto take(std::atomic<std::uint64_t> &left, std::uint64_t wanted)
+        -> std::uint64_t {
+      auto available = left.load(std::memory_order_relaxed);
+      auto taken = std::min(available, wanted);
+      while (taken != 0 &&
+             !left.compare_exchange_weak(available, available - taken,
+                                         std::memory_order_relaxed)) {
+        taken = std::min(available, wanted);
+      }
+      return taken;
+    }
+
+  public:
+    explicit Budget(RunLimits limits)
+        : limits{limits},
+          deadline{std::chrono::steady_clock::now() + limits.time},
+          steps{limits.steps}, output{limits.outputBytes} {}
+
+    [[nodiscard]] auto heapLimit() const -> std::uint64_t {
+      return limits.heapBytes;
+    }
+
+    [[nodiscard]] auto wasExceeded() const -> bool { return exceeded; }
+
+    // Fails once the run has exceeded a limit or run out of time
+    auto check() -> Result<void> {
+      if (exceeded.load(std::memory_order_relaxed)) {
+        return std::unexpected(ReportError{"Run stopped at a limit."});
+      }
+      if (limits.time.count() != 0 &&
+          std::chrono::steady_clock::now() > deadline) {
+        return stop("Time");
+      }
+      return {};
+    }
+
+    // Hands out up to CHUNK more steps
+    auto grant() -> Result<std::uint64_t> {
+      TRY(check());
+      if (limits.steps == 0) {
+        return CHUNK;
+      }
+      if (auto const granted = take(steps, CHUNK)) {
+        return granted;
+      }
+      return stop("Step");
+    }
+
+    // The heap on the calling thread has grown by `growth` bytes this run
+    auto checkHeap(std::int64_t growth) -> Result<void> {
+      if (limits.heapBytes != 0 &&
+          growth > static_cast<std::int64_t>(limits.heapBytes)) {
+        return stop("Heap");
+      }
+      return {};
+    }
+
+    // Called before printing `bytes`; nothing more is printed once it fails
+    auto chargeOutput(std::size_t bytes) -> Result<void> {
+      if (limits.outputBytes == 0) {
+        return {};
+      }
+      if (take(output, bytes) < bytes) {
+        output = 0;
+        return stop("Output");
+      }
+      return {};
+    }
+  };
+} // namespace lox
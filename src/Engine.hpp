@@ -0,0 +1,221 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AstCache.hpp"
+#include "Budget.hpp"
+#include "Environment.hpp"
+#include "Interpreter.hpp"
+#include "ModuleCache.hpp"
+#include "Native.hpp"
+#include "OutputSink.hpp"
+#include "Parser.hpp"
+#include "Profiler.hpp"
+#include "Report.hpp"
+#include "Scanner.hpp"
+#include "Snapshot.hpp"
+#include "Stats.hpp"
+
+namespace lox {
+  // Optional instrumentation and caching for a run; all off by default
+  struct RunOptions {
+    RunStats *stats = nullptr;            // Per-phase timings and allocations
+    Profiler *profiler = nullptr;         // Per-line interpreter time
+    AstCache const *cache = nullptr;      // Parsed programs reused across runs
+    bool memoize = false;                 // Pure functions reuse their results
+    RunLimits limits = {};                // Steps, time, heap and output
+    std::filesystem::path directory = {}; // Imports are relative to it
+    // The script's own file, which imports of it don't run again
+    std::filesystem::path file = {};
+    // Globals to run against, e.g. a Prelude's; a fresh scope when null
+    std::shared_ptr<Environment> globals = nullptr;
+  };
+
+  enum class RunStatus {
+    SUCCESS,
+    COMPILE_ERROR,
+    RUNTIME_ERROR,
+    LIMIT_EXCEEDED
+  };
+
+  struct RunResult {
+    RunStatus status = RunStatus::SUCCESS;
+    std::vector<ReportError> errors;
+  };
+
+  // Scans, parses and interprets scripts into its own output sink. An engine
+  // holds no state shared with other engines, so separate engines can run on
+  // separate threads at once. The objects behind `options` (stats,
+  // profiler, globals) belong to whoever set them and must not be shared
+  // between concurrently running engines; the cache may be.
+  class Engine {
+  public:
+    using Program = std::vector<std::unique_ptr<stmt::Stmt>>;
+
+  private:
+    std::shared_ptr<OutputSink> const output;
+    RunOptions const options;
+
+    auto scanAndParse(std::string const &source)
+        -> std::expected<Program, std::vector<ReportError>> {
+      auto *const stats = options.stats;
+
+      /* #region Scanning */
+      auto [tokens, scannerReport] =
+          RunStats::measure(stats ? &stats->scanner : nullptr, [&] {
+            auto scanner = lox::Scanner(source);
+            return scanner.scanTokens();
+          });
+
+      if (scannerReport.status == ScannerStatus::HAS_ERRORS) {
+        return std::unexpected(std::move(scannerReport.errors));
+      }
+      /* #endregion */
+
+      /* #region Parsing */
+      auto [statements, parsingReport] =
+          RunStats::measure(stats ? &stats->parser : nullptr, [&] {
+            auto parser = lox::Parser{tokens};
+            return parser.parse();
+          });
+
+      if (parsingReport.status == ParserStatus::HAS_ERRORS) {
+        return std::unexpected(std::move(parsingReport.errors));
+      }
+      /* #endregion */
+
+      if (stats != nullptr) {
+        stats->tokenCount = tokens.size();
+      }
+
+      return std::move(statements);
+    }
+
+  public:
+    explicit Engine(std::shared_ptr<OutputSink> output, RunOptions options = {})
+        : output{std::move(output)}, options{std::move(options)} {}
+
+    // Waits for the modules `program` imports and links it to them
+    auto link(Program program)
+        -> std::expected<Program, std::vector<ReportError>> {
+      auto &modules = ModuleCache::shared();
+      modules.link(program, options.directory);
+      if (auto errors = modules.wait(program); !errors.empty()) {
+        return std::unexpected(std::move(errors));
+      }
+      return program;
+    }
+
+    // The parsed program, from the cache when it has one for `source`
+    auto compile(std::string const &source)
+        -> std::expected<Program, std::vector<ReportError>> {
+      auto *const stats = options.stats;
+
+      // A cache hit replaces both scanning and parsing; its load time is
+      // reported as the parser's
+      if (options.cache != nullptr) {
+        auto cached = RunStats::measure(stats ? &stats->parser : nullptr, [&] {
+          return options.cache->load(source);
+        });
+        if (cached) {
+          if (stats != nullptr) {
+            stats->cached = true;
+          }
+          return link(std::move(*cached));
+        }
+      }
+
+      auto program = scanAndParse(source);
+      if (!program) {
+        return program;
+      }
+      if (options.cache != nullptr) {
+        options.cache->store(source, *program);
+      }
+      return link(std::move(*program));
+    }
+
+    auto run(std::string const &source) -> RunResult {
+      auto *const stats = options.stats;
+      if (stats != nullptr) {
+        RunStats::beginRun();
+      }
+
+      auto statements = compile(source);
+      if (!statements) {
+        if (stats != nullptr) {
+          RunStats::endRun();
+        }
+        return {RunStatus::COMPILE_ERROR, std::move(statements.error())};
+      }
+
+      /* #region Interpreter */
+      auto interpreterReport =
+          RunStats::measure(stats ? &stats->interpreter : nullptr, [&] {
+            auto interpreter =
+                options.globals ? Interpreter{output, options.globals}
+                                : Interpreter{output};
+            if (options.profiler != nullptr) {
+              options.profiler->setSource(source);
+              interpreter.setProfiler(options.profiler);
+            }
+            interpreter.setScript(ModuleCache::shared().find(options.file));
+            interpreter.setMemoize(options.memoize);
+            interpreter.setLimits(options.limits);
+            auto report = interpreter.interpret(
+                *statements | std::ranges::views::filter([](auto &stmt) {
+                  return stmt != nullptr;
+                }));
+            if (stats != nullptr) {
+              stats->memo = interpreter.memoStats();
+            }
+            return report;
+          });
+      /* #endregion */
+
+      if (stats != nullptr) {
+        RunStats::endRun();
+        stats->astNodeCount = AstNodeCounter::countAll(*statements);
+      }
+
+      if (interpreterReport.status == InterpreterStatus::HAS_ERRORS) {
+        return {RunStatus::RUNTIME_ERROR,
+                std::move(interpreterReport.errors)};
+      }
+      if (interpreterReport.status == InterpreterStatus::LIMIT_EXCEEDED) {
+        return {RunStatus::LIMIT_EXCEEDED,
+                std::move(interpreterReport.errors)};
+      }
+      return {};
+    }
+
+    // Runs `source` and keeps its program and globals alive, so later runs
+    // (or a Snapshot) can build on what it defined
+    auto runPrelude(std::string const &source)
+        -> std::expected<Prelude, RunResult> {
+      auto program = compile(source);
+      if (!program) {
+        return std::unexpected(
+            RunResult{RunStatus::COMPILE_ERROR, std::move(program.error())});
+      }
+
+      auto globals = makeGlobals();
+      auto interpreter = Interpreter{output, globals};
+      interpreter.setScript(ModuleCache::shared().find(options.file));
+      auto report = interpreter.interpret(*program);
+      if (report.status == InterpreterStatus::HAS_ERRORS) {
+        return std::unexpected(
+            RunResult{RunStatus::RUNTIME_ERROR, std::move(report.errors)});
+      }
+
+      return Prelude{std::move(*program), std::move(globals)};
+    }
+  };
+} // namespace lox
@@ -1,51 +1,199 @@
 #pragma once
 
 #include <any>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include "Arena.hpp"
 #include "Report.hpp"
 #include "Token.hpp"
 
 namespace lox {
+  // Where a global lives, cached on a Variable or Assign node that can only
+  // name a global (see Resolver): the id of the global scope it was found
+  // in, then its slot there. Both go in one word, so tasks sharing the node
+  // never read half of an update; a slot never moves once assigned.
+  class SlotCache {
+  private:
+    std::atomic<std::uint64_t> key{0};
+
+  public:
+    SlotCache() = default;
+    // A copy starts out empty; the cache is only ever a hint
+    SlotCache(SlotCache const & /*other*/) {}
+    auto operator=(SlotCache const & /*other*/) -> SlotCache & {
+      return *this;
+    }
+    ~SlotCache() = default;
+
+    // -1 unless the slot was cached for the scope with id `scope`
+    [[nodiscard]] auto find(std::uint32_t scope) const -> std::int64_t {
+      auto const cached = key.load(std::memory_order_relaxed);
+      return cached >> 32U == scope
+                 ? static_cast<std::int64_t>(cached & 0xffffffffU)
+                 : -1;
+    }
+
+    auto insert(std::uint32_t scope, std::uint32_t slot) -> void {
+      key.store(std::uint64_t{scope} << 32U | slot, std::memory_order_relaxed);
+    }
+  };
+
   class Environment {
   private:
-    Environment *const enclosing; // Enclosing scope is a raw pointer because
-                                  // this environment doesn't own its parent.
-                                  // Parent's lifetime should exceed this
-    std::unordered_map<std::string, LiteralVal> values;
+    friend class DeepCopier;
+    friend class Snapshot;
+
+    static auto inline nextId() -> std::uint32_t {
+      static std::atomic<std::uint32_t> counter{0};
+      return ++counter; // 0 is reserved for scopes that aren't global
+    }
+
+    // Set on a run's global scope; declared first so it goes last
+    std::unique_ptr<Arena, Arena::Release> arena;
+    // Shared because closures keep their defining scope alive after the block
+    // that created it has finished executing
+    std::shared_ptr<Environment> const enclosing;
+    // The scope at the end of the chain, which `enclosing` keeps alive
+    Environment *const global;
+    std::uint32_t const id;
+    // Where this scope and those nested in it allocate
+    std::pmr::memory_resource *const memory;
+    // Not std::hash<std::string>: for that libstdc++ skips hashing in maps of
+    // up to 20 entries and compares the name against each of them, which is
+    // slow for a global scope that starts out holding all the natives
+    struct NameHash {
+      auto operator()(std::string const &name) const -> std::size_t {
+        return std::hash<std::string_view>{}(name);
+      }
+    };
+
+    // Values are stored densely in order of definition; `slots` maps each
+    // name to its index in `values`. Redefining a name reuses its slot.
+    std::pmr::unordered_map<std::string, std::uint32_t, NameHash> slots;
+    std::pmr::vector<LiteralVal> values;
+
+    [[nodiscard]] auto local(std::string const &name) const
+        -> LiteralVal const * {
+      auto found = slots.find(name);
+      return found == slots.end() ? nullptr : &values[found->second];
+    }
+
+    Environment(std::unique_ptr<Arena, Arena::Release> arena)
+        : arena{std::move(arena)}, global{this}, id{nextId()},
+          memory{this->arena.get()}, slots{memory}, values{memory} {}
 
   public:
-    Environment() : enclosing{nullptr} {}
-    Environment(Environment *enclosing) : enclosing{enclosing} {}
+    Environment() : Environment{std::shared_ptr<Environment>{}} {}
+    Environment(std::shared_ptr<Environment> enclosing)
+        : enclosing{std::move(enclosing)},
+          global{this->enclosing ? this->enclosing->global : this},
+          id{this->enclosing ? 0 : nextId()},
+          memory{this->enclosing ? this->enclosing->memory
+                                 : std::pmr::get_default_resource()},
+          slots{memory}, values{memory} {}
+
+    // A global scope for a run, whose nested scopes come from its Arena
+    static auto withArena() -> std::shared_ptr<Environment> {
+      return std::shared_ptr<Environment>{new Environment{Arena::create()}};
+    }
+
+    // A scope nested in `enclosing`, allocated where it allocates
+    static auto nested(std::shared_ptr<Environment> enclosing)
+        -> std::shared_ptr<Environment> {
+      auto allocator =
+          std::pmr::polymorphic_allocator<Environment>{enclosing->memory};
+      return std::allocate_shared<Environment>(allocator, std::move(enclosing));
+    }
 
     auto define(std::string const &name, LiteralVal const &value) {
-      values[name] = value;
+      auto [found, added] =
+          slots.try_emplace(name, static_cast<std::uint32_t>(values.size()));
+      if (added) {
+        values.push_back(value);
+      } else {
+        values[found->second] = value;
+      }
     }
 
-    [[nodiscard]] auto get(Token const &name) const -> LiteralVal {
-      if (values.contains(name.lexeme)) {
-        return values.at(name.lexeme);
+    [[nodiscard]] auto get(Token const &name) const -> Result<LiteralVal> {
+      if (auto const *value = find(name.lexeme)) {
+        return *value;
       }
 
-      if (enclosing != nullptr) {
-        return enclosing->get(name);
+      return std::unexpected(undefined(name));
+    }
+
+    static auto undefined(Token const &name) -> ReportError {
+      return ReportError(name, "Undefined variable '" + name.lexeme + "'.");
+    }
+
+    // The global scope this one is nested in, or itself
+    [[nodiscard]] auto globalScope() const -> Environment & { return *global; }
+
+    // A global of this scope, found through `cache` once a lookup has filled
+    // it in; nullptr if `name` isn't defined. Only for the global scope.
+    auto slot(Token const &name, SlotCache &cache) -> LiteralVal * {
+      if (auto const cached = cache.find(id); cached >= 0) [[likely]] {
+        return &values[cached];
+      }
+      auto found = slots.find(name.lexeme);
+      if (found == slots.end()) {
+        return nullptr;
       }
+      cache.insert(id, found->second);
+      return &values[found->second];
+    }
 
-      throw ReportError(name, "Undefined variable '" + name.lexeme + "'.");
+    // Calls visit(name, value) for each variable, in order of definition
+    template <typename Visit> auto forEach(Visit visit) const -> void {
+      auto names = std::vector<std::string const *>(values.size());
+      for (auto const &[name, slot] : slots) {
+        names[slot] = &name;
+      }
+      for (std::size_t slot = 0; slot < values.size(); slot++) {
+        visit(*names[slot], values[slot]);
+      }
     }
 
-    auto assign(Token const &name, LiteralVal const &value) {
-      if (values.contains(name.lexeme)) {
-        values[name.lexeme] = value;
-        return;
+    [[nodiscard]] auto size() const -> std::size_t { return values.size(); }
+
+    // Nullptr if `name` isn't defined here or in an enclosing scope
+    [[nodiscard]] auto find(std::string const &name) const
+        -> LiteralVal const * {
+      for (auto const *scope = this; scope != nullptr;
+           scope = scope->enclosing.get()) {
+        if (auto const *value = scope->local(name)) {
+          return value;
+        }
       }
+      return nullptr;
+    }
+
+    // Reads a variable TypeInference proved is defined and holds a number
+    [[nodiscard]] auto number(Token const &name) const -> double {
+      return std::get<double>(*find(name.lexeme));
+    }
 
-      if (enclosing != nullptr) {
-        enclosing->assign(name, value);
+    auto assign(Token const &name, LiteralVal const &value) -> Result<void> {
+      for (auto *scope = this; scope != nullptr;
+           scope = scope->enclosing.get()) {
+        if (auto found = scope->slots.find(name.lexeme);
+            found != scope->slots.end()) {
+          scope->values[found->second] = value;
+          return {};
+        }
       }
 
-      throw ReportError(name, "Undefined variable '" + name.lexeme + "'.");
+      return std::unexpected(undefined(name));
     }
   };
 } // namespace lox
\ No newline at end of file
@@ -2,50 +2,81 @@
 
 #include <any>
 #include <memory>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include "Environment.hpp"
+#include "Shape.hpp"
 #include "Token.hpp"
 
 namespace lox::expr {
   /* #region Forward declarations */
+  struct Array;
   struct Assign;
   struct Binary;
   struct Call;
   struct Get;
   struct Grouping;
+  struct Index;
   struct Literal;
   struct Logical;
   struct Set;
+  struct SetIndex;
   struct Super;
   struct This;
   struct Unary;
   struct Variable;
 
-  using Expr = std::variant<Assign, Binary, Call, Get, Grouping, Literal,
-                            Logical, Set, Super, This, Unary, Variable>;
+  using Expr =
+      std::variant<Array, Assign, Binary, Call, Get, Grouping, Index, Literal,
+                   Logical, Set, SetIndex, Super, This, Unary, Variable>;
   /* #endregion */
+} // namespace lox::expr
+
+// Frees a tree from a work list instead of letting each node's destructor
+// free its children, which would recurse once per level of nesting. Child
+// pointers aren't const so it can detach them first.
+template <> struct std::default_delete<lox::expr::Expr> {
+  auto operator()(lox::expr::Expr *expr) const -> void;
+};
+
+namespace lox::expr {
+
+  // `[a, b, c]`
+  struct Array {
+    Token const bracket;
+    std::vector<std::unique_ptr<Expr>> elements;
+
+    Array(Token bracket, std::vector<std::unique_ptr<Expr>> elements)
+        : bracket{std::move(bracket)}, elements{std::move(elements)} {}
+  };
 
   struct Assign {
     Token const name;
-    std::unique_ptr<Expr> const value;
+    std::unique_ptr<Expr> value;
+    // Set by Resolver when no enclosing scope can declare `name`
+    mutable bool global = false;
+    mutable SlotCache slot;
 
     Assign(Token name, std::unique_ptr<Expr> &value)
         : name{std::move(name)}, value{std::move(value)} {}
   };
 
   struct Binary {
-    std::unique_ptr<Expr> const left, right;
+    std::unique_ptr<Expr> left, right;
     Token const op;
+    // Set by TypeInference when both operands always evaluate to numbers
+    mutable bool numberOperands = false;
 
     Binary(std::unique_ptr<Expr> &left, Token op, std::unique_ptr<Expr> &right)
         : left{std::move(left)}, op{std::move(op)}, right{std::move(right)} {}
   };
 
   struct Call {
-    std::unique_ptr<Expr> const callee;
-    std::vector<std::unique_ptr<Expr>> const arguments;
+    std::unique_ptr<Expr> callee;
+    std::vector<std::unique_ptr<Expr>> arguments;
     Token const paren;
 
     Call(std::unique_ptr<Expr> &callee, Token paren,
@@ -55,20 +86,32 @@ namespace lox::expr {
   };
 
   struct Get {
-    std::unique_ptr<Expr> const object;
+    std::unique_ptr<Expr> object;
     Token const name;
+    mutable InlineCache cache;
 
     Get(std::unique_ptr<Expr> &object, Token name)
         : object{std::move(object)}, name{std::move(name)} {}
   };
 
   struct Grouping {
-    std::unique_ptr<Expr> const expression;
+    std::unique_ptr<Expr> expression;
 
     Grouping(std::unique_ptr<Expr> &expression)
         : expression{std::move(expression)} {}
   };
 
+  // `object[index]`
+  struct Index {
+    std::unique_ptr<Expr> object, index;
+    Token const bracket;
+
+    Index(std::unique_ptr<Expr> &object, Token bracket,
+          std::unique_ptr<Expr> &index)
+        : object{std::move(object)}, index{std::move(index)},
+          bracket{std::move(bracket)} {}
+  };
+
   struct Literal {
     LiteralVal const value;
 
@@ -76,7 +119,7 @@ namespace lox::expr {
   };
 
   struct Logical {
-    std::unique_ptr<Expr> const left, right;
+    std::unique_ptr<Expr> left, right;
     Token const op;
 
     Logical(std::unique_ptr<Expr> &left, Token op, std::unique_ptr<Expr> &right)
@@ -84,14 +127,26 @@ namespace lox::expr {
   };
 
   struct Set {
-    std::unique_ptr<Expr> const object, value;
+    std::unique_ptr<Expr> object, value;
     Token const name;
+    mutable InlineCache cache;
 
     Set(std::unique_ptr<Expr> &object, Token name, std::unique_ptr<Expr> &value)
         : object{std::move(object)}, name{std::move(name)},
           value{std::move(value)} {}
   };
 
+  // `object[index] = value`
+  struct SetIndex {
+    std::unique_ptr<Expr> object, index, value;
+    Token const bracket;
+
+    SetIndex(std::unique_ptr<Expr> &object, Token bracket,
+             std::unique_ptr<Expr> &index, std::unique_ptr<Expr> &value)
+        : object{std::move(object)}, index{std::move(index)},
+          value{std::move(value)}, bracket{std::move(bracket)} {}
+  };
+
   struct Super {
     Token const keyword, method;
 
@@ -106,8 +161,10 @@ namespace lox::expr {
   };
 
   struct Unary {
-    std::unique_ptr<Expr> const right;
+    std::unique_ptr<Expr> right;
     Token const op;
+    // Set by TypeInference when the operand always evaluates to a number
+    mutable bool numberOperand = false;
 
     Unary(Token op, std::unique_ptr<Expr> &right)
         : op{std::move(op)}, right{std::move(right)} {}
@@ -115,7 +172,74 @@ namespace lox::expr {
 
   struct Variable {
     Token const name;
+    // Set by Resolver when no enclosing scope can declare `name`
+    mutable bool global = false;
+    mutable SlotCache slot;
 
     Variable(Token name) : name{std::move(name)} {}
   };
-} // namespace lox::expr
\ No newline at end of file
+
+  // Calls visit(child) on each of `expr`'s child pointers, left to right.
+  // `Node` is Expr or Expr const.
+  template <typename Node, typename Visit>
+    requires std::is_same_v<std::remove_const_t<Node>, Expr>
+  auto forEachChild(Node &expr, Visit visit) -> void {
+    std::visit(
+        [&]<typename Kind>(Kind &node) {
+          using Type = std::remove_const_t<Kind>;
+          if constexpr (std::is_same_v<Type, Array>) {
+            for (auto &element : node.elements) {
+              visit(element);
+            }
+          } else if constexpr (std::is_same_v<Type, Assign>) {
+            visit(node.value);
+          } else if constexpr (std::is_same_v<Type, Binary> ||
+                               std::is_same_v<Type, Logical>) {
+            visit(node.left);
+            visit(node.right);
+          } else if constexpr (std::is_same_v<Type, Call>) {
+            visit(node.callee);
+            for (auto &argument : node.arguments) {
+              visit(argument);
+            }
+          } else if constexpr (std::is_same_v<Type, Get>) {
+            visit(node.object);
+          } else if constexpr (std::is_same_v<Type, Grouping>) {
+            visit(node.expression);
+          } else if constexpr (std::is_same_v<Type, Index>) {
+            visit(node.object);
+            visit(node.index);
+          } else if constexpr (std::is_same_v<Type, Set>) {
+            visit(node.object);
+            visit(node.value);
+          } else if constexpr (std::is_same_v<Type, SetIndex>) {
+            visit(node.object);
+            visit(node.index);
+            visit(node.value);
+          } else if constexpr (std::is_same_v<Type, Unary>) {
+            visit(node.right);
+          }
+        },
+        expr);
+  }
+} // namespace lox::expr
+
+inline auto std::default_delete<lox::expr::Expr>::operator()(
+    lox::expr::Expr *expr) const -> void {
+  auto pending = std::vector<lox::expr::Expr *>{};
+  while (true) {
+    lox::expr::forEachChild(
+        *expr, [&](std::unique_ptr<lox::expr::Expr> &child) {
+          if (child) {
+            pending.push_back(child.release());
+          }
+        });
+    delete expr; // Its children are detached: nothing left to recurse into
+
+    if (pending.empty()) {
+      return;
+    }
+    expr = pending.back();
+    pending.pop_back();
+  }
+}
\ No newline at end of file
@@ -1,197 +1,836 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
 #include <initializer_list>
-#include <iostream>
+#include <limits>
 #include <memory>
 #include <optional>
-#include <stdexcept>
+#include <span>
 #include <string>
+#include <string_view>
 #include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include <pthread.h>
+
+#include "AllocationCounter.hpp"
+#include "Budget.hpp"
 #include "Environment.hpp"
 #include "Expr.hpp"
+#include "LoxArray.hpp"
+#include "LoxCallable.hpp"
+#include "LoxClass.hpp"
+#include "LoxFunction.hpp"
+#include "LoxGenerator.hpp"
+#include "LoxInstance.hpp"
+#include "LoxMap.hpp"
+#include "MemoCache.hpp"
+#include "ModuleCache.hpp"
+#include "Native.hpp"
+#include "OutputSink.hpp"
 #include "Parser.hpp"
+#include "Profiler.hpp"
+#include "Purity.hpp"
 #include "Report.hpp"
+#include "Resolver.hpp"
+#include "Stats.hpp"
 #include "Stmt.hpp"
 #include "Token.hpp"
+#include "Tracing.hpp"
+#include "TypeInference.hpp"
 #include "utils.hpp"
 
 namespace lox {
-  enum class InterpreterStatus { UNPROCESSED, SUCCESS, HAS_ERRORS };
+  enum class InterpreterStatus {
+    UNPROCESSED,
+    SUCCESS,
+    HAS_ERRORS,
+    LIMIT_EXCEEDED
+  };
 
-  class Interpreter {
+  // Runs programs. `Policy` (see Tracing.hpp) adds hooks for tracing and
+  // checking at compile time; every other file uses the Interpreter alias,
+  // the instantiation the build picked.
+  template <typename Policy> class BasicInterpreter {
   private:
-    std::unique_ptr<Environment> environment = std::make_unique<Environment>();
+    std::shared_ptr<Environment> const globals = makeGlobals();
+    std::shared_ptr<Environment> environment = globals;
+    std::shared_ptr<OutputSink> const output;
+
+    // Set by a `return` statement and checked by every statement list so the
+    // enclosing function call can unwind without throwing
+    std::optional<LiteralVal> returnValue;
+
+    Profiler *profiler = nullptr;
+
+    bool memoize = false;
+    MemoCounts memoCounts;
+
+    // evaluate() recurses through nested expressions until it has used this
+    // much C++ stack, then hands the rest of the expression to
+    // evaluateDeep(). Comparing the frame address against a limit costs a
+    // load and a compare, where counting levels would cost a store on the
+    // way in and out of every node. The limit is reset for each call so
+    // deep Lox recursion doesn't push every callee onto the slower path.
+    static constexpr std::uintptr_t RECURSION_STACK = 256 * 1024;
+    std::uintptr_t stackLimit = stackLimitHere();
+
+    // Roughly where the stack pointer is. The address of a local rather
+    // than __builtin_frame_address(), which would make every function
+    // evaluate() is inlined into set up a frame pointer.
+    [[gnu::always_inline]] static auto stackPosition() -> std::uintptr_t {
+      auto marker = char{};
+      return reinterpret_cast<std::uintptr_t>(&marker);
+    }
+
+    static auto stackLimitHere() -> std::uintptr_t {
+      return stackPosition() - RECURSION_STACK;
+    }
+
+    // Calls past this point fail with "Stack overflow." instead of running
+    // off the end of the thread's stack. What's left below it covers one
+    // callee's expressions up to stackLimit and the natives they call.
+    static constexpr std::uintptr_t STACK_RESERVE = 4 * RECURSION_STACK;
+    std::uintptr_t stackFloor = stackFloorHere();
+
+    static auto stackFloorHere() -> std::uintptr_t {
+      auto attributes = pthread_attr_t{};
+      void *lowest = nullptr;
+      auto size = std::size_t{};
+      auto const known =
+          pthread_getattr_np(pthread_self(), &attributes) == 0 &&
+          pthread_attr_getstack(&attributes, &lowest, &size) == 0;
+      if (known) {
+        pthread_attr_destroy(&attributes);
+      }
+      auto const here = stackPosition();
+      auto const bottom = reinterpret_cast<std::uintptr_t>(lowest);
+      if (!known || here < bottom || here - bottom > size) {
+        // Not this thread's stack, so assume the smallest one we'd run on
+        return here - std::min(here, 2 * STACK_RESERVE) + STACK_RESERVE;
+      }
+      return bottom + STACK_RESERVE;
+    }
+
+    // Tasks spawned by this run, shared with the interpreters running them
+    std::shared_ptr<TaskGroup> tasks;
+
+    // Modules already run; importing one again does nothing
+    std::unordered_set<Module const *> imported;
+
+    // The run's limits, shared with the interpreters running its tasks; null
+    // without any. `fuel` counts down the steps until they're looked at
+    // again, which without limits never comes. `drawn` holds steps granted
+    // by the budget but not yet put in `fuel`.
+    std::shared_ptr<Budget> budget;
+    std::uint64_t fuel = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t drawn = 0;
+    std::int64_t heapBaseline = 0;
+
+    // Counts a loop iteration or a call against the run's limits
+    auto inline step() -> Result<void> {
+      if (--fuel == 0) [[unlikely]] {
+        return refuel();
+      }
+      return {};
+    }
+
+    // With a heap limit the heap is looked at after every step, as a single
+    // step can double a string; steps still come a chunk at a time
+    [[gnu::noinline, gnu::cold]] auto refuel() -> Result<void> {
+      if (budget == nullptr) {
+        fuel = std::numeric_limits<std::uint64_t>::max();
+        return {};
+      }
+      if (drawn == 0) {
+        drawn = TRY(budget->grant());
+      }
+      fuel = drawn;
+      if (budget->heapLimit() != 0) {
+        TRY(budget->checkHeap(AllocationCounter::current().liveBytes -
+                              heapBaseline));
+        fuel = 1;
+      }
+      drawn -= fuel;
+      return {};
+    }
 
     static auto inline isTruthy(LiteralVal const &object) {
       return std::visit(
-          overloaded{[](std::monostate const &arg) { return false; },
+          overloaded{[](std::monostate const & /*nil*/) { return false; },
                      [](std::string const &arg) { return !arg.empty(); },
                      [](bool const &arg) { return arg; },
-                     [](double const &arg) { return arg != 0; }},
+                     [](double const &arg) { return arg != 0; },
+                     [](auto const & /*object*/) { return true; }},
           object);
     }
 
+    // The same equality maps use for their keys
     static auto inline isEqual(LiteralVal const &a, LiteralVal const &b) {
-      // If both null
-      if (std::holds_alternative<std::monostate>(a) &&
-          std::holds_alternative<std::monostate>(b)) {
-        return true;
+      return ValueEqual{}(a, b);
+    }
+
+    // A failed operand type check
+    static auto typeError(Token const &op, std::string message)
+        -> std::unexpected<ReportError> {
+      auto error = ReportError(op, std::move(message));
+      if constexpr (Policy::ENABLED) {
+        Policy::typeError(error);
+      }
+      return std::unexpected(std::move(error));
+    }
+
+    static auto checkNumberOperand(Token const &op, LiteralVal const &operand)
+        -> Result<void> {
+      if (std::holds_alternative<double>(operand)) {
+        return {};
       }
 
-      // If only a is null
-      if (std::holds_alternative<std::monostate>(a)) {
-        return false;
+      return typeError(op, "Operand must be a number.");
+    }
+
+    static auto inline areNumbers(LiteralVal const &left,
+                                  LiteralVal const &right) {
+      return std::holds_alternative<double>(left) &&
+             std::holds_alternative<double>(right);
+    }
+
+    static auto inline isArray(LiteralVal const &value) {
+      return std::holds_alternative<std::shared_ptr<LoxArray>>(value);
+    }
+
+    static auto checkNumberOperands(Token const &op, LiteralVal const &left,
+                                    LiteralVal const &right) -> Result<void> {
+      if (std::holds_alternative<double>(left) &&
+          std::holds_alternative<double>(right)) {
+        return {};
       }
 
-      // If a and b are strings
-      if (std::holds_alternative<std::string>(a) &&
-          std::holds_alternative<std::string>(b)) {
-        return std::get<std::string>(a) == std::get<std::string>(a);
+      return typeError(op, "Operands must be numbers.");
+    }
+
+    // The element of `array` that `index` names, which must be a whole
+    // number below its length
+    static auto checkIndex(Token const &bracket, LoxArray const &array,
+                           LiteralVal const &index) -> Result<std::size_t> {
+      auto const *number = std::get_if<double>(&index);
+      if (number == nullptr) {
+        return typeError(bracket, "Array index must be a number.");
       }
 
-      // If a and b are doubles
-      if (std::holds_alternative<double>(a) &&
-          std::holds_alternative<double>(b)) {
-        return std::get<double>(a) == std::get<double>(a);
+      if (std::trunc(*number) != *number) { // Also catches NaN
+        return std::unexpected(
+            ReportError(bracket, "Array index must be a whole number."));
       }
 
-      // If a and b are bools
-      if (std::holds_alternative<bool>(a) && std::holds_alternative<bool>(b)) {
-        return std::get<bool>(a) == std::get<bool>(a);
+      if (*number < 0 || *number >= static_cast<double>(array.size())) {
+        auto buffer = std::array<char, 32>{};
+        return std::unexpected(ReportError(
+            bracket, "Index " + std::string{formatNumber(*number, buffer)} +
+                         " is out of bounds for an array of length " +
+                         std::to_string(array.size()) + "."));
       }
 
-      return false;
+      return static_cast<std::size_t>(*number);
     }
-    static auto validateOpIsNumberThrows(Token op, LiteralVal const &operand) {
-      if (std::holds_alternative<double>(operand)) {
-        return;
+
+    // Arithmetic with an array of numbers on either side, done by the bulk
+    // kernels: two arrays of the same length combine element by element, an
+    // array and a number apply the number to every element. The result is
+    // a new array.
+    template <typename Op>
+    static auto elementwise(Token const &op, LiteralVal const &left,
+                            LiteralVal const &right, Op apply)
+        -> Result<LiteralVal> {
+      auto const numbersOf = [](LiteralVal const &value) {
+        auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&value);
+        return array != nullptr ? (*array)->numbers() : nullptr;
+      };
+      auto const *leftNumbers = numbersOf(left);
+      auto const *rightNumbers = numbersOf(right);
+      auto const *leftNumber = std::get_if<double>(&left);
+      auto const *rightNumber = std::get_if<double>(&right);
+
+      auto out = std::vector<double>{};
+      if (leftNumbers != nullptr && rightNumbers != nullptr) {
+        if (leftNumbers->size() != rightNumbers->size()) {
+          return std::unexpected(
+              ReportError(op, "Arrays must have the same length."));
+        }
+        out.resize(leftNumbers->size());
+        kernels::zip(*leftNumbers, *rightNumbers, out, apply);
+      } else if (leftNumbers != nullptr && rightNumber != nullptr) {
+        out.resize(leftNumbers->size());
+        kernels::map(*leftNumbers, *rightNumber, false, out, apply);
+      } else if (leftNumber != nullptr && rightNumbers != nullptr) {
+        out.resize(rightNumbers->size());
+        kernels::map(*rightNumbers, *leftNumber, true, out, apply);
+      } else {
+        return typeError(
+            op, isArray(left) || isArray(right)
+                    ? "Operands must be numbers or arrays of numbers."
+                    : "Operands must be numbers.");
       }
 
-      throw ReportError(std::move(op), "Operand must be a number");
+      return std::make_shared<LoxArray>(std::move(out));
     }
 
-    static auto validateOpIsNumberThrows(Token op, LiteralVal const &left,
-                                         LiteralVal const &right) {
-      if (std::holds_alternative<double>(left) &&
-          std::holds_alternative<double>(right)) {
-        return;
+    // Writes straight into the sink; strings and numbers, which is nearly
+    // everything printed, don't build an intermediate std::string
+    auto print(LiteralVal const &obj) -> Result<void> {
+      auto buffer = std::array<char, 32>{};
+      auto built = std::string{};
+      auto text = std::string_view{};
+      if (auto const *string = std::get_if<std::string>(&obj)) {
+        text = *string;
+      } else if (auto const *number = std::get_if<double>(&obj)) {
+        text = formatNumber(*number, buffer);
+      } else {
+        built = to_string(obj);
+        text = built;
+      }
+
+      if (budget != nullptr) {
+        TRY(budget->chargeOutput(text.size() + 1));
+      }
+      output->write(text);
+      output->endLine();
+      return {};
+    }
+
+    auto inline evaluate(expr::Expr const &expr) -> Result<LiteralVal> {
+      if (stackPosition() < stackLimit) [[unlikely]] {
+        return evaluateDeep(expr);
+      }
+      if (profiler != nullptr) [[unlikely]] {
+        profiler->countVisit();
       }
 
-      throw ReportError(std::move(op), "Operands must be numbers.");
+      return dispatch(expr);
     }
 
-    static auto stringify(LiteralVal const &obj) {
-      // Special handling to remove decimal from 0.0 double
-      if (std::holds_alternative<double>(obj)) {
+    // Visits `node`, between the policy's hooks if it has any
+    template <typename Node>
+    [[gnu::always_inline]] auto dispatch(Node const &node) {
+      if constexpr (Policy::ENABLED) {
+        Policy::enter(node);
+        auto result =
+            std::visit([this](auto &&arg) { return (*this)(arg); }, node);
+        Policy::exit(node, !result);
+        return result;
+      } else {
+        return std::visit([this](auto &&arg) { return (*this)(arg); }, node);
+      }
+    }
 
-        auto text = to_string(obj);
-        if (text.ends_with(".0")) {
-          text = text.substr(0, text.length() - 2);
+    // Evaluates an expression TypeInference proved is a number: no type
+    // checks, and no Result or LiteralVal around each intermediate value
+    auto evaluateNumber(expr::Expr const &expr) -> double {
+      if (stackPosition() < stackLimit) [[unlikely]] {
+        return std::get<double>(evaluateDeep(expr).value());
+      }
+      if (profiler != nullptr) [[unlikely]] {
+        profiler->countVisit();
+      }
+
+      if constexpr (Policy::ENABLED) {
+        Policy::enter(expr);
+        auto const number = numberOf(expr);
+        Policy::exit(expr, false);
+        return number;
+      } else {
+        return numberOf(expr);
+      }
+    }
+
+    [[gnu::always_inline]] auto numberOf(expr::Expr const &expr) -> double {
+      switch (expr.index()) {
+        case variant_index_v<expr::Expr, expr::Literal>:
+          return std::get<double>(std::get_if<expr::Literal>(&expr)->value);
+        case variant_index_v<expr::Expr, expr::Variable>: {
+          auto const &variable = *std::get_if<expr::Variable>(&expr);
+          if constexpr (Policy::ENABLED) {
+            auto const *value = variable.global
+                                    ? globalSlot(variable.name, variable.slot)
+                                    : environment->find(variable.name.lexeme);
+            Policy::verify(std::holds_alternative<double>(*value),
+                           variable.name, "it holds a number");
+            Policy::read(variable.name, *value);
+          }
+          return variable.global
+                     ? std::get<double>(*environment->globalScope().slot(
+                           variable.name, variable.slot))
+                     : environment->number(variable.name);
+        }
+        case variant_index_v<expr::Expr, expr::Grouping>:
+          return evaluateNumber(
+              *std::get_if<expr::Grouping>(&expr)->expression);
+        case variant_index_v<expr::Expr, expr::Unary>:
+          return -evaluateNumber(*std::get_if<expr::Unary>(&expr)->right);
+        default: {
+          auto const &binary = *std::get_if<expr::Binary>(&expr);
+          return arithmetic(binary.op.type, evaluateNumber(*binary.left),
+                            evaluateNumber(*binary.right));
         }
+      }
+    }
 
-        return text;
+    static auto inline arithmetic(TokenType op, double left, double right)
+        -> double {
+      switch (op) {
+        case TokenType::PLUS:
+          return left + right;
+        case TokenType::MINUS:
+          return left - right;
+        case TokenType::STAR:
+          return left * right;
+        default:
+          return left / right;
       }
+    }
 
-      return to_string(obj);
+    // A Binary with numberOperands set, which can't fail
+    auto numberBinary(expr::Binary const &expr) -> LiteralVal {
+      auto const left = evaluateNumber(*expr.left);
+      auto const right = evaluateNumber(*expr.right);
+      switch (expr.op.type) {
+        case TokenType::GREATER:
+          return left > right;
+        case TokenType::GREATER_EQUAL:
+          return left >= right;
+        case TokenType::LESS:
+          return left < right;
+        case TokenType::LESS_EQUAL:
+          return left <= right;
+        case TokenType::BANG_EQUAL:
+          return left != right;
+        case TokenType::EQUAL_EQUAL:
+          return left == right;
+        default:
+          return arithmetic(expr.op.type, left, right);
+      }
     }
 
-    auto inline evaluate(expr::Expr &expr) {
-      return std::visit(
-          [this](auto &&arg) {
-            using T = std::decay_t<decltype(arg)>;
-            if constexpr (std::is_same_v<T, expr::Literal> ||
-                          std::is_same_v<T, expr::Logical> ||
-                          std::is_same_v<T, expr::Grouping> ||
-                          std::is_same_v<T, expr::Unary> ||
-                          std::is_same_v<T, expr::Variable> ||
-                          std::is_same_v<T, expr::Binary> ||
-                          std::is_same_v<T, expr::Assign>) {
-              return (*this)(arg);
+    // Evaluates `root` without recursing: `pending` holds the nodes being
+    // evaluated, innermost last, each with the number of steps it has
+    // taken, and `values` the results of finished children. A node takes
+    // one step per child, evaluating it by pushing it, then a last step
+    // that pops its children's values and pushes its own, so a tree of any
+    // depth needs heap in proportion and no C++ stack. It makes the same
+    // checks in the same order as the visitors below, through the helpers
+    // they share.
+    [[gnu::noinline]] auto evaluateDeep(expr::Expr const &root)
+        -> Result<LiteralVal> {
+      struct Pending {
+        expr::Expr const *expr;
+        std::size_t step = 0;
+      };
+      auto pending = std::vector<Pending>{{&root}};
+      auto values = std::vector<LiteralVal>{};
+
+      auto const push = [&](std::unique_ptr<expr::Expr> const &child) {
+        pending.push_back({child.get()});
+      };
+      auto const pop = [&] {
+        auto value = std::move(values.back());
+        values.pop_back();
+        return value;
+      };
+      auto const finish = [&](LiteralVal value) {
+        values.push_back(std::move(value));
+        pending.pop_back();
+      };
+
+      while (!pending.empty()) {
+        auto const &node = *pending.back().expr;
+        auto const step = pending.back().step++;
+        if (step == 0 && profiler != nullptr) [[unlikely]] {
+          profiler->countVisit();
+        }
+
+        switch (node.index()) {
+          case variant_index_v<expr::Expr, expr::Array>: {
+            auto const &expr = *std::get_if<expr::Array>(&node);
+            if (step < expr.elements.size()) {
+              push(expr.elements[step]);
+              break;
+            }
+            auto elements = std::vector<LiteralVal>(
+                std::make_move_iterator(values.end() - step),
+                std::make_move_iterator(values.end()));
+            values.resize(values.size() - step);
+            finish(makeArray(std::move(elements)));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Assign>: {
+            auto const &expr = *std::get_if<expr::Assign>(&node);
+            if (step == 0) {
+              push(expr.value);
+              break;
+            }
+            TRY(assignVariable(expr, values.back()));
+            pending.pop_back(); // Its value is the assigned one
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Binary>: {
+            auto const &expr = *std::get_if<expr::Binary>(&node);
+            if (step < 2) {
+              push(step == 0 ? expr.left : expr.right);
+              break;
+            }
+            auto right = pop();
+            auto left = pop();
+            finish(TRY(applyBinary(expr, left, right)));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Call>: {
+            auto const &expr = *std::get_if<expr::Call>(&node);
+            auto const count = expr.arguments.size();
+            if (step == 0) {
+              push(expr.callee);
+              break;
+            }
+            if (step <= count) {
+              push(expr.arguments[step - 1]);
+              break;
+            }
+            auto const callee =
+                values.end() - static_cast<std::ptrdiff_t>(count) - 1;
+            auto result = TRY(callValue(
+                expr, *callee, std::span{callee + 1, values.end()}));
+            values.erase(callee, values.end());
+            finish(std::move(result));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Get>: {
+            auto const &expr = *std::get_if<expr::Get>(&node);
+            if (step == 0) {
+              push(expr.object);
+              break;
+            }
+            finish(TRY(readProperty(expr, pop())));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Grouping>:
+            if (step == 0) {
+              push(std::get_if<expr::Grouping>(&node)->expression);
             } else {
-              return LiteralVal{};
+              pending.pop_back();
             }
-          },
-          expr);
-    }
+            break;
+
+          case variant_index_v<expr::Expr, expr::Index>: {
+            auto const &expr = *std::get_if<expr::Index>(&node);
+            if (step == 0) {
+              push(expr.object);
+              break;
+            }
+            if (step == 1) {
+              TRY(checkIndexable(expr.bracket, values.back()));
+              push(expr.index);
+              break;
+            }
+            auto index = pop();
+            auto object = pop();
+            finish(TRY(readIndex(expr.bracket, object, index)));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Logical>: {
+            auto const &expr = *std::get_if<expr::Logical>(&node);
+            if (step == 0) {
+              push(expr.left);
+            } else if (step == 1 && !shortCircuits(expr, values.back())) {
+              values.pop_back();
+              push(expr.right);
+            } else {
+              pending.pop_back(); // Its value is the last operand's
+            }
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Set>: {
+            auto const &expr = *std::get_if<expr::Set>(&node);
+            if (step == 0) {
+              push(expr.object);
+              break;
+            }
+            if (step == 1) {
+              TRY(checkHasFields(expr, values.back()));
+              push(expr.value);
+              break;
+            }
+            auto value = pop();
+            auto object = pop();
+            finish(writeField(expr, object, std::move(value)));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::SetIndex>: {
+            auto const &expr = *std::get_if<expr::SetIndex>(&node);
+            if (step == 0) {
+              push(expr.object);
+              break;
+            }
+            if (step == 1) {
+              TRY(checkIndexable(expr.bracket, values.back()));
+            }
+            if (step < 3) {
+              push(step == 1 ? expr.index : expr.value);
+              break;
+            }
+            auto value = pop();
+            auto index = pop();
+            auto object = pop();
+            finish(TRY(writeIndex(expr.bracket, object, index,
+                                  std::move(value))));
+            break;
+          }
 
-    auto inline execute(stmt::Stmt const &stmt) {
-      std::visit([this](auto &&arg) { return (*this)(arg); }, stmt);
+          case variant_index_v<expr::Expr, expr::Unary>: {
+            auto const &expr = *std::get_if<expr::Unary>(&node);
+            if (step == 0) {
+              push(expr.right);
+              break;
+            }
+            finish(TRY(applyUnary(expr, pop())));
+            break;
+          }
+
+          case variant_index_v<expr::Expr, expr::Literal>:
+            finish(std::get_if<expr::Literal>(&node)->value);
+            break;
+
+          case variant_index_v<expr::Expr, expr::Super>:
+            finish(TRY((*this)(*std::get_if<expr::Super>(&node))));
+            break;
+
+          case variant_index_v<expr::Expr, expr::This>:
+            finish(TRY((*this)(*std::get_if<expr::This>(&node))));
+            break;
+
+          default:
+            finish(TRY((*this)(*std::get_if<expr::Variable>(&node))));
+            break;
+        }
+      }
+
+      return std::move(values.back());
     }
 
-    auto
-    executeBlock(std::vector<std::unique_ptr<stmt::Stmt>> const &statements,
-                 std::unique_ptr<Environment> environment) {
-      auto prev = std::move(this->environment);
+    auto inline execute(stmt::Stmt const &stmt) -> Result<void> {
+      if (profiler != nullptr) [[unlikely]] {
+        return executeProfiled(stmt);
+      }
 
-      try {
-        this->environment = std::move(environment);
+      return dispatch(stmt);
+    }
 
-        std::ranges::for_each(statements,
-                              [this](auto const &stmt) { execute(*stmt); });
-      } catch (std::exception const &e) {
-        // Reset the environment on exception
-        this->environment = std::move(prev);
-        throw;
+    // Places an error that doesn't know where it happened, such as a limit
+    // running out in a print, on `node`'s line. One that reaches
+    // a call or the top level without a line is placed there instead.
+    [[gnu::noinline, gnu::cold]] static auto locate(ReportError error,
+                                                    auto const &node)
+        -> std::unexpected<ReportError> {
+      auto const line = error.line ? 0 : firstLine(node);
+      if (line == 0) {
+        return std::unexpected(std::move(error));
       }
+      auto placed = ReportError(line, std::move(error.message));
+      placed.file = std::move(error.file);
+      return std::unexpected(std::move(placed));
+    }
 
-      this->environment = std::move(prev);
+    // A statement's own line or, for a block or an `if` on a literal, the
+    // first line found in the statements it holds
+    static auto firstLine(stmt::Stmt const &stmt) -> int {
+      return std::visit([](auto const &node) { return firstLine(node); },
+                        stmt);
+    }
+    static auto firstLine(stmt::Block const &block) -> int {
+      for (auto const &inner : block.statements) {
+        if (inner != nullptr) {
+          if (auto const line = firstLine(*inner)) {
+            return line;
+          }
+        }
+      }
+      return 0;
+    }
+    static auto firstLine(stmt::If const &branch) -> int {
+      auto const line = LineFinder{}(branch);
+      return line != 0 ? line : firstLine(*branch.thenBranch);
+    }
+    static auto firstLine(auto const &stmt) -> int {
+      return LineFinder{}(stmt);
     }
 
-    /* #region Expr */
-    VISIT_EXPR(expr::Literal) { return expr.value; }
-    VISIT_EXPR(expr::Logical) {
-      auto left = evaluate(*expr.left);
+    // Kept out of line so the unprofiled execute() stays small
+    [[gnu::noinline]] auto executeProfiled(stmt::Stmt const &stmt)
+        -> Result<void> {
+      auto scope = Profiler::StatementScope{*profiler, stmt};
+      profiler->countVisit();
+      return dispatch(stmt);
+    }
+
+    auto resumeFrames(std::vector<LoxGenerator::Frame> &frames)
+        -> Result<LiteralVal> {
+      while (!frames.empty()) {
+        auto &frame = frames.back();
+        environment = frame.environment;
 
-      if (expr.op.type == TokenType::OR) {
-        if (isTruthy(left)) {
-          return left;
+        if (frame.next == frame.statements.size()) {
+          if (frame.loop != nullptr &&
+              isTruthy(TRY(evaluate(*frame.loop->condition)))) {
+            if (auto counted = step(); !counted) [[unlikely]] {
+              return std::unexpected(
+                  ReportError(frame.loop->keyword,
+                              std::move(counted.error().message)));
+            }
+            frame.next = 0;
+          } else {
+            frames.pop_back();
+          }
+          continue;
         }
-      } else {
-        if (!isTruthy(left)) {
-          return left;
+
+        // `frame` dangles once a frame is pushed below
+        auto const &stmt = *frame.statements[frame.next++];
+
+        if (auto const *yield = std::get_if<stmt::Yield>(&stmt)) {
+          return yield->value ? evaluate(*yield->value) : LiteralVal{};
+        }
+
+        if (auto const *ret = std::get_if<stmt::Return>(&stmt)) {
+          auto value = ret->value ? TRY(evaluate(*ret->value)) : LiteralVal{};
+          frames.clear();
+          return value;
+        }
+
+        if (auto const *block = std::get_if<stmt::Block>(&stmt)) {
+          frames.push_back({block->statements, 0,
+                            Environment::nested(environment)});
+        } else if (auto const *branch = std::get_if<stmt::If>(&stmt)) {
+          auto const &taken = isTruthy(TRY(evaluate(*branch->condition)))
+                                  ? branch->thenBranch
+                                  : branch->elseBranch;
+          if (taken) {
+            frames.push_back({std::span{&taken, 1}, 0, environment});
+          }
+        } else if (auto const *loop = std::get_if<stmt::While>(&stmt)) {
+          if (isTruthy(TRY(evaluate(*loop->condition)))) {
+            frames.push_back({std::span{&loop->body, 1}, 0, environment, loop});
+          }
+        } else {
+          TRY(execute(stmt));
         }
       }
 
-      return evaluate(*expr.right);
+      return LiteralVal{};
+    }
+
+    /* #region Expr */
+    // The part of each expression that comes after evaluating its operands,
+    // shared by the recursive visitors and evaluateDeep()
+    static auto makeArray(std::vector<LiteralVal> values) -> LiteralVal {
+      auto array = std::make_shared<LoxArray>(std::move(values));
+      array->numbers(); // All numbers: unboxed from the start
+      return array;
+    }
+
+    static auto checkIndexable(Token const &bracket, LiteralVal const &object)
+        -> Result<void> {
+      if (isArray(object) ||
+          std::holds_alternative<std::shared_ptr<LoxMap>>(object)) {
+        return {};
+      }
+      return std::unexpected(
+          ReportError(bracket, "Only arrays and maps can be indexed."));
+    }
+
+    // `object` passed checkIndexable()
+    static auto readIndex(Token const &bracket, LiteralVal const &object,
+                          LiteralVal const &index) -> Result<LiteralVal> {
+      if (auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&object)) {
+        return (*array)->at(TRY(checkIndex(bracket, **array, index)));
+      }
+
+      // A missing key reads as nil
+      auto const &map = std::get<std::shared_ptr<LoxMap>>(object);
+      auto const *value = map->find(index);
+      return value != nullptr ? *value : LiteralVal{};
+    }
+
+    // `object` passed checkIndexable()
+    static auto writeIndex(Token const &bracket, LiteralVal const &object,
+                           LiteralVal const &index, LiteralVal value)
+        -> Result<LiteralVal> {
+      if (auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&object)) {
+        // Checked last: evaluating the value may have resized the array
+        (*array)->set(TRY(checkIndex(bracket, **array, index)), value);
+        return value;
+      }
+
+      if (auto const *number = std::get_if<double>(&index);
+          number != nullptr && std::isnan(*number)) {
+        return std::unexpected(ReportError(bracket, "Map key can't be NaN."));
+      }
+      std::get<std::shared_ptr<LoxMap>>(object)->set(index, value);
+      return value;
+    }
+
+    static auto inline shortCircuits(expr::Logical const &expr,
+                                     LiteralVal const &left) -> bool {
+      return expr.op.type == TokenType::OR ? isTruthy(left) : !isTruthy(left);
     }
-    VISIT_EXPR(expr::Grouping) { return evaluate(*expr.expression); }
-    VISIT_EXPR(expr::Unary) {
-      auto right = evaluate(*expr.right);
 
+    static auto inline applyUnary(expr::Unary const &expr,
+                                  LiteralVal const &right)
+        -> Result<LiteralVal> {
       switch (expr.op.type) {
         case TokenType::MINUS:
+          TRY(checkNumberOperand(expr.op, right));
           return -std::get<double>(right);
         case TokenType::BANG:
           return !isTruthy(right);
         default:
-          throw std::runtime_error{"Invalid unary operator"};
+          return std::unexpected(
+              ReportError(expr.op, "Invalid unary operator."));
       }
     }
-    VISIT_EXPR(expr::Variable) { return environment->get(expr.name); }
-    VISIT_EXPR(expr::Binary) {
-      auto left = evaluate(*expr.left);
-      auto right = evaluate(*expr.right);
 
+    static auto inline applyBinary(expr::Binary const &expr,
+                                   LiteralVal const &left,
+                                   LiteralVal const &right)
+        -> Result<LiteralVal> {
       switch (expr.op.type) {
         case TokenType::GREATER:
-          validateOpIsNumberThrows(expr.op, left, right);
+          TRY(checkNumberOperands(expr.op, left, right));
           return std::get<double>(left) > std::get<double>(right);
 
         case TokenType::GREATER_EQUAL:
-          validateOpIsNumberThrows(expr.op, left, right);
+          TRY(checkNumberOperands(expr.op, left, right));
           return std::get<double>(left) >= std::get<double>(right);
 
         case TokenType::LESS:
-          validateOpIsNumberThrows(expr.op, left, right);
+          TRY(checkNumberOperands(expr.op, left, right));
           return std::get<double>(left) < std::get<double>(right);
 
         case TokenType::LESS_EQUAL:
-          validateOpIsNumberThrows(expr.op, left, right);
+          TRY(checkNumberOperands(expr.op, left, right));
           return std::get<double>(left) <= std::get<double>(right);
 
         case TokenType::BANG_EQUAL:
@@ -201,15 +840,21 @@ namespace lox {
           return isEqual(left, right);
 
         case TokenType::MINUS:
-          validateOpIsNumberThrows(expr.op, right);
+          if (!areNumbers(left, right)) [[unlikely]] {
+            return elementwise(expr.op, left, right, std::minus{});
+          }
           return std::get<double>(left) - std::get<double>(right);
 
         case TokenType::SLASH:
-          validateOpIsNumberThrows(expr.op, left, right);
+          if (!areNumbers(left, right)) [[unlikely]] {
+            return elementwise(expr.op, left, right, std::divides{});
+          }
           return std::get<double>(left) / std::get<double>(right);
 
         case TokenType::STAR:
-          validateOpIsNumberThrows(expr.op, left, right);
+          if (!areNumbers(left, right)) [[unlikely]] {
+            return elementwise(expr.op, left, right, std::multiplies{});
+          }
           return std::get<double>(left) * std::get<double>(right);
 
         case TokenType::PLUS:
@@ -225,62 +870,641 @@ namespace lox {
             return std::get<std::string>(left) + std::get<std::string>(right);
           }
 
-          throw ReportError(expr.op,
-                            "Operands must be two numbers or two strings.");
+          if (isArray(left) || isArray(right)) {
+            return elementwise(expr.op, left, right, std::plus{});
+          }
+
+          return typeError(expr.op,
+                           "Operands must be two numbers or two strings.");
         default:
-          throw std::runtime_error("Invalid binary operator");
+          return std::unexpected(
+              ReportError(expr.op, "Invalid binary operator."));
+      }
+    }
+
+    auto callValue(expr::Call const &expr, LiteralVal const &callee,
+                   std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> {
+      auto const *function = std::get_if<std::shared_ptr<LoxCallable>>(&callee);
+      if (function == nullptr) {
+        return std::unexpected(
+            ReportError(expr.paren, "Can only call functions and classes."));
+      }
+
+      if (static_cast<int>(arguments.size()) != (*function)->arity()) {
+        return std::unexpected(ReportError(
+            expr.paren, "Expected " + std::to_string((*function)->arity()) +
+                            " arguments but got " +
+                            std::to_string(arguments.size()) + "."));
+      }
+
+      if (auto counted = step(); !counted) [[unlikely]] {
+        return std::unexpected(
+            ReportError(expr.paren, std::move(counted.error().message)));
+      }
+      if (stackPosition() < stackFloor) [[unlikely]] {
+        return std::unexpected(ReportError(expr.paren, "Stack overflow."));
+      }
+      auto const callerLimit = std::exchange(stackLimit, stackLimitHere());
+      auto result = (*function)->call(*this, arguments);
+      stackLimit = callerLimit;
+      if (!result && !result.error().line) {
+        // Natives don't know where they were called from
+        return std::unexpected(
+            ReportError(expr.paren, std::move(result.error().message)));
+      }
+      return result;
+    }
+
+    // A global's slot through the cache on a node Resolver marked; nullptr
+    // if it isn't defined
+    auto globalSlot(Token const &name, SlotCache &cache) -> LiteralVal * {
+      auto *slot = environment->globalScope().slot(name, cache);
+      if constexpr (Policy::ENABLED) {
+        Policy::verify(slot == environment->globalScope().find(name.lexeme),
+                       name, "the cached slot is the global's");
+      }
+      return slot;
+    }
+
+    auto assignVariable(expr::Assign const &expr, LiteralVal const &value)
+        -> Result<void> {
+      if constexpr (Policy::ENABLED) {
+        Policy::write(expr.name, value);
+      }
+      if (!expr.global) {
+        return environment->assign(expr.name, value);
+      }
+      if (auto *slot = globalSlot(expr.name, expr.slot)) {
+        *slot = value;
+        return {};
+      }
+      return std::unexpected(Environment::undefined(expr.name));
+    }
+
+    [[gnu::always_inline]] auto readVariable(expr::Variable const &expr)
+        -> Result<LiteralVal> {
+      if (expr.global) {
+        if (auto const *value = globalSlot(expr.name, expr.slot)) {
+          return *value;
+        }
+        return std::unexpected(Environment::undefined(expr.name));
+      }
+      return environment->get(expr.name);
+    }
+
+    auto declare(Token const &name, LiteralVal const &value) -> void {
+      if constexpr (Policy::ENABLED) {
+        Policy::write(name, value);
+      }
+      environment->define(name.lexeme, value);
+    }
+
+    static auto readProperty(expr::Get const &expr, LiteralVal const &object)
+        -> Result<LiteralVal> {
+      auto const *instance = std::get_if<std::shared_ptr<LoxInstance>>(&object);
+      if (instance == nullptr) {
+        return std::unexpected(
+            ReportError(expr.name, "Only instances have properties."));
+      }
+
+      if (auto *field = (*instance)->field(expr.name.lexeme, expr.cache)) {
+        return *field;
+      }
+
+      if (auto method = (*instance)->klass->findMethod(expr.name.lexeme)) {
+        return method->bind(*instance);
+      }
+
+      return std::unexpected(ReportError(
+          expr.name, "Undefined property '" + expr.name.lexeme + "'."));
+    }
+
+    static auto checkHasFields(expr::Set const &expr, LiteralVal const &object)
+        -> Result<void> {
+      if (std::holds_alternative<std::shared_ptr<LoxInstance>>(object)) {
+        return {};
       }
+      return std::unexpected(
+          ReportError(expr.name, "Only instances have fields."));
     }
-    VISIT_EXPR(expr::Assign) {
-      auto value = evaluate(*expr.value);
-      environment->assign(expr.name, value);
+
+    // `object` passed checkHasFields()
+    static auto writeField(expr::Set const &expr, LiteralVal const &object,
+                           LiteralVal value) -> LiteralVal {
+      std::get<std::shared_ptr<LoxInstance>>(object)->set(expr.name.lexeme,
+                                                           value, expr.cache);
+      return value;
+    }
+
+    VISIT_EXPR_RESULT(expr::Literal) { return expr.value; }
+    VISIT_EXPR_RESULT(expr::Array) {
+      auto values = std::vector<LiteralVal>{};
+      values.reserve(expr.elements.size());
+      for (auto const &element : expr.elements) {
+        values.push_back(TRY(evaluate(*element)));
+      }
+      return makeArray(std::move(values));
+    }
+    VISIT_EXPR_RESULT(expr::Index) {
+      auto object = TRY(evaluate(*expr.object));
+      TRY(checkIndexable(expr.bracket, object));
+      auto index = TRY(evaluate(*expr.index));
+      return readIndex(expr.bracket, object, index);
+    }
+    VISIT_EXPR_RESULT(expr::SetIndex) {
+      auto object = TRY(evaluate(*expr.object));
+      TRY(checkIndexable(expr.bracket, object));
+      auto index = TRY(evaluate(*expr.index));
+      auto value = TRY(evaluate(*expr.value));
+      return writeIndex(expr.bracket, object, index, std::move(value));
+    }
+    VISIT_EXPR_RESULT(expr::Logical) {
+      auto left = TRY(evaluate(*expr.left));
+      if (shortCircuits(expr, left)) {
+        return left;
+      }
+
+      return evaluate(*expr.right);
+    }
+    VISIT_EXPR_RESULT(expr::Grouping) { return evaluate(*expr.expression); }
+    VISIT_EXPR_RESULT(expr::Unary) {
+      if (expr.numberOperand && expr.op.type == TokenType::MINUS) {
+        return -evaluateNumber(*expr.right);
+      }
+      auto right = TRY(evaluate(*expr.right));
+      return applyUnary(expr, right);
+    }
+    VISIT_EXPR_RESULT(expr::Variable) {
+      auto value = readVariable(expr);
+      if constexpr (Policy::ENABLED) {
+        if (value) {
+          Policy::read(expr.name, *value);
+        }
+      }
       return value;
     }
+    VISIT_EXPR_RESULT(expr::Binary) {
+      if (expr.numberOperands) {
+        return numberBinary(expr);
+      }
+      auto left = TRY(evaluate(*expr.left));
+      auto right = TRY(evaluate(*expr.right));
+      return applyBinary(expr, left, right);
+    }
+    VISIT_EXPR_RESULT(expr::Assign) {
+      auto value = TRY(evaluate(*expr.value));
+      TRY(assignVariable(expr, value));
+      return value;
+    }
+    VISIT_EXPR_RESULT(expr::Call) {
+      auto callee = TRY(evaluate(*expr.callee));
+
+      // Nearly every call has only a few arguments; those stay on the stack
+      constexpr std::size_t INLINE_ARGUMENTS = 4;
+      auto inlineArguments = std::array<LiteralVal, INLINE_ARGUMENTS>{};
+      auto spilledArguments = std::vector<LiteralVal>{};
+      auto const count = expr.arguments.size();
+      if (count > INLINE_ARGUMENTS) {
+        spilledArguments.resize(count);
+      }
+      auto const arguments = count > INLINE_ARGUMENTS
+                                 ? std::span{spilledArguments}
+                                 : std::span{inlineArguments}.first(count);
+      for (std::size_t i = 0; i < count; i++) {
+        arguments[i] = TRY(evaluate(*expr.arguments[i]));
+      }
+
+      return callValue(expr, callee, arguments);
+    }
+    VISIT_EXPR_RESULT(expr::Get) {
+      auto object = TRY(evaluate(*expr.object));
+      return readProperty(expr, object);
+    }
+    VISIT_EXPR_RESULT(expr::Set) {
+      auto object = TRY(evaluate(*expr.object));
+      TRY(checkHasFields(expr, object));
+      auto value = TRY(evaluate(*expr.value));
+      return writeField(expr, object, std::move(value));
+    }
+    VISIT_EXPR_RESULT(expr::This) { return environment->get(expr.keyword); }
+    VISIT_EXPR_RESULT(expr::Super) {
+      auto superclass = std::static_pointer_cast<LoxClass>(
+          std::get<std::shared_ptr<LoxCallable>>(
+              TRY(environment->get(expr.keyword))));
+      auto object = std::get<std::shared_ptr<LoxInstance>>(
+          TRY(environment->get(Token{TokenType::THIS, "this", LiteralVal{},
+                                     expr.keyword.line})));
+
+      auto method = superclass->findMethod(expr.method.lexeme);
+      if (method == nullptr) {
+        return std::unexpected(ReportError(
+            expr.method, "Undefined property '" + expr.method.lexeme + "'."));
+      }
+
+      return method->bind(object);
+    }
     /* #endregion */
 
     /* #region Stmt */
-    VISIT_STMT(stmt::Expression) { evaluate(*stmt.expression); }
-    VISIT_STMT(stmt::Print) {
-      auto value = evaluate(*stmt.expression);
-      std::cout << stringify(value) << std::endl;
+    VISIT_STMT_RESULT(stmt::Expression) {
+      TRY(evaluate(*stmt.expression));
+      return {};
+    }
+    VISIT_STMT_RESULT(stmt::Print) {
+      if (auto printed = print(TRY(evaluate(*stmt.expression))); !printed) {
+        return locate(std::move(printed.error()), stmt);
+      }
+      return {};
+    }
+    VISIT_STMT_RESULT(stmt::Var) {
+      auto val =
+          stmt.initializer ? TRY(evaluate(*stmt.initializer)) : LiteralVal{};
+      declare(stmt.name, val);
+      return {};
+    }
+    VISIT_STMT_RESULT(stmt::Block) {
+      return executeBlock(stmt.statements,
+                          Environment::nested(environment));
+    }
+    VISIT_STMT_RESULT(stmt::If) {
+      if (isTruthy(TRY(evaluate(*stmt.condition)))) {
+        return execute(*stmt.thenBranch);
+      }
+
+      if (stmt.elseBranch) {
+        return execute(*stmt.elseBranch);
+      }
+
+      return {};
+    }
+    VISIT_STMT_RESULT(stmt::While) {
+      while (!returnValue && isTruthy(TRY(evaluate(*stmt.condition)))) {
+        if (auto counted = step(); !counted) [[unlikely]] {
+          return std::unexpected(
+              ReportError(stmt.keyword, std::move(counted.error().message)));
+        }
+        TRY(execute(*stmt.body));
+      }
+
+      return {};
     }
-    VISIT_STMT(stmt::Var) {
-      auto val = stmt.initializer ? evaluate(*stmt.initializer) : LiteralVal{};
-      environment->define(stmt.name.lexeme, val);
+    VISIT_STMT_RESULT(stmt::Function) {
+      auto function = std::make_shared<LoxFunction>(stmt, environment, false);
+      declare(stmt.name, std::static_pointer_cast<LoxCallable>(function));
+      return {};
     }
-    VISIT_STMT(stmt::Block) {
-      executeBlock(stmt.statements,
-                   std::make_unique<Environment>(*environment));
+    VISIT_STMT_RESULT(stmt::Return) {
+      returnValue = stmt.value ? TRY(evaluate(*stmt.value)) : LiteralVal{};
+      return {};
     }
-    VISIT_STMT(stmt::If) {
-      if (isTruthy(evaluate(*stmt.condition))) {
-        execute(*stmt.thenBranch);
-      } else if (stmt.elseBranch) {
-        execute(*stmt.elseBranch);
+    VISIT_STMT_RESULT(stmt::Class) {
+      std::shared_ptr<LoxClass> superclass;
+      if (stmt.superclass) {
+        auto value = TRY(evaluate(*stmt.superclass));
+        auto *callable = std::get_if<std::shared_ptr<LoxCallable>>(&value);
+        superclass = callable == nullptr
+                         ? nullptr
+                         : std::dynamic_pointer_cast<LoxClass>(*callable);
+
+        if (superclass == nullptr) {
+          return std::unexpected(
+              ReportError(std::get<expr::Variable>(*stmt.superclass).name,
+                          "Superclass must be a class."));
+        }
+      }
+
+      environment->define(stmt.name.lexeme, LiteralVal{});
+
+      auto classEnvironment = environment;
+      if (superclass != nullptr) {
+        classEnvironment = Environment::nested(environment);
+        classEnvironment->define(
+            "super", std::static_pointer_cast<LoxCallable>(superclass));
       }
+
+      std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
+      for (auto const &method : stmt.methods) {
+        auto const &declaration = std::get<stmt::Function>(*method);
+        methods[declaration.name.lexeme] = std::make_shared<LoxFunction>(
+            declaration, classEnvironment, declaration.name.lexeme == "init");
+      }
+
+      auto klass = std::make_shared<LoxClass>(
+          stmt.name.lexeme, std::move(superclass), std::move(methods));
+      return environment->assign(stmt.name,
+                                 std::static_pointer_cast<LoxCallable>(klass));
     }
-    VISIT_STMT(stmt::While) {
-      while (isTruthy(evaluate(stmt.condition))) {
-        execute(stmt.body);
+    VISIT_STMT_RESULT(stmt::Import) {
+      if (stmt.module == nullptr) {
+        return std::unexpected(
+            ReportError(stmt.keyword, "Module was not loaded."));
+      }
+      if (!imported.insert(stmt.module).second) {
+        return {};
+      }
+
+      // Imports only appear at the top level, which runs in the globals
+      for (auto const &inner : stmt.module->program) {
+        if (auto result = execute(*inner); !result) {
+          return std::unexpected(
+              located(std::move(result).error(), stmt.module));
+        }
       }
+      return {};
+    }
+    VISIT_STMT_RESULT(stmt::Yield) {
+      // Generator bodies run through resume(), which handles their yields
+      return std::unexpected(
+          ReportError(stmt.keyword, "Can only yield inside a generator."));
     }
     /* #endregion */
 
   public:
-    auto interpret(std::ranges::input_range auto &&statements) {
+    BasicInterpreter() : output{BufferedWriter::forStdout()} {}
+    BasicInterpreter(std::shared_ptr<OutputSink> output)
+        : output{std::move(output)} {}
+    // Runs against existing globals, e.g. those left by a prelude
+    BasicInterpreter(std::shared_ptr<OutputSink> output,
+                     std::shared_ptr<Environment> globals)
+        : globals{std::move(globals)}, output{std::move(output)} {}
+    // Runs a spawned task as part of the run that spawned it, within its
+    // limits
+    BasicInterpreter(std::shared_ptr<OutputSink> output,
+                     std::shared_ptr<Environment> globals,
+                     std::shared_ptr<TaskGroup> tasks,
+                     std::shared_ptr<Budget> budget)
+        : globals{std::move(globals)}, output{std::move(output)},
+          tasks{std::move(tasks)}, budget{std::move(budget)} {
+      if (this->budget != nullptr) {
+        fuel = 1;
+        heapBaseline = AllocationCounter::current().liveBytes;
+      }
+    }
+
+    [[nodiscard]] auto outputSink() const -> OutputSink & { return *output; }
+
+    auto taskGroup() -> std::shared_ptr<TaskGroup> const & {
+      if (tasks == nullptr) {
+        tasks = std::make_shared<TaskGroup>();
+      }
+      return tasks;
+    }
+
+    // Profiling is off unless a profiler is set; it must outlive the
+    // interpreter's use of it
+    auto setProfiler(Profiler *profiler) -> void { this->profiler = profiler; }
+    [[nodiscard]] auto currentProfiler() const -> Profiler * {
+      return profiler;
+    }
+
+    // Pure functions keep their results to answer later calls with the same
+    // arguments when set; off by default
+    auto setMemoize(bool memoize) -> void { this->memoize = memoize; }
+    [[nodiscard]] auto memoizing() const -> bool { return memoize; }
+    auto memoStats() -> MemoCounts & { return memoCounts; }
+
+    // The module `script` also is when it's imported from within its own run,
+    // e.g. in a cycle through another module; importing it then does nothing
+    auto setScript(Module const *script) -> void {
+      if (script != nullptr) {
+        imported.insert(script);
+      }
+    }
+
+    [[nodiscard]] auto limitsHeap() const -> bool {
+      return budget != nullptr && budget->heapLimit() != 0;
+    }
+
+    // Stops the run with a limit error once it goes over any of `limits`;
+    // the clock starts now. No limits by default.
+    auto setLimits(RunLimits const &limits) -> void {
+      budget = limits.any() ? std::make_shared<Budget>(limits) : nullptr;
+      fuel = budget != nullptr ? 1 : std::numeric_limits<std::uint64_t>::max();
+      drawn = 0;
+    }
+    [[nodiscard]] auto runBudget() const -> std::shared_ptr<Budget> const & {
+      return budget;
+    }
+    // Fails once the run is out of time or stopped at a limit elsewhere,
+    // for waits that take no steps
+    auto checkBudget() -> Result<void> {
+      return budget != nullptr ? budget->check() : Result<void>{};
+    }
+
+    auto
+    executeBlock(std::vector<std::unique_ptr<stmt::Stmt>> const &statements,
+                 std::shared_ptr<Environment> environment) -> Result<void> {
+      auto prev = std::exchange(this->environment, std::move(environment));
+
+      for (auto const &stmt : statements) {
+        if (auto result = execute(*stmt); !result) {
+          // Reset the environment before handing the error up
+          this->environment = std::move(prev);
+          return result;
+        }
+
+        if (returnValue) {
+          break;
+        }
+      }
+
+      this->environment = std::move(prev);
+      return {};
+    }
+
+    // Runs a generator's frames up to its next yield, or to the end of its
+    // body, which leaves `frames` empty. Only statements that can contain a
+    // yield (blocks, if, while) get frames; the rest go through execute().
+    auto resume(std::vector<LoxGenerator::Frame> &frames)
+        -> Result<LiteralVal> {
+      auto const previous = environment;
+      auto result = resumeFrames(frames);
+      environment = previous;
+      return result;
+    }
+
+    // Hands back the value of the `return` that ended the last executeBlock,
+    // clearing it so the caller's own statements keep running
+    auto takeReturnValue() -> std::optional<LiteralVal> {
+      return std::exchange(returnValue, std::nullopt);
+    }
+
+    auto interpret(std::ranges::forward_range auto &&statements) {
       auto report = Report<InterpreterStatus>{InterpreterStatus::UNPROCESSED};
+      stackLimit = stackLimitHere(); // This thread's stack, e.g. in a Session
+      stackFloor = stackFloorHere();
+      Resolver::annotate(statements);
+      TypeInference::annotate(statements);
+      if (memoize) {
+        Purity::annotate(statements);
+      }
 
-      try {
-        std::ranges::for_each(
-            statements,
-            [this](std::unique_ptr<stmt::Stmt> &stmt) { execute(*stmt); });
-        report.status = InterpreterStatus::SUCCESS;
-      } catch (ReportError &err) {
-        report.addError(err);
-        report.status = InterpreterStatus::HAS_ERRORS;
+      // Heap growth is only seen while live bytes are tracked
+      auto const tracking = LiveBytesTracking{limitsHeap()};
+      heapBaseline = AllocationCounter::current().liveBytes;
+
+      for (std::unique_ptr<stmt::Stmt> const &stmt : statements) {
+        if (auto result = execute(*stmt); !result) {
+          report.addError(locate(std::move(result.error()), *stmt).error());
+          report.status = budget != nullptr && budget->wasExceeded()
+                              ? InterpreterStatus::LIMIT_EXCEEDED
+                              : InterpreterStatus::HAS_ERRORS;
+          break;
+        }
       }
 
+      // Tasks still running use the program's nodes, which the caller may
+      // free as soon as this returns. Past a limit they stop at their next
+      // step.
+      if (tasks != nullptr) {
+        tasks->wait();
+      }
+
+      output->flush();
+      if (report.status == InterpreterStatus::UNPROCESSED) {
+        report.status = InterpreterStatus::SUCCESS;
+      }
       return report;
     }
   };
-} // namespace lox
\ No newline at end of file
+
+  inline auto LoxFunction::call(Interpreter &interpreter,
+                                std::span<LiteralVal const> arguments)
+      -> Result<LiteralVal> {
+    auto frame = Profiler::CallScope{interpreter.currentProfiler(),
+                                     declaration.name.lexeme};
+
+    if (!declaration.pure || !interpreter.memoizing() ||
+        !MemoCache::accepts(arguments) || !memoValid()) {
+      return run(interpreter, arguments);
+    }
+
+    auto &counts = interpreter.memoStats();
+    if (auto const *result = memo->find(arguments)) {
+      counts.hits++;
+      return *result;
+    }
+    counts.misses++;
+    auto result = TRY(run(interpreter, arguments));
+    memo->insert(arguments, result);
+    return result;
+  }
+
+  inline auto LoxFunction::run(Interpreter &interpreter,
+                               std::span<LiteralVal const> arguments)
+      -> Result<LiteralVal> {
+    auto environment = Environment::nested(closure);
+    for (std::size_t i = 0; i < declaration.params.size(); i++) {
+      environment->define(declaration.params[i].lexeme, arguments[i]);
+    }
+
+    // The body runs a piece at a time, each time the generator is called
+    if (declaration.isGenerator) {
+      return std::static_pointer_cast<LoxCallable>(
+          std::make_shared<LoxGenerator>(declaration, std::move(environment)));
+    }
+
+    if (auto body = interpreter.executeBlock(declaration.body, environment);
+        !body) {
+      return std::unexpected(
+          located(std::move(body).error(), declaration.module));
+    }
+    auto returnValue = interpreter.takeReturnValue();
+
+    if (isInitializer) {
+      return closure->get(
+          Token{TokenType::THIS, "this", LiteralVal{}, declaration.name.line});
+    }
+
+    return returnValue.value_or(LiteralVal{});
+  }
+
+  inline auto SpawnNative::call(Interpreter &interpreter,
+                                std::span<LiteralVal const> arguments)
+      -> Result<LiteralVal> {
+    auto const *callable =
+        std::get_if<std::shared_ptr<LoxCallable>>(&arguments[0]);
+    if (callable == nullptr || (*callable)->arity() != 0) {
+      return std::unexpected(
+          ReportError{"Can only spawn a function that takes no arguments."});
+    }
+
+    auto task = std::make_shared<LoxTask>();
+    auto const &group = interpreter.taskGroup();
+    group->started();
+    taskPool().submit(
+        [function = std::get<std::shared_ptr<LoxCallable>>(
+             DeepCopier::copyOf(*callable)),
+         task, group, budget = interpreter.runBudget()]() mutable {
+          auto output = std::make_shared<CaptureSink>();
+          // On a pool worker, which doesn't track the heap by itself
+          auto const tracking = LiveBytesTracking{
+              budget != nullptr && budget->heapLimit() != 0};
+          auto result = [&] {
+            auto interpreter = Interpreter{
+                output, std::make_shared<Environment>(), group, budget};
+            auto result = function->call(interpreter, {});
+            function = nullptr; // Let go of the task's copy first
+            return result;
+          }();
+          task->finish(std::move(result), output->take());
+          group->finished();
+        });
+
+    return std::static_pointer_cast<LoxCallable>(task);
+  }
+
+  inline auto LoxTask::call(Interpreter &interpreter,
+                            std::span<LiteralVal const> /*arguments*/)
+      -> Result<LiteralVal> {
+    auto lock = helpUntil(mutex, done, [this] { return result.has_value(); });
+    interpreter.outputSink().write(std::exchange(output, {}));
+    if (!*result) {
+      return std::unexpected(result->error());
+    }
+    return DeepCopier::copyOf(**result);
+  }
+
+  // Gives up waiting once the run is out of time or stopped at a limit
+  inline auto LoxChannel::call(Interpreter &interpreter,
+                               std::span<LiteralVal const> /*arguments*/)
+      -> Result<LiteralVal> {
+    auto stopped = std::optional<ReportError>{};
+    auto lock = helpUntil(mutex, available, [&] {
+      if (!messages.empty()) {
+        return true;
+      }
+      if (auto check = interpreter.checkBudget(); !check) {
+        stopped.emplace(std::move(check).error());
+      }
+      return stopped.has_value();
+    });
+    if (stopped) {
+      return std::unexpected(std::move(*stopped));
+    }
+    auto message = std::move(messages.front());
+    messages.pop_front();
+    return message;
+  }
+
+  inline auto LoxGenerator::call(Interpreter &interpreter,
+                                 std::span<LiteralVal const> /*arguments*/)
+      -> Result<LiteralVal> {
+    if (running) {
+      return std::unexpected(ReportError{"Generator is already running."});
+    }
+    if (done()) {
+      return LiteralVal{};
+    }
+
+    running = true;
+    auto result = interpreter.resume(frames);
+    running = false;
+
+    if (!result) {
+      frames.clear(); // A generator that raised an error is finished
+    }
+    return result;
+  }
+} // namespace lox
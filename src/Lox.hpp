@@ -1,80 +1,141 @@
 #pragma once
 
-#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <memory>
-#include <numeric>
 #include <optional>
-#include <ranges>
 #include <string>
+#include <thread>
+#include <vector>
 
-#include "AstPrinter.hpp"
-#include "Interpreter.hpp"
-#include "Parser.hpp"
-#include "Scanner.hpp"
+#include "Batch.hpp"
+#include "Engine.hpp"
+#include "OutputSink.hpp"
+#include "Report.hpp"
+#include "Session.hpp"
+#include "Snapshot.hpp"
 
 namespace lox {
+  // Command-line front end over Engine: output to stdout, errors to stderr
   class Lox {
-  public:
-    static auto run(const std::string &source) -> void {
-      /* #region Scanning + Print tokens */
-      std::cout << "[Scanning]" << '\n';
-      auto scanner = lox::Scanner(source);
-      auto [tokens, scannerReport] = scanner.scanTokens();
-
-      for (const auto &token : tokens) {
-        std::cout << token.toString() << std::endl;
+  private:
+    static auto printErrors(std::vector<ReportError> &errors) -> void {
+      for (auto &error : errors) {
+        std::cerr << error.toString() << std::endl;
       }
+    }
 
-      std::cout << "" << std::endl;
-      /* #endregion */
-
-      /* #region Parsing */
-      std::cout << "Parsing" << '\n';
-      auto parser = lox::Parser{tokens};
-      auto [statements, parsingReport] = parser.parse();
+  public:
+    static auto run(const std::string &source, RunOptions const &options = {})
+        -> RunStatus {
+      auto engine = Engine{BufferedWriter::forStdout(), options};
+      auto result = engine.run(source);
+      printErrors(result.errors);
+      return result.status;
+    }
 
-      if (parsingReport.status == ParserStatus::HAS_ERRORS) {
-        parsingReport.printErrors();
-        return;
+    // Imports in the prelude are relative to its `file`'s directory
+    static auto runPrelude(const std::string &source,
+                           std::filesystem::path const &file = {})
+        -> std::optional<Prelude> {
+      auto engine = Engine{BufferedWriter::forStdout(),
+                           {.directory = file.parent_path(), .file = file}};
+      auto prelude = engine.runPrelude(source);
+      if (!prelude) {
+        printErrors(prelude.error().errors);
+        return std::nullopt;
       }
-      /* #endregion */
-
-      /* #region AST Printer */
-      // std::cout << "AST Printer:\n";
-      // std::cout << lox::AstPrinter().print(*expression) << "\n\n";
-      /* #endregion */
-
-      /* #region Interpreter */
-      std::cout << "Interpreter:\n";
-      auto interpreter = Interpreter{};
-      interpreter.interpret(statements |
-                            std::ranges::views::filter(
-                                [](auto &stmt) { return stmt != nullptr; }));
-      /* #endregion */
+
+      return std::move(*prelude);
     }
 
-    static auto runFile(const std::string &filePath) -> void {
+    static auto readFile(const std::string &filePath)
+        -> std::optional<std::string> {
       auto input = std::ifstream{filePath};
       if (!input) {
         std::cerr << "Could not open file: " << filePath << '\n';
+        return std::nullopt;
       }
 
-      run(std::string{std::istreambuf_iterator<char>{input}, {}});
+      return std::string{std::istreambuf_iterator<char>{input}, {}};
+    }
 
-      // TODO
-      // parser error
-      // if (hadError)
-      // exit(65);
+    // Imports in the file are relative to its directory. Nullopt when the
+    // file can't be read.
+    static auto runFile(const std::string &filePath, RunOptions options = {})
+        -> std::optional<RunStatus> {
+      auto source = readFile(filePath);
+      if (!source) {
+        return std::nullopt;
+      }
+
+      options.file = filePath;
+      options.directory = options.file.parent_path();
+      return run(*source, options);
+    }
 
-      // interpreter error
-      // if (hadRuntimeError)
-      // exit(70);
+    // The process exit status for a runFile() result, after sysexits.h
+    static auto exitStatus(std::optional<RunStatus> status) -> int {
+      if (!status) {
+        return 66; // EX_NOINPUT
+      }
+      switch (*status) {
+        case RunStatus::SUCCESS:
+          return 0;
+        case RunStatus::COMPILE_ERROR:
+          return 65; // EX_DATAERR
+        case RunStatus::RUNTIME_ERROR:
+        case RunStatus::LIMIT_EXCEEDED:
+          return 70; // EX_SOFTWARE
+      }
+      return 70;
+    }
+
+    // Runs each file independently over `jobs` threads, then prints their
+    // output and errors in the order given. Returns false if any failed.
+    static auto runBatch(std::vector<std::string> const &filePaths,
+                         std::size_t jobs, AstCache const *cache = nullptr,
+                         RunLimits const &limits = {}) -> bool {
+      auto sources = std::vector<std::string>{};
+      auto files = std::vector<std::filesystem::path>{};
+      for (auto const &path : filePaths) {
+        auto source = readFile(path);
+        if (!source) {
+          return false;
+        }
+        sources.push_back(std::move(*source));
+        files.emplace_back(path);
+      }
+
+      auto pool = WorkStealingPool{jobs};
+      auto results = lox::runBatch(sources, pool, cache, limits, files);
+
+      auto output = BufferedWriter::forStdout();
+      auto succeeded = true;
+      for (std::size_t i = 0; i < results.size(); i++) {
+        output->write(results[i].output);
+        output->flush();
+        // Errors from a module already name its file
+        for (auto &error : results[i].result.errors) {
+          if (!error.file || error.file->empty()) {
+            std::cerr << filePaths[i] << ": ";
+          }
+          std::cerr << error.toString() << '\n';
+        }
+        succeeded &= results[i].result.status == RunStatus::SUCCESS;
+      }
+      return succeeded;
     }
 
-    static auto runPrompt() -> void {
+    // Every line runs in one Session, so later lines see what earlier ones
+    // defined; a prelude's globals are in scope from the first line
+    static auto runPrompt(std::optional<Prelude> prelude = std::nullopt)
+        -> void {
+      auto output = BufferedWriter::forStdout();
+      auto session = prelude ? Session{output, std::move(*prelude)}
+                             : Session{output};
       auto line = std::string{};
 
       while (true) {
@@ -83,10 +144,10 @@ namespace lox {
           break;
         }
 
-        run(line);
-        // hadError = false;
+        auto result = session.submit(line);
+        printErrors(result.errors);
       }
     }
   };
 
-} // namespace lox
\ No newline at end of file
+} // namespace lox
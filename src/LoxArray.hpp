@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Teardown.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // Appends `value` the way print shows it. Arrays and maps already being
+  // written further up (`open`) show as [...] or {...} instead of recursing
+  // forever. Defined in LoxMap.hpp.
+  inline auto appendValue(std::string &out, LiteralVal const &value,
+                          std::vector<void const *> &open) -> void;
+
+  // Bulk operations over contiguous doubles. Reductions keep four partial
+  // sums rather than one running total: floating point addition isn't
+  // associative, so with a single total the compiler has to add one element
+  // at a time, while independent partials can sit in vector lanes.
+  namespace kernels {
+    constexpr std::size_t LANES = 4;
+
+    inline auto sum(std::span<double const> values) -> double {
+      auto partial = std::array<double, LANES>{};
+      auto const whole = values.size() - values.size() % LANES;
+      std::size_t i = 0;
+      for (; i < whole; i += LANES) {
+        for (std::size_t lane = 0; lane < LANES; lane++) {
+          partial[lane] += values[i + lane];
+        }
+      }
+
+      auto total = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+      for (; i < values.size(); i++) {
+        total += values[i];
+      }
+      return total;
+    }
+
+    // `a` and `b` have the same length
+    inline auto dot(std::span<double const> a, std::span<double const> b)
+        -> double {
+      auto partial = std::array<double, LANES>{};
+      auto const whole = a.size() - a.size() % LANES;
+      std::size_t i = 0;
+      for (; i < whole; i += LANES) {
+        for (std::size_t lane = 0; lane < LANES; lane++) {
+          partial[lane] += a[i + lane] * b[i + lane];
+        }
+      }
+
+      auto total = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+      for (; i < a.size(); i++) {
+        total += a[i] * b[i];
+      }
+      return total;
+    }
+
+    // out[i] = op(a[i], b[i]); all three have the same length
+    template <typename Op>
+    auto zip(std::span<double const> a, std::span<double const> b,
+             std::span<double> out, Op op) -> void {
+      for (std::size_t i = 0; i < out.size(); i++) {
+        out[i] = op(a[i], b[i]);
+      }
+    }
+
+    // out[i] = op(a[i], scalar), or op(scalar, a[i]) when `scalarFirst`
+    template <typename Op>
+    auto map(std::span<double const> a, double scalar, bool scalarFirst,
+             std::span<double> out, Op op) -> void {
+      if (scalarFirst) {
+        for (std::size_t i = 0; i < out.size(); i++) {
+          out[i] = op(scalar, a[i]);
+        }
+      } else {
+        for (std::size_t i = 0; i < out.size(); i++) {
+          out[i] = op(a[i], scalar);
+        }
+      }
+    }
+  } // namespace kernels
+
+  // A growable list of values. While it holds only numbers they're stored
+  // unboxed in one contiguous buffer, which the kernels above work on
+  // directly; storing anything else switches it to a vector of LiteralVal.
+  class LoxArray {
+  private:
+    friend class DeepCopier;
+    friend class Snapshot;
+
+    std::variant<std::vector<double>, std::vector<LiteralVal>> elements;
+
+    auto values() -> std::vector<LiteralVal> & {
+      if (auto *numbers = std::get_if<std::vector<double>>(&elements)) {
+        auto boxed = std::vector<LiteralVal>(numbers->begin(), numbers->end());
+        elements = std::move(boxed);
+      }
+      return std::get<std::vector<LiteralVal>>(elements);
+    }
+
+  public:
+    LoxArray() = default;
+    explicit LoxArray(std::vector<double> numbers)
+        : elements{std::move(numbers)} {}
+    explicit LoxArray(std::vector<LiteralVal> values)
+        : elements{std::move(values)} {}
+    LoxArray(LoxArray const &) = delete;
+    auto operator=(LoxArray const &) -> LoxArray & = delete;
+    // Arrays nested thousands deep are freed one level at a time
+    ~LoxArray() {
+      if (auto *boxed = std::get_if<std::vector<LiteralVal>>(&elements)) {
+        Teardown::release(*boxed);
+      }
+    }
+
+    auto appendTo(std::string &out, std::vector<void const *> &open) const
+        -> void {
+      if (std::ranges::find(open, this) != open.end()) {
+        out += "[...]";
+        return;
+      }
+      open.push_back(this);
+
+      out += '[';
+      auto separate = [&, first = true]() mutable {
+        if (!std::exchange(first, false)) {
+          out += ", ";
+        }
+      };
+      if (auto const *numbers = std::get_if<std::vector<double>>(&elements)) {
+        auto buffer = std::array<char, 32>{};
+        for (auto const number : *numbers) {
+          separate();
+          out += formatNumber(number, buffer);
+        }
+      } else {
+        for (auto const &value : std::get<std::vector<LiteralVal>>(elements)) {
+          separate();
+          appendValue(out, value, open);
+        }
+      }
+      out += ']';
+
+      open.pop_back();
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t {
+      return std::visit([](auto const &items) { return items.size(); },
+                        elements);
+    }
+
+    // `index` is below size()
+    [[nodiscard]] auto at(std::size_t index) const -> LiteralVal {
+      if (auto const *numbers = std::get_if<std::vector<double>>(&elements)) {
+        return (*numbers)[index];
+      }
+      return std::get<std::vector<LiteralVal>>(elements)[index];
+    }
+
+    // `index` is below size()
+    auto set(std::size_t index, LiteralVal value) -> void {
+      auto *numbers = std::get_if<std::vector<double>>(&elements);
+      if (auto const *number = std::get_if<double>(&value);
+          numbers != nullptr && number != nullptr) {
+        (*numbers)[index] = *number;
+      } else {
+        values()[index] = std::move(value);
+      }
+    }
+
+    auto push(LiteralVal value) -> void {
+      auto *numbers = std::get_if<std::vector<double>>(&elements);
+      if (auto const *number = std::get_if<double>(&value);
+          numbers != nullptr && number != nullptr) {
+        numbers->push_back(*number);
+      } else {
+        values().push_back(std::move(value));
+      }
+    }
+
+    // The elements as unboxed numbers, or nullptr if any element isn't a
+    // number. Boxed storage that has come to hold only numbers again is
+    // unboxed first, so later calls are free.
+    auto numbers() -> std::vector<double> * {
+      if (auto *numbers = std::get_if<std::vector<double>>(&elements)) {
+        return numbers;
+      }
+
+      auto const &values = std::get<std::vector<LiteralVal>>(elements);
+      if (!std::ranges::all_of(values, [](LiteralVal const &value) {
+            return std::holds_alternative<double>(value);
+          })) {
+        return nullptr;
+      }
+
+      auto unboxed = std::vector<double>{};
+      unboxed.reserve(values.size());
+      for (auto const &value : values) {
+        unboxed.push_back(std::get<double>(value));
+      }
+      return &elements.emplace<std::vector<double>>(std::move(unboxed));
+    }
+
+    [[nodiscard]] auto toString() const -> std::string {
+      auto out = std::string{};
+      auto open = std::vector<void const *>{};
+      appendTo(out, open);
+      return out;
+    }
+  };
+
+  inline auto to_string(LoxArray const &array) -> std::string {
+    return array.toString();
+  }
+} // namespace lox
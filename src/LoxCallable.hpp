@@ -0,0 +1,29 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+#include "Policy.hpp"
+#include "Report.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  class LoxCallable {
+  public:
+    LoxCallable() = default;
+    LoxCallable(LoxCallable const &) = delete;
+    auto operator=(LoxCallable const &) -> LoxCallable & = delete;
+    virtual ~LoxCallable() = default;
+
+    [[nodiscard]] virtual auto arity() const -> int = 0;
+    // `arguments` holds exactly arity() values; the caller checks
+    virtual auto call(Interpreter &interpreter,
+                      std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> = 0;
+    [[nodiscard]] virtual auto toString() const -> std::string = 0;
+  };
+
+  inline auto to_string(LoxCallable const &callable) -> std::string {
+    return callable.toString();
+  }
+} // namespace lox
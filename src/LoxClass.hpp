@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "LoxCallable.hpp"
+#include "LoxFunction.hpp"
+#include "Report.hpp"
+#include "Shape.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  class LoxClass : public LoxCallable,
+                   public std::enable_shared_from_this<LoxClass> {
+  private:
+    friend class DeepCopier;
+    friend class Snapshot;
+
+
+    std::unordered_map<std::string, std::shared_ptr<LoxFunction>> const
+        methods;
+
+  public:
+    std::string const name;
+    std::shared_ptr<LoxClass> const superclass;
+    // Every instance starts out with this empty shape. Keeping one root per
+    // class means a shape never mixes instances of different classes.
+    std::shared_ptr<Shape> const rootShape = std::make_shared<Shape>();
+
+    LoxClass(
+        std::string name, std::shared_ptr<LoxClass> superclass,
+        std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods)
+        : methods{std::move(methods)}, name{std::move(name)},
+          superclass{std::move(superclass)} {}
+
+    [[nodiscard]] auto findMethod(std::string const &methodName) const
+        -> std::shared_ptr<LoxFunction> {
+      if (auto method = methods.find(methodName); method != methods.end()) {
+        return method->second;
+      }
+
+      if (superclass != nullptr) {
+        return superclass->findMethod(methodName);
+      }
+
+      return nullptr;
+    }
+
+    [[nodiscard]] auto arity() const -> int override {
+      auto initializer = findMethod("init");
+      return initializer == nullptr ? 0 : initializer->arity();
+    }
+
+    // Defined in LoxInstance.hpp, it needs the complete LoxInstance
+    auto call(Interpreter &interpreter,
+              std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return name;
+    }
+  };
+} // namespace lox
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "Environment.hpp"
+#include "LoxCallable.hpp"
+#include "MemoCache.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  class LoxFunction : public LoxCallable {
+  private:
+    friend class DeepCopier;
+    friend class Snapshot;
+
+    // The declaration is owned by the parsed program, which outlives every
+    // function value created while interpreting it
+    stmt::Function const &declaration;
+    std::shared_ptr<Environment> const closure;
+    bool const isInitializer;
+    // Results of earlier calls, once a pure function has been called
+    std::unique_ptr<MemoCache> memo;
+
+    // Runs the body. Defined in Interpreter.hpp, like call().
+    auto run(Interpreter &interpreter, std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal>;
+
+    // Whether each function the declaration's callees name is the same
+    // object it was when the memoized results were computed. One that's
+    // been replaced by a function of the same declaration and scope only
+    // drops the results; if a name now refers to anything else, Purity's
+    // assumption fails and the memo can't be used.
+    auto memoValid() -> bool {
+      if (memo == nullptr) {
+        memo = std::make_unique<MemoCache>();
+      }
+
+      auto const &expected = declaration.callees;
+      auto &seen = memo->callees;
+      auto unchanged = seen.size() == expected.size();
+      for (std::size_t i = 0; unchanged && i < expected.size(); i++) {
+        unchanged = calleeNamed(*expected[i]) == seen[i];
+      }
+      if (unchanged) {
+        return true;
+      }
+
+      memo->clear();
+      seen.clear();
+      for (auto const *callee : expected) {
+        auto const *function =
+            dynamic_cast<LoxFunction const *>(calleeNamed(*callee));
+        if (function == nullptr || &function->declaration != callee ||
+            function->closure != closure) {
+          seen.clear();
+          return false;
+        }
+        seen.push_back(function);
+      }
+      return true;
+    }
+
+    [[nodiscard]] auto calleeNamed(stmt::Function const &callee) const
+        -> LoxCallable const * {
+      auto const *value = closure->find(callee.name.lexeme);
+      auto const *callable =
+          value != nullptr ? std::get_if<std::shared_ptr<LoxCallable>>(value)
+                           : nullptr;
+      return callable != nullptr ? callable->get() : nullptr;
+    }
+
+  public:
+    LoxFunction(stmt::Function const &declaration,
+                std::shared_ptr<Environment> closure, bool isInitializer)
+        : declaration{declaration}, closure{std::move(closure)},
+          isInitializer{isInitializer} {}
+
+    [[nodiscard]] auto bind(std::shared_ptr<LoxInstance> const &instance) const
+        -> std::shared_ptr<LoxFunction> {
+      auto environment = Environment::nested(closure);
+      environment->define("this", instance);
+      return std::make_shared<LoxFunction>(declaration, std::move(environment),
+                                           isInitializer);
+    }
+
+    [[nodiscard]] auto arity() const -> int override {
+      return static_cast<int>(declaration.params.size());
+    }
+
+    // Defined in Interpreter.hpp, it needs the complete Interpreter
+    auto call(Interpreter &interpreter,
+              std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return "<fn " + declaration.name.lexeme + ">";
+    }
+  };
+} // namespace lox
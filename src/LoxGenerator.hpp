@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Environment.hpp"
+#include "LoxCallable.hpp"
+#include "Report.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // A call to a function whose body yields. Rather than a C++ stack of its
+  // own, it keeps the statement lists it's part-way through as explicit
+  // frames, so a suspended generator costs a few small heap objects. Each
+  // call runs the body up to the next `yield` and returns the yielded
+  // value; once the body returns, done() is true and the call returns the
+  // function's return value.
+  class LoxGenerator : public LoxCallable {
+  public:
+    // A statement list and the index of the next statement to run in it.
+    // The frame for a while loop's body re-checks the loop's condition each
+    // time the body finishes.
+    struct Frame {
+      std::span<std::unique_ptr<stmt::Stmt> const> statements;
+      std::size_t next = 0;
+      std::shared_ptr<Environment> environment;
+      stmt::While const *loop = nullptr;
+    };
+
+  private:
+    friend class DeepCopier;
+    template <typename Policy> friend class BasicInterpreter;
+
+    std::string const name;
+    std::vector<Frame> frames; // Innermost last; empty once done
+    bool running = false;
+
+  public:
+    LoxGenerator(std::string name, std::vector<Frame> frames)
+        : name{std::move(name)}, frames{std::move(frames)} {}
+
+    // The declaration is owned by the parsed program, which outlives every
+    // value created while interpreting it
+    LoxGenerator(stmt::Function const &declaration,
+                 std::shared_ptr<Environment> environment)
+        : name{declaration.name.lexeme},
+          frames{{Frame{declaration.body, 0, std::move(environment)}}} {}
+
+    [[nodiscard]] auto done() const -> bool { return frames.empty(); }
+
+    [[nodiscard]] auto arity() const -> int override { return 0; }
+
+    // Defined in Interpreter.hpp, it needs the complete Interpreter
+    auto call(Interpreter &interpreter, std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return "<generator " + name + ">";
+    }
+  };
+} // namespace lox
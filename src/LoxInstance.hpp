@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LoxClass.hpp"
+#include "Report.hpp"
+#include "Shape.hpp"
+#include "Teardown.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // Fields live in a flat slot vector laid out by `shape`, rather than in a
+  // per-instance map keyed by name
+  class LoxInstance {
+  public:
+    std::shared_ptr<LoxClass> const klass;
+    std::shared_ptr<Shape> shape;
+    std::vector<LiteralVal> fields;
+
+    LoxInstance(std::shared_ptr<LoxClass> klass)
+        : klass{std::move(klass)}, shape{this->klass->rootShape} {}
+    LoxInstance(LoxInstance const &) = delete;
+    auto operator=(LoxInstance const &) -> LoxInstance & = delete;
+    // A linked list of instances is freed one node at a time
+    ~LoxInstance() { Teardown::release(fields); }
+
+    // Returns nullptr when the instance has no such field, leaving method
+    // lookup to the caller
+    auto field(std::string const &name, InlineCache &cache) -> LiteralVal * {
+      if (auto const entry = cache.find(shape->id)) {
+        return &fields[entry->slot];
+      }
+
+      auto slot = shape->lookup(name);
+      if (slot == -1) {
+        return nullptr;
+      }
+
+      cache.insert(shape->id, slot);
+      return &fields[slot];
+    }
+
+    auto set(std::string const &name, LiteralVal value, InlineCache &cache)
+        -> void {
+      if (auto const entry = cache.find(shape->id)) {
+        if (entry->transition != nullptr) {
+          shape = entry->transition->shared_from_this();
+          fields.push_back(std::move(value));
+        } else {
+          fields[entry->slot] = std::move(value);
+        }
+        return;
+      }
+
+      if (auto slot = shape->lookup(name); slot != -1) {
+        cache.insert(shape->id, slot);
+        fields[slot] = std::move(value);
+        return;
+      }
+
+      auto next = shape->withField(name);
+      cache.insert(shape->id, shape->fieldCount(), next.get());
+      shape = std::move(next);
+      fields.push_back(std::move(value));
+    }
+  };
+
+  inline auto LoxClass::call(Interpreter &interpreter,
+                             std::span<LiteralVal const> arguments)
+      -> Result<LiteralVal> {
+    auto instance = std::make_shared<LoxInstance>(shared_from_this());
+
+    if (auto initializer = findMethod("init")) {
+      TRY(initializer->bind(instance)->call(interpreter, arguments));
+    }
+
+    return instance;
+  }
+
+  inline auto to_string(LoxInstance const &instance) -> std::string {
+    return instance.klass->name + " instance";
+  }
+} // namespace lox
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "LoxArray.hpp"
+#include "Teardown.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  class LoxMap;
+
+  // Equality and hashing of Lox values, each one switch on the value's type.
+  // Values of different types are never equal. Nil, booleans, numbers and
+  // strings compare by value; functions, classes, instances, arrays and maps
+  // by identity. The two agree: equal values hash the same (0 and -0
+  // included).
+  struct ValueEqual {
+    auto operator()(LiteralVal const &a, LiteralVal const &b) const -> bool {
+      if (a.index() != b.index()) {
+        return false;
+      }
+
+      switch (a.index()) {
+        case variant_index_v<LiteralVal, std::monostate>:
+          return true;
+        case variant_index_v<LiteralVal, std::string>:
+          return *std::get_if<std::string>(&a) ==
+                 *std::get_if<std::string>(&b);
+        case variant_index_v<LiteralVal, bool>:
+          return *std::get_if<bool>(&a) == *std::get_if<bool>(&b);
+        case variant_index_v<LiteralVal, double>:
+          return *std::get_if<double>(&a) == *std::get_if<double>(&b);
+        default:
+          return object(a) == object(b);
+      }
+    }
+
+    // The object a callable, instance, array or map refers to
+    static auto object(LiteralVal const &value) -> void const * {
+      switch (value.index()) {
+        case variant_index_v<LiteralVal, std::shared_ptr<LoxCallable>>:
+          return std::get_if<std::shared_ptr<LoxCallable>>(&value)->get();
+        case variant_index_v<LiteralVal, std::shared_ptr<LoxInstance>>:
+          return std::get_if<std::shared_ptr<LoxInstance>>(&value)->get();
+        case variant_index_v<LiteralVal, std::shared_ptr<LoxArray>>:
+          return std::get_if<std::shared_ptr<LoxArray>>(&value)->get();
+        case variant_index_v<LiteralVal, std::shared_ptr<LoxMap>>:
+          return std::get_if<std::shared_ptr<LoxMap>>(&value)->get();
+        default:
+          return nullptr;
+      }
+    }
+  };
+
+  struct ValueHash {
+    // The MurmurHash3 finalizer: every input bit affects every output bit,
+    // so the table can take its bucket from the low bits and its tag from
+    // the high ones
+    static constexpr auto mix(std::uint64_t x) -> std::uint64_t {
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccd;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53;
+      x ^= x >> 33;
+      return x;
+    }
+
+    auto operator()(LiteralVal const &value) const -> std::size_t {
+      switch (value.index()) {
+        case variant_index_v<LiteralVal, std::monostate>:
+          return mix(1);
+        case variant_index_v<LiteralVal, std::string>:
+          return std::hash<std::string_view>{}(
+              *std::get_if<std::string>(&value));
+        case variant_index_v<LiteralVal, bool>:
+          return mix(*std::get_if<bool>(&value) ? 3 : 2);
+        case variant_index_v<LiteralVal, double>: {
+          // + 0.0 turns -0 into 0, which it equals
+          auto const number = *std::get_if<double>(&value) + 0.0;
+          return mix(std::bit_cast<std::uint64_t>(number));
+        }
+        default:
+          return mix(reinterpret_cast<std::uintptr_t>(
+              ValueEqual::object(value)));
+      }
+    }
+  };
+
+  // Hash map from Lox values to Lox values, in the style of a Swiss table:
+  // open addressing over a flat slot array, with a separate array of
+  // one-byte control tags. A probe loads eight tags at once and compares
+  // them all against 7 bits of the key's hash in a few integer
+  // instructions, so most lookups touch one cache line of tags and then
+  // exactly the slot holding the key. Each slot keeps its key's full hash,
+  // so string keys are hashed once, when inserted, rather than again on
+  // every rehash, and a probe only compares strings whose hashes match.
+  //
+  // Keys may be any value except NaN, which equals nothing, itself included.
+  class LoxMap {
+  private:
+    friend class DeepCopier;
+    friend class Snapshot;
+
+    static constexpr std::size_t GROUP = 8;
+    static constexpr std::uint64_t LOW_BITS = 0x0101010101010101;
+    static constexpr std::uint64_t HIGH_BITS = 0x8080808080808080;
+
+    // A full slot's tag is the top 7 bits of its hash, 0 to 127; free slots
+    // have the high bit set
+    static constexpr std::int8_t EMPTY = -128;
+    static constexpr std::int8_t DELETED = -2;
+
+    static constexpr auto NONE = static_cast<std::size_t>(-1);
+
+    struct Slot {
+      std::size_t hash = 0;
+      LiteralVal key;
+      LiteralVal value;
+    };
+
+    // One byte per slot, then the first GROUP - 1 again so a group read
+    // near the end wraps around without a branch
+    std::vector<std::int8_t> control;
+    std::vector<Slot> slots;
+    std::size_t count = 0;
+    std::size_t growthLeft = 0; // Empty slots usable before a rehash
+
+    // Eight control bytes. Each mask has bit 7 of every byte that matched;
+    // countr_zero / 8 finds the first.
+    class Group {
+    private:
+      std::uint64_t word;
+
+    public:
+      explicit Group(std::int8_t const *at) {
+        std::memcpy(&word, at, sizeof word);
+        if constexpr (std::endian::native == std::endian::big) {
+          word = std::byteswap(word);
+        }
+      }
+
+      // May also flag a full slot whose tag differs in the lowest bit; the
+      // caller compares keys anyway
+      [[nodiscard]] auto match(std::uint8_t tag) const -> std::uint64_t {
+        auto const x = word ^ (LOW_BITS * tag);
+        return (x - LOW_BITS) & ~x & HIGH_BITS;
+      }
+
+      [[nodiscard]] auto matchEmpty() const -> std::uint64_t {
+        return word & ~(word << 6) & HIGH_BITS;
+      }
+
+      [[nodiscard]] auto matchFree() const -> std::uint64_t {
+        return word & HIGH_BITS;
+      }
+    };
+
+    static auto tagOf(std::size_t hash) -> std::uint8_t {
+      return static_cast<std::uint8_t>(hash >> (sizeof hash * 8 - 7));
+    }
+
+    [[nodiscard]] auto mask() const -> std::size_t { return slots.size() - 1; }
+
+    auto setControl(std::size_t index, std::int8_t tag) -> void {
+      control[index] = tag;
+      if (index < GROUP - 1) {
+        control[slots.size() + index] = tag;
+      }
+    }
+
+    // Calls visit(position, group) for the groups at triangular offsets
+    // from the hash's home slot, which reach every group of a power-of-two
+    // table, until it returns true
+    template <typename Visit>
+    auto probe(std::size_t hash, Visit visit) const -> void {
+      auto position = hash & mask();
+      for (std::size_t step = GROUP;
+           !visit(position, Group{&control[position]}); step += GROUP) {
+        position = (position + step) & mask();
+      }
+    }
+
+    [[nodiscard]] auto slotAt(std::size_t position, std::uint64_t bits) const
+        -> std::size_t {
+      return (position + std::countr_zero(bits) / 8) & mask();
+    }
+
+    [[nodiscard]] auto findSlot(LiteralVal const &key, std::size_t hash) const
+        -> std::size_t {
+      if (count == 0) {
+        return NONE;
+      }
+
+      auto const tag = tagOf(hash);
+      auto found = NONE;
+      probe(hash, [&](std::size_t position, Group group) {
+        for (auto bits = group.match(tag); bits != 0; bits &= bits - 1) {
+          auto const index = slotAt(position, bits);
+          if (slots[index].hash == hash &&
+              ValueEqual{}(slots[index].key, key)) {
+            found = index;
+            return true;
+          }
+        }
+        // Inserting never skips an empty slot, so the key isn't further on
+        return group.matchEmpty() != 0;
+      });
+      return found;
+    }
+
+    // First empty or deleted slot along `hash`'s probe sequence
+    [[nodiscard]] auto freeSlot(std::size_t hash) const -> std::size_t {
+      auto found = NONE;
+      probe(hash, [&](std::size_t position, Group group) {
+        auto const bits = group.matchFree();
+        if (bits != 0) {
+          found = slotAt(position, bits);
+        }
+        return bits != 0;
+      });
+      return found;
+    }
+
+    // Capacity a power of two, at least GROUP. Drops every tombstone.
+    auto rehash(std::size_t capacity) -> void {
+      auto old = std::exchange(slots, std::vector<Slot>(capacity));
+      auto const oldControl =
+          std::exchange(control, std::vector<std::int8_t>(
+                                     capacity + GROUP - 1, EMPTY));
+      growthLeft = capacity - capacity / 8 - count;
+
+      for (std::size_t i = 0; i < old.size(); i++) {
+        if (oldControl[i] >= 0) {
+          auto const index = freeSlot(old[i].hash);
+          setControl(index, static_cast<std::int8_t>(tagOf(old[i].hash)));
+          slots[index] = std::move(old[i]);
+        }
+      }
+    }
+
+  public:
+    LoxMap() = default;
+    LoxMap(LoxMap const &) = delete;
+    auto operator=(LoxMap const &) -> LoxMap & = delete;
+    // Maps nested through their keys or values are freed one level at a
+    // time
+    ~LoxMap() {
+      Teardown::release(slots | std::views::transform(&Slot::value));
+      Teardown::release(slots | std::views::transform(&Slot::key));
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return count; }
+
+    // Nullptr if `key` isn't present
+    [[nodiscard]] auto find(LiteralVal const &key) -> LiteralVal * {
+      auto const index = findSlot(key, ValueHash{}(key));
+      return index == NONE ? nullptr : &slots[index].value;
+    }
+
+    auto set(LiteralVal const &key, LiteralVal value) -> void {
+      auto const hash = ValueHash{}(key);
+      if (auto const index = findSlot(key, hash); index != NONE) {
+        slots[index].value = std::move(value);
+        return;
+      }
+
+      if (growthLeft == 0) {
+        // Grow only if live keys, not tombstones, fill half the table
+        auto const capacity = slots.size();
+        rehash(capacity == 0                ? GROUP
+               : count >= capacity * 7 / 16 ? capacity * 2
+                                            : capacity);
+      }
+
+      auto const index = freeSlot(hash);
+      if (control[index] == EMPTY) {
+        growthLeft--;
+      }
+      setControl(index, static_cast<std::int8_t>(tagOf(hash)));
+      slots[index] = Slot{hash, key, std::move(value)};
+      count++;
+    }
+
+    // Whether `key` was present
+    auto erase(LiteralVal const &key) -> bool {
+      auto const index = findSlot(key, ValueHash{}(key));
+      if (index == NONE) {
+        return false;
+      }
+
+      setControl(index, DELETED);
+      slots[index] = Slot{};
+      count--;
+      return true;
+    }
+
+    // Calls visit(key, value) for every entry, in slot order
+    template <typename Visit> auto forEach(Visit visit) const -> void {
+      for (std::size_t i = 0; i < slots.size(); i++) {
+        if (control[i] >= 0) {
+          visit(slots[i].key, slots[i].value);
+        }
+      }
+    }
+
+    // See appendValue()
+    auto appendTo(std::string &out, std::vector<void const *> &open) const
+        -> void {
+      if (std::ranges::find(open, this) != open.end()) {
+        out += "{...}";
+        return;
+      }
+      open.push_back(this);
+
+      out += '{';
+      auto first = true;
+      forEach([&](LiteralVal const &key, LiteralVal const &value) {
+        if (!std::exchange(first, false)) {
+          out += ", ";
+        }
+        appendValue(out, key, open);
+        out += ": ";
+        appendValue(out, value, open);
+      });
+      out += '}';
+
+      open.pop_back();
+    }
+
+    [[nodiscard]] auto toString() const -> std::string {
+      auto out = std::string{};
+      auto open = std::vector<void const *>{};
+      appendTo(out, open);
+      return out;
+    }
+  };
+
+  inline auto to_string(LoxMap const &map) -> std::string {
+    return map.toString();
+  }
+
+  inline auto appendValue(std::string &out, LiteralVal const &value,
+                          std::vector<void const *> &open) -> void {
+    if (auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&value)) {
+      (*array)->appendTo(out, open);
+    } else if (auto const *map =
+                   std::get_if<std::shared_ptr<LoxMap>>(&value)) {
+      (*map)->appendTo(out, open);
+    } else {
+      out += to_string(value);
+    }
+  }
+} // namespace lox
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lox {
+  // Read-only mapping of a whole file, unmapped on destruction
+  class MappedFile {
+  private:
+    void *data = nullptr;
+    std::size_t size = 0;
+
+    MappedFile(void *data, std::size_t size) : data{data}, size{size} {}
+
+  public:
+    MappedFile(MappedFile &&other) noexcept
+        : data{std::exchange(other.data, nullptr)},
+          size{std::exchange(other.size, 0)} {}
+    MappedFile(MappedFile const &) = delete;
+    auto operator=(MappedFile const &) -> MappedFile & = delete;
+    auto operator=(MappedFile &&) -> MappedFile & = delete;
+
+    ~MappedFile() {
+      if (data != nullptr) {
+        munmap(data, size);
+      }
+    }
+
+    static auto open(std::filesystem::path const &path)
+        -> std::optional<MappedFile> {
+      auto const fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return std::nullopt;
+      }
+
+      struct stat info {};
+      if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return std::nullopt;
+      }
+
+      auto const size = static_cast<std::size_t>(info.st_size);
+      auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED) {
+        return std::nullopt;
+      }
+
+      return MappedFile{data, size};
+    }
+
+    [[nodiscard]] auto bytes() const -> std::string_view {
+      return {static_cast<char const *>(data), size};
+    }
+  };
+} // namespace lox
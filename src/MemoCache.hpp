@@ -0,0 +1,124 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "LoxMap.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // Results of a pure function (see Purity) by argument list. Holds at most
+  // CAPACITY of them, dropping the least recently used first.
+  class MemoCache {
+  public:
+    static constexpr std::size_t CAPACITY = 1024;
+
+    // What each of the function's callees referred to when these results
+    // were computed
+    std::vector<LoxCallable const *> callees;
+
+  private:
+    struct Entry {
+      std::vector<LiteralVal> arguments;
+      LiteralVal result;
+    };
+
+    using Key = std::span<LiteralVal const>;
+
+    // Unlike ValueEqual, numbers are equal only if their bits are: 1 / x
+    // tells 0 from -0
+    struct KeyEqual {
+      auto operator()(Key a, Key b) const -> bool {
+        if (a.size() != b.size()) {
+          return false;
+        }
+        for (std::size_t i = 0; i < a.size(); i++) {
+          auto const *x = std::get_if<double>(&a[i]);
+          auto const *y = std::get_if<double>(&b[i]);
+          if (x != nullptr && y != nullptr
+                  ? std::bit_cast<std::uint64_t>(*x) !=
+                        std::bit_cast<std::uint64_t>(*y)
+                  : !ValueEqual{}(a[i], b[i])) {
+            return false;
+          }
+        }
+        return true;
+      }
+    };
+
+    struct KeyHash {
+      auto operator()(Key arguments) const -> std::size_t {
+        auto hash = std::uint64_t{arguments.size()};
+        for (auto const &argument : arguments) {
+          hash = ValueHash::mix(hash ^ ValueHash{}(argument));
+        }
+        return hash;
+      }
+    };
+
+    std::list<Entry> entries; // Most recently used first
+    // Keys view the arguments of the entry they point to
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEqual>
+        index;
+
+  public:
+    // Only arguments compared by value can be looked up: the contents of an
+    // array, instance or map may have changed since
+    static auto accepts(std::span<LiteralVal const> arguments) -> bool {
+      for (auto const &argument : arguments) {
+        switch (argument.index()) {
+          case variant_index_v<LiteralVal, std::monostate>:
+          case variant_index_v<LiteralVal, std::string>:
+          case variant_index_v<LiteralVal, bool>:
+          case variant_index_v<LiteralVal, double>:
+            break;
+          default:
+            return false;
+        }
+      }
+      return true;
+    }
+
+    // Nullptr if there's no result for `arguments`
+    auto find(std::span<LiteralVal const> arguments) -> LiteralVal const * {
+      auto found = index.find(arguments);
+      if (found == index.end()) {
+        return nullptr;
+      }
+      entries.splice(entries.begin(), entries, found->second);
+      return &found->second->result;
+    }
+
+    auto insert(std::span<LiteralVal const> arguments, LiteralVal result)
+        -> void {
+      if (auto found = index.find(arguments); found != index.end()) {
+        found->second->result = std::move(result);
+        return;
+      }
+
+      if (entries.size() == CAPACITY) {
+        index.erase(Key{entries.back().arguments});
+        entries.pop_back();
+      }
+      entries.push_front(
+          {{arguments.begin(), arguments.end()}, std::move(result)});
+      index.emplace(Key{entries.front().arguments}, entries.begin());
+    }
+
+    auto clear() -> void {
+      index.clear();
+      entries.clear();
+    }
+  };
+} // namespace lox
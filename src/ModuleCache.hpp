@@ -0,0 +1,218 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Parser.hpp"
+#include "Purity.hpp"
+#include "Report.hpp"
+#include "Resolver.hpp"
+#include "Scanner.hpp"
+#include "Stmt.hpp"
+#include "Tasks.hpp"
+#include "TypeInference.hpp"
+
+namespace lox {
+  // A file brought in by `import`. Its program is analysed once, when it's
+  // loaded, and shared read-only by every run that imports it.
+  struct Module {
+    std::string const name; // Its path as first imported, for errors
+    std::vector<std::unique_ptr<stmt::Stmt>> program;
+    std::vector<ReportError> errors; // From reading, scanning or parsing it
+    bool loaded = false;             // Guarded by ModuleCache's mutex
+
+    explicit Module(std::string name) : name{std::move(name)} {}
+  };
+
+  // Records that `error` happened in `module`, or in the main program when
+  // that's null, unless it's already known where it happened
+  inline auto located(ReportError error, Module const *module)
+      -> ReportError {
+    if (!error.file) {
+      error.file = module != nullptr ? module->name : std::string{};
+    }
+    return error;
+  }
+
+  // Every module imported in the process, by canonical path. Each file is
+  // read, scanned and parsed once, on the task pool; the imports it makes
+  // start loading as soon as it's parsed, alongside whatever else is
+  // loading. Files edited after they were loaded aren't read again.
+  class ModuleCache {
+  private:
+    using Program = std::vector<std::unique_ptr<stmt::Stmt>>;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::unordered_map<std::string, std::unique_ptr<Module>> modules;
+
+    static auto readFile(std::filesystem::path const &path)
+        -> std::optional<std::string> {
+      auto input = std::ifstream{path};
+      if (!input) {
+        return std::nullopt;
+      }
+      return std::string{std::istreambuf_iterator<char>{input}, {}};
+    }
+
+    static auto tagged(std::vector<ReportError> errors, std::string const &name)
+        -> std::vector<ReportError> {
+      for (auto &error : errors) {
+        error.file = name;
+      }
+      return errors;
+    }
+
+    // Points every function declared anywhere in `statements` at `module`,
+    // so runtime errors in their bodies name its file
+    static auto markFunctions(
+        std::span<std::unique_ptr<stmt::Stmt> const> statements,
+        Module const &module) -> void {
+      for (auto const &stmt : statements) {
+        if (stmt == nullptr) {
+          continue;
+        }
+        std::visit(
+            overloaded{[&](stmt::Function const &function) {
+                         function.module = &module;
+                         markFunctions(function.body, module);
+                       },
+                       [&](stmt::Class const &klass) {
+                         markFunctions(klass.methods, module);
+                       },
+                       [&](stmt::Block const &block) {
+                         markFunctions(block.statements, module);
+                       },
+                       [&](stmt::If const &branch) {
+                         markFunctions(
+                             std::span{&branch.thenBranch, 1}, module);
+                         if (branch.elseBranch) {
+                           markFunctions(
+                               std::span{&branch.elseBranch, 1}, module);
+                         }
+                       },
+                       [&](stmt::While const &loop) {
+                         markFunctions(std::span{&loop.body, 1}, module);
+                       },
+                       [](auto const & /*other*/) {}},
+            *stmt);
+      }
+    }
+
+    // Runs on the pool; `module` isn't visible to other threads until it's
+    // marked loaded
+    auto load(Module &module, std::filesystem::path const &path) -> void {
+      auto program = Program{};
+      auto errors = std::vector<ReportError>{};
+
+      if (auto source = readFile(path); !source) {
+        errors.emplace_back("Could not open file.");
+      } else if (auto [tokens, scanned] = Scanner{*source}.scanTokens();
+                 scanned.status == ScannerStatus::HAS_ERRORS) {
+        errors = std::move(scanned.errors);
+      } else if (auto [statements, parsed] = Parser{std::move(tokens)}.parse();
+                 parsed.status == ParserStatus::HAS_ERRORS) {
+        errors = std::move(parsed.errors);
+      } else {
+        program = std::move(statements);
+        Resolver::annotate(program);
+        TypeInference::annotate(program);
+        Purity::annotate(program);
+        markFunctions(program, module);
+        link(program, path.parent_path());
+      }
+
+      {
+        auto lock = std::lock_guard{mutex};
+        module.program = std::move(program);
+        module.errors = tagged(std::move(errors), module.name);
+        module.loaded = true;
+      }
+      changed.notify_all();
+    }
+
+    static auto importsOf(Program const &program)
+        -> std::vector<stmt::Import const *> {
+      auto imports = std::vector<stmt::Import const *>{};
+      for (auto const &stmt : program) {
+        if (auto const *import = std::get_if<stmt::Import>(stmt.get())) {
+          imports.push_back(import);
+        }
+      }
+      return imports;
+    }
+
+  public:
+    static auto shared() -> ModuleCache & {
+      static auto cache = ModuleCache{};
+      return cache;
+    }
+
+    // Points each import in `program` at its module, relative to
+    // `directory`, and starts loading the ones not loaded or loading yet
+    auto link(Program const &program, std::filesystem::path const &directory)
+        -> void {
+      for (auto const *import : importsOf(program)) {
+        auto const path =
+            (directory / std::get<std::string>(import->path.literal))
+                .lexically_normal();
+        auto key = std::filesystem::weakly_canonical(path).string();
+
+        auto lock = std::lock_guard{mutex};
+        auto [found, added] = modules.try_emplace(std::move(key));
+        if (added) {
+          found->second = std::make_unique<Module>(path.string());
+          taskPool().submit(
+              [this, &module = *found->second, path] { load(module, path); });
+        }
+        import->module = found->second.get();
+      }
+    }
+
+    // The module loaded from `file`, if anything imported it; null if not
+    auto find(std::filesystem::path const &file) -> Module const * {
+      if (file.empty()) {
+        return nullptr;
+      }
+      auto const key = std::filesystem::weakly_canonical(file).string();
+      auto lock = std::lock_guard{mutex};
+      auto const found = modules.find(key);
+      return found != modules.end() ? found->second.get() : nullptr;
+    }
+
+    // Waits for every module `program` imports, directly or through other
+    // modules, and returns the errors any of them had
+    auto wait(Program const &program) -> std::vector<ReportError> {
+      auto errors = std::vector<ReportError>{};
+      auto seen = std::unordered_set<Module const *>{};
+      auto pending = importsOf(program);
+      for (std::size_t next = 0; next < pending.size(); next++) {
+        auto const &module = *pending[next]->module;
+        if (!seen.insert(&module).second) {
+          continue;
+        }
+
+        helpUntil(mutex, changed, [&] { return module.loaded; });
+        for (auto const &error : module.errors) {
+          errors.push_back(error);
+        }
+        auto const imports = importsOf(module.program);
+        pending.insert(pending.end(), imports.begin(), imports.end());
+      }
+      return errors;
+    }
+  };
+} // namespace lox
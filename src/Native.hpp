@@ -0,0 +1,373 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Environment.hpp"
+#include "LoxArray.hpp"
+#include "LoxCallable.hpp"
+#include "LoxGenerator.hpp"
+#include "LoxMap.hpp"
+#include "Report.hpp"
+#include "Tasks.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // How a native's C++ parameter type is read out of an argument. `from`
+  // points into the argument itself, so strings and instances are passed by
+  // reference rather than copied; it's null when the argument has another
+  // type.
+  template <typename T> struct NativeParameter;
+
+  template <> struct NativeParameter<double> {
+    static constexpr std::string_view DESCRIPTION = "a number";
+    static auto from(LiteralVal const &value) {
+      return std::get_if<double>(&value);
+    }
+  };
+
+  template <> struct NativeParameter<bool> {
+    static constexpr std::string_view DESCRIPTION = "a boolean";
+    static auto from(LiteralVal const &value) {
+      return std::get_if<bool>(&value);
+    }
+  };
+
+  template <> struct NativeParameter<std::string> {
+    static constexpr std::string_view DESCRIPTION = "a string";
+    static auto from(LiteralVal const &value) {
+      return std::get_if<std::string>(&value);
+    }
+  };
+
+  template <> struct NativeParameter<std::shared_ptr<LoxInstance>> {
+    static constexpr std::string_view DESCRIPTION = "an instance";
+    static auto from(LiteralVal const &value) {
+      return std::get_if<std::shared_ptr<LoxInstance>>(&value);
+    }
+  };
+
+  template <> struct NativeParameter<LoxChannel> {
+    static constexpr std::string_view DESCRIPTION = "a channel";
+    static auto from(LiteralVal const &value) -> LoxChannel * {
+      auto const *callable = std::get_if<std::shared_ptr<LoxCallable>>(&value);
+      return callable ? dynamic_cast<LoxChannel *>(callable->get()) : nullptr;
+    }
+  };
+
+  template <> struct NativeParameter<LoxGenerator> {
+    static constexpr std::string_view DESCRIPTION = "a generator";
+    static auto from(LiteralVal const &value) -> LoxGenerator * {
+      auto const *callable = std::get_if<std::shared_ptr<LoxCallable>>(&value);
+      return callable ? dynamic_cast<LoxGenerator *>(callable->get())
+                      : nullptr;
+    }
+  };
+
+  template <> struct NativeParameter<LoxArray> {
+    static constexpr std::string_view DESCRIPTION = "an array";
+    static auto from(LiteralVal const &value) -> LoxArray * {
+      auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&value);
+      return array ? array->get() : nullptr;
+    }
+  };
+
+  template <> struct NativeParameter<LoxMap> {
+    static constexpr std::string_view DESCRIPTION = "a map";
+    static auto from(LiteralVal const &value) -> LoxMap * {
+      auto const *map = std::get_if<std::shared_ptr<LoxMap>>(&value);
+      return map ? map->get() : nullptr;
+    }
+  };
+
+  // Any value at all
+  template <> struct NativeParameter<LiteralVal> {
+    static constexpr std::string_view DESCRIPTION = "a value";
+    static auto from(LiteralVal const &value) { return &value; }
+  };
+
+  // Natives are told apart from Lox functions by name, which is also how a
+  // Snapshot refers to them
+  class LoxNative : public LoxCallable {
+  private:
+    std::string const name;
+
+  public:
+    explicit LoxNative(std::string name) : name{std::move(name)} {}
+
+    [[nodiscard]] auto nativeName() const -> std::string const & {
+      return name;
+    }
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return "<native fn " + name + ">";
+    }
+  };
+
+  template <typename Signature, typename Function> class NativeFunction;
+
+  // A C++ callable exposed to Lox with the typed signature `Signature`, e.g.
+  // double(double, double). Arguments are checked and unpacked straight from
+  // the caller's argument span, then `function` is called directly; it's
+  // stored by value so the compiler can inline it into call().
+  //
+  // Parameters may be double, bool, std::string, std::shared_ptr<LoxInstance>
+  // or LiteralVal, by value or const reference, or a runtime object such as
+  // LoxArray or LoxMap by reference. The result may be void (nil),
+  // any type a LiteralVal holds, or a Result<LiteralVal> for natives that can
+  // fail.
+  template <typename Return, typename... Params, typename Function>
+  class NativeFunction<Return(Params...), Function> : public LoxNative {
+  private:
+    static constexpr auto DESCRIPTIONS =
+        std::array<std::string_view, sizeof...(Params)>{
+            NativeParameter<std::remove_cvref_t<Params>>::DESCRIPTION...};
+
+    Function const function;
+
+    [[nodiscard]] auto typeError(std::size_t index) const -> ReportError {
+      return ReportError{"Expected " + std::string{DESCRIPTIONS[index]} +
+                         " for argument " + std::to_string(index + 1) +
+                         " of '" + nativeName() + "'."};
+    }
+
+    template <std::size_t... I>
+    auto invoke([[maybe_unused]] std::span<LiteralVal const> arguments,
+                std::index_sequence<I...> /*indices*/) const
+        -> Result<LiteralVal> {
+      auto const unpacked = std::tuple{
+          NativeParameter<std::remove_cvref_t<Params>>::from(arguments[I])...};
+
+      auto mismatch = std::size_t{0};
+      if (!((std::get<I>(unpacked) != nullptr || (mismatch = I, false)) &&
+            ...)) {
+        return std::unexpected(typeError(mismatch));
+      }
+
+      if constexpr (std::is_void_v<Return>) {
+        function(*std::get<I>(unpacked)...);
+        return LiteralVal{};
+      } else if constexpr (std::is_same_v<Return, Result<LiteralVal>>) {
+        return function(*std::get<I>(unpacked)...);
+      } else {
+        return LiteralVal{function(*std::get<I>(unpacked)...)};
+      }
+    }
+
+  public:
+    NativeFunction(std::string name, Function function)
+        : LoxNative{std::move(name)}, function{std::move(function)} {}
+
+    [[nodiscard]] auto arity() const -> int override {
+      return static_cast<int>(sizeof...(Params));
+    }
+
+    // The interpreter has already checked the argument count
+    auto call(Interpreter & /*interpreter*/,
+              std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override {
+      return invoke(arguments, std::index_sequence_for<Params...>{});
+    }
+  };
+
+  template <typename Signature, typename Function>
+  auto makeNative(std::string name, Function function)
+      -> std::shared_ptr<LoxNative> {
+    return std::make_shared<
+        NativeFunction<Signature, std::decay_t<Function>>>(
+        std::move(name), std::move(function));
+  }
+
+  // spawn(fn) runs `fn`, which takes no arguments, as a task on taskPool().
+  // The task works on a deep copy of `fn` and everything it can reach, so it
+  // shares no mutable state with its spawner; the LoxTask it returns waits
+  // for the result when called.
+  //
+  // That reach runs through `fn`'s closure up to the global scope, so each
+  // spawn copies every global and all it holds, used by `fn` or not, on the
+  // spawning thread before the task starts. Large arrays or maps in globals
+  // slow down every spawn; in the locals of a function `fn` isn't nested in
+  // they aren't copied.
+  class SpawnNative : public LoxNative {
+  public:
+    SpawnNative() : LoxNative{"spawn"} {}
+
+    [[nodiscard]] auto arity() const -> int override { return 1; }
+
+    // Defined in Interpreter.hpp, it needs the complete Interpreter
+    auto call(Interpreter &interpreter, std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+  };
+
+  // Defines `name` in `globals` as a native, e.g.
+  //   registerNative<double(double, double)>(globals, "pow", ...);
+  template <typename Signature, typename Function>
+  auto registerNative(Environment &globals, std::string const &name,
+                      Function function) -> void {
+    globals.define(name, std::static_pointer_cast<LoxCallable>(
+                             makeNative<Signature>(name, std::move(function))));
+  }
+
+  // Natives every program starts with. Built once and shared: they hold no
+  // state, so every interpreter (on any thread) can call the same objects.
+  inline auto standardNatives()
+      -> std::vector<std::shared_ptr<LoxNative>> const & {
+    using Unary = double(double);
+    using Binary = double(double, double);
+
+    static auto const natives = std::vector<std::shared_ptr<LoxNative>>{
+        // Seconds since an arbitrary start, for timing code
+        makeNative<double()>("clock", [] {
+          auto const now = std::chrono::steady_clock::now();
+          return std::chrono::duration<double>(now.time_since_epoch()).count();
+        }),
+        makeNative<Unary>("abs", [](double x) { return std::abs(x); }),
+        makeNative<Unary>("sqrt", [](double x) { return std::sqrt(x); }),
+        makeNative<Unary>("floor", [](double x) { return std::floor(x); }),
+        makeNative<Unary>("ceil", [](double x) { return std::ceil(x); }),
+        makeNative<Unary>("exp", [](double x) { return std::exp(x); }),
+        makeNative<Unary>("log", [](double x) { return std::log(x); }),
+        makeNative<Unary>("sin", [](double x) { return std::sin(x); }),
+        makeNative<Unary>("cos", [](double x) { return std::cos(x); }),
+        makeNative<Binary>("pow",
+                           [](double x, double y) { return std::pow(x, y); }),
+        makeNative<Binary>("min",
+                           [](double x, double y) { return std::fmin(x, y); }),
+        makeNative<Binary>("max",
+                           [](double x, double y) { return std::fmax(x, y); }),
+
+        // array(n) is n zeros; [a, b, c] builds one from values
+        makeNative<Result<LiteralVal>(double)>(
+            "array",
+            [](double size) -> Result<LiteralVal> {
+              if (!(size >= 0 && std::trunc(size) == size)) {
+                return std::unexpected(ReportError{
+                    "Array size must be a non-negative whole number."});
+              }
+              return std::make_shared<LoxArray>(
+                  std::vector<double>(static_cast<std::size_t>(size)));
+            }),
+        makeNative<Result<LiteralVal>(LiteralVal const &)>(
+            "len",
+            [](LiteralVal const &value) -> Result<LiteralVal> {
+              if (auto const *array =
+                      std::get_if<std::shared_ptr<LoxArray>>(&value)) {
+                return static_cast<double>((*array)->size());
+              }
+              if (auto const *map =
+                      std::get_if<std::shared_ptr<LoxMap>>(&value)) {
+                return static_cast<double>((*map)->size());
+              }
+              if (auto const *text = std::get_if<std::string>(&value)) {
+                return static_cast<double>(text->size());
+              }
+              return std::unexpected(ReportError{
+                  "Expected an array, map or string for argument 1 of "
+                  "'len'."});
+            }),
+        makeNative<void(LoxArray &, LiteralVal const &)>(
+            "push", [](LoxArray &array, LiteralVal const &value) {
+              array.push(value);
+            }),
+        makeNative<Result<LiteralVal>(LoxArray &)>(
+            "sum",
+            [](LoxArray &array) -> Result<LiteralVal> {
+              auto const *numbers = array.numbers();
+              if (numbers == nullptr) {
+                return std::unexpected(
+                    ReportError{"Can only sum an array of numbers."});
+              }
+              return kernels::sum(*numbers);
+            }),
+        makeNative<Result<LiteralVal>(LoxArray &, LoxArray &)>(
+            "dot",
+            [](LoxArray &a, LoxArray &b) -> Result<LiteralVal> {
+              auto const *left = a.numbers();
+              auto const *right = b.numbers();
+              if (left == nullptr || right == nullptr) {
+                return std::unexpected(ReportError{
+                    "Can only take the dot product of arrays of numbers."});
+              }
+              if (left->size() != right->size()) {
+                return std::unexpected(
+                    ReportError{"Arrays must have the same length."});
+              }
+              return kernels::dot(*left, *right);
+            }),
+
+        // m[key] reads nil for a missing key; has() tells it from a nil value
+        makeNative<LiteralVal()>("map",
+                                 []() -> LiteralVal {
+                                   return std::make_shared<LoxMap>();
+                                 }),
+        makeNative<bool(LoxMap &, LiteralVal const &)>(
+            "has", [](LoxMap &map, LiteralVal const &key) {
+              return map.find(key) != nullptr;
+            }),
+        makeNative<bool(LoxMap &, LiteralVal const &)>(
+            "remove", [](LoxMap &map, LiteralVal const &key) {
+              return map.erase(key);
+            }),
+        makeNative<LiteralVal(LoxMap &)>(
+            "keys",
+            [](LoxMap &map) -> LiteralVal {
+              auto keys = std::vector<LiteralVal>{};
+              keys.reserve(map.size());
+              map.forEach([&](LiteralVal const &key, LiteralVal const &) {
+                keys.push_back(key);
+              });
+              auto array = std::make_shared<LoxArray>(std::move(keys));
+              array->numbers(); // Unboxed if every key is a number
+              return array;
+            }),
+
+        // Whether a generator's body has run to its end
+        makeNative<bool(LoxGenerator &)>(
+            "done", [](LoxGenerator &generator) { return generator.done(); }),
+
+        std::make_shared<SpawnNative>(),
+        makeNative<LiteralVal()>("channel",
+                                 []() -> LiteralVal {
+                                   return std::static_pointer_cast<LoxCallable>(
+                                       std::make_shared<LoxChannel>());
+                                 }),
+        makeNative<void(LoxChannel &, LiteralVal const &)>(
+            "send", [](LoxChannel &channel, LiteralVal const &value) {
+              channel.send(value);
+            }),
+    };
+    return natives;
+  }
+
+  inline auto findStandardNative(std::string_view name)
+      -> std::shared_ptr<LoxNative> {
+    for (auto const &native : standardNatives()) {
+      if (native->nativeName() == name) {
+        return native;
+      }
+    }
+    return nullptr;
+  }
+
+  // A run's global scope holding the standard natives. Its scopes allocate
+  // from an Arena, so it's only for use on one thread at a time.
+  inline auto makeGlobals() -> std::shared_ptr<Environment> {
+    auto globals = Environment::withArena();
+    for (auto const &native : standardNatives()) {
+      globals->define(native->nativeName(),
+                      std::static_pointer_cast<LoxCallable>(native));
+    }
+    return globals;
+  }
+} // namespace lox
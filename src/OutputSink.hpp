@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace lox {
+  // Where `print` output goes. The interpreter only ever appends text and
+  // marks line ends; each sink decides when bytes actually leave the process.
+  class OutputSink {
+  public:
+    OutputSink() = default;
+    OutputSink(OutputSink const &) = delete;
+    auto operator=(OutputSink const &) -> OutputSink & = delete;
+    virtual ~OutputSink() = default;
+
+    virtual auto write(std::string_view text) -> void = 0;
+    virtual auto endLine() -> void { write("\n"); }
+    virtual auto flush() -> void {}
+  };
+
+  enum class FlushPolicy {
+    LINE,    // Flush after every line, like std::endl
+    SIZE,    // Flush whenever the buffer fills up
+    EXPLICIT // Grow the buffer and only flush on flush() or destruction
+  };
+
+  class BufferedWriter : public OutputSink {
+  private:
+    std::FILE *const file;
+    FlushPolicy const policy;
+    std::size_t const capacity;
+    std::vector<char> buffer;
+
+  public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    BufferedWriter(std::FILE *file, FlushPolicy policy,
+                   std::size_t capacity = DEFAULT_CAPACITY)
+        : file{file}, policy{policy}, capacity{capacity} {
+      buffer.reserve(capacity);
+    }
+
+    // Line-flushed when a person is watching, size-flushed when piped
+    static auto forStdout() -> std::shared_ptr<BufferedWriter> {
+      return std::make_shared<BufferedWriter>(
+          stdout, isatty(fileno(stdout)) != 0 ? FlushPolicy::LINE
+                                              : FlushPolicy::SIZE);
+    }
+
+    BufferedWriter(BufferedWriter const &) = delete;
+    auto operator=(BufferedWriter const &) -> BufferedWriter & = delete;
+    ~BufferedWriter() override { flush(); }
+
+    auto write(std::string_view text) -> void override {
+      if (policy != FlushPolicy::EXPLICIT &&
+          buffer.size() + text.size() > capacity) {
+        flush();
+
+        // Too big to be worth buffering
+        if (text.size() >= capacity) {
+          std::fwrite(text.data(), 1, text.size(), file);
+          return;
+        }
+      }
+
+      buffer.insert(buffer.end(), text.begin(), text.end());
+    }
+
+    auto endLine() -> void override {
+      write("\n");
+      if (policy == FlushPolicy::LINE) {
+        flush();
+      }
+    }
+
+    auto flush() -> void override {
+      if (!buffer.empty()) {
+        std::fwrite(buffer.data(), 1, buffer.size(), file);
+        buffer.clear();
+      }
+      std::fflush(file);
+    }
+  };
+
+  // Keeps everything in memory, for hosts embedding the interpreter
+  class CaptureSink : public OutputSink {
+  private:
+    std::string captured;
+
+  public:
+    auto write(std::string_view text) -> void override {
+      captured.append(text);
+    }
+
+    [[nodiscard]] auto str() const -> std::string const & { return captured; }
+
+    auto take() -> std::string { return std::exchange(captured, {}); }
+  };
+} // namespace lox
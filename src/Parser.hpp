@@ -2,7 +2,6 @@
 
 #include <algorithm>
 #include <concepts>
-#include <exception>
 #include <memory>
 #include <optional>
 #include <tuple>
@@ -22,11 +21,14 @@ namespace lox {
   class Parser {
     std::vector<Token> tokens;
     int current = 0;
+    int functionDepth = 0;
+    int blockDepth = 0;
+    bool functionYields = false; // A yield in the innermost function so far
 
     Report<ParserStatus> report;
 
     static auto generateParserError(Token token, std::string message) {
-      return ReportError(std::move(token), std::move(message));
+      return std::unexpected(ReportError(std::move(token), std::move(message)));
     }
 
     auto previous() { return tokens.at(current - 1); }
@@ -71,12 +73,12 @@ namespace lox {
       });
     }
 
-    auto consume(TokenType type, std::string message) -> Token {
+    auto consume(TokenType type, std::string message) -> Result<Token> {
       if (check(type)) {
         return advance();
       }
 
-      throw generateParserError(peek(), std::move(message));
+      return generateParserError(peek(), std::move(message));
     }
 
     auto synchronize() -> void {
@@ -96,6 +98,7 @@ namespace lox {
           case TokenType::WHILE:
           case TokenType::PRINT:
           case TokenType::RETURN:
+          case TokenType::YIELD:
             return;
           default:
             break;
@@ -106,110 +109,289 @@ namespace lox {
     }
 
     /* #region Expr */
-    auto expression() -> std::unique_ptr<expr::Expr> { return assignment(); }
+    // Expressions are parsed by operator precedence over two explicit stacks
+    // rather than by recursive descent, so however deeply an expression
+    // nests, parsing it takes heap proportional to the depth and no C++
+    // stack. `operators` holds the operators and open brackets still
+    // waiting for operands, `operands` the finished subexpressions.
+    enum class Precedence {
+      NONE, // Brackets: nothing reduces past them
+      ASSIGNMENT,
+      OR,
+      AND,
+      EQUALITY,
+      COMPARISON,
+      TERM,
+      FACTOR,
+      UNARY
+    };
+
+    struct Pending {
+      enum class Kind {
+        BINARY,
+        LOGICAL,
+        ASSIGN,
+        UNARY,
+        GROUPING,
+        CALL,
+        INDEX,
+        ARRAY
+      };
+
+      Kind kind;
+      Token token; // The operator or opening bracket
+      Precedence precedence = Precedence::NONE;
+      std::unique_ptr<expr::Expr> target = nullptr; // Callee, indexed object
+      // Arguments or elements
+      std::vector<std::unique_ptr<expr::Expr>> items = {};
+    };
+
+    using ExprPtr = std::unique_ptr<expr::Expr>;
+
+    static auto infix(TokenType type) -> std::pair<Pending::Kind, Precedence> {
+      switch (type) {
+        case TokenType::EQUAL:
+          return {Pending::Kind::ASSIGN, Precedence::ASSIGNMENT};
+        case TokenType::OR:
+          return {Pending::Kind::LOGICAL, Precedence::OR};
+        case TokenType::AND:
+          return {Pending::Kind::LOGICAL, Precedence::AND};
+        case TokenType::BANG_EQUAL:
+        case TokenType::EQUAL_EQUAL:
+          return {Pending::Kind::BINARY, Precedence::EQUALITY};
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+          return {Pending::Kind::BINARY, Precedence::COMPARISON};
+        case TokenType::MINUS:
+        case TokenType::PLUS:
+          return {Pending::Kind::BINARY, Precedence::TERM};
+        case TokenType::SLASH:
+        case TokenType::STAR:
+          return {Pending::Kind::BINARY, Precedence::FACTOR};
+        default:
+          return {Pending::Kind::BINARY, Precedence::NONE};
+      }
+    }
 
-    auto assignment() -> std::unique_ptr<expr::Expr> {
-      auto expr = orExpr();
+    static auto pop(std::vector<ExprPtr> &operands) -> ExprPtr {
+      auto operand = std::move(operands.back());
+      operands.pop_back();
+      return operand;
+    }
 
-      if (match(TokenType::EQUAL)) {
-        auto equals = previous();
-        auto value = assignment();
+    auto assignTo(ExprPtr target, Token const &equals, ExprPtr value)
+        -> ExprPtr {
+      if (auto *val = std::get_if<expr::Variable>(&(*target))) {
+        auto name = val->name;
+        return make_unique_variant<expr::Expr, expr::Assign>(name, value);
+      }
 
-        if (auto *val = std::get_if<expr::Variable>(&(*expr))) {
-          auto name = val->name;
-          return make_unique_variant<expr::Expr, expr::Assign>(name, value);
-        }
+      if (auto *get = std::get_if<expr::Get>(&(*target))) {
+        return make_unique_variant<expr::Expr, expr::Set>(get->object,
+                                                          get->name, value);
+      }
 
-        report.addError(ReportError{equals, "Invalid assignment target."});
+      if (auto *index = std::get_if<expr::Index>(&(*target))) {
+        return make_unique_variant<expr::Expr, expr::SetIndex>(
+            index->object, index->bracket, index->index, value);
       }
 
-      return expr;
+      report.addError(ReportError{equals, "Invalid assignment target."});
+      return target;
     }
 
-    auto orExpr() -> std::unique_ptr<expr::Expr> {
-      auto expr = andExpr();
-
-      while (match(TokenType::OR)) {
-        auto op = previous();
-        auto right = andExpr();
-        expr = make_unique_variant<expr::Expr, expr::Logical>(expr, op, right);
+    // Builds the nodes for the operators on top of `operators` whose
+    // precedence is at least `lowest`, stopping at a bracket
+    auto reduce(std::vector<Pending> &operators, std::vector<ExprPtr> &operands,
+                Precedence lowest) -> void {
+      while (!operators.empty() && operators.back().precedence >= lowest &&
+             operators.back().precedence != Precedence::NONE) {
+        auto pending = std::move(operators.back());
+        operators.pop_back();
+        auto right = pop(operands);
+
+        switch (pending.kind) {
+          case Pending::Kind::UNARY:
+            operands.push_back(make_unique_variant<expr::Expr, expr::Unary>(
+                pending.token, right));
+            break;
+          case Pending::Kind::ASSIGN: {
+            auto target = pop(operands);
+            operands.push_back(
+                assignTo(std::move(target), pending.token, std::move(right)));
+            break;
+          }
+          case Pending::Kind::LOGICAL: {
+            auto left = pop(operands);
+            operands.push_back(make_unique_variant<expr::Expr, expr::Logical>(
+                left, pending.token, right));
+            break;
+          }
+          default: {
+            auto left = pop(operands);
+            operands.push_back(make_unique_variant<expr::Expr, expr::Binary>(
+                left, pending.token, right));
+            break;
+          }
+        }
       }
-
-      return expr;
     }
 
-    auto andExpr() -> std::unique_ptr<expr::Expr> {
-      auto expr = equality();
-
-      while (match(TokenType::AND)) {
-        auto op = previous();
-        auto right = equality();
-        expr = make_unique_variant<expr::Expr, expr::Logical>(expr, op, right);
+    // Pushes any prefix operators and opening brackets, then parses the
+    // literal, name or `super`/`this` access they lead up to
+    auto operand(std::vector<Pending> &operators) -> Result<ExprPtr> {
+      while (true) {
+        if (match({TokenType::BANG, TokenType::MINUS})) {
+          operators.push_back(
+              {Pending::Kind::UNARY, previous(), Precedence::UNARY});
+        } else if (match(TokenType::LEFT_PAREN)) {
+          operators.push_back({Pending::Kind::GROUPING, previous()});
+        } else if (check(TokenType::LEFT_BRACKET)) {
+          auto bracket = advance();
+          if (match(TokenType::RIGHT_BRACKET)) {
+            return make_unique_variant<expr::Expr, expr::Array>(
+                bracket, std::vector<ExprPtr>{});
+          }
+          operators.push_back({Pending::Kind::ARRAY, bracket});
+        } else {
+          return primary();
+        }
       }
-
-      return expr;
     }
 
-    auto equality() -> std::unique_ptr<expr::Expr> {
-      auto expr = comparison();
-
-      while (match({TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL})) {
-        auto op = previous();
-        auto right = comparison();
-        expr = make_unique_variant<expr::Expr, expr::Binary>(expr, op, right);
-      }
+    // Applies the calls, property accesses and indexes following `expr`.
+    // Nullptr when it opened a call with arguments or an index, whose first
+    // operand comes next.
+    auto postfix(ExprPtr expr, std::vector<Pending> &operators)
+        -> Result<ExprPtr> {
+      while (true) {
+        if (match(TokenType::LEFT_PAREN)) {
+          if (match(TokenType::RIGHT_PAREN)) {
+            expr = make_unique_variant<expr::Expr, expr::Call>(
+                expr, previous(), std::vector<ExprPtr>{});
+            continue;
+          }
+          operators.push_back(
+              {Pending::Kind::CALL, previous(), Precedence::NONE,
+               std::move(expr)});
+          return nullptr;
+        }
 
-      return expr;
-    }
+        if (match(TokenType::LEFT_BRACKET)) {
+          operators.push_back(
+              {Pending::Kind::INDEX, previous(), Precedence::NONE,
+               std::move(expr)});
+          return nullptr;
+        }
 
-    auto comparison() -> std::unique_ptr<expr::Expr> {
-      auto expr = term();
+        if (match(TokenType::DOT)) {
+          auto name = TRY(consume(TokenType::IDENTIFIER,
+                                  "Expect property name after '.'."));
+          expr = make_unique_variant<expr::Expr, expr::Get>(expr, name);
+          continue;
+        }
 
-      while (match({TokenType::GREATER, TokenType::GREATER_EQUAL,
-                    TokenType::LESS, TokenType::LESS_EQUAL})) {
-        auto op = previous();
-        auto right = term();
-        expr = make_unique_variant<expr::Expr, expr::Binary>(expr, op, right);
+        return expr;
       }
-
-      return expr;
     }
 
-    auto term() -> std::unique_ptr<expr::Expr> {
-      auto expr = factor();
-
-      while (match({TokenType::MINUS, TokenType::PLUS})) {
-        auto op = previous();
-        auto right = factor();
-        expr = make_unique_variant<expr::Expr, expr::Binary>(expr, op, right);
-      }
+    // The innermost open bracket has its last operand, in `operands`. Either
+    // takes it as an argument or element and returns nullptr for the next
+    // one, or closes the bracket and returns the node it makes.
+    auto close(std::vector<Pending> &operators, std::vector<ExprPtr> &operands)
+        -> Result<ExprPtr> {
+      auto &open = operators.back();
+      auto operand = pop(operands);
+
+      switch (open.kind) {
+        case Pending::Kind::GROUPING: {
+          TRY(consume(TokenType::RIGHT_PAREN, "Expect ')' after expression."));
+          operators.pop_back();
+          return make_unique_variant<expr::Expr, expr::Grouping>(operand);
+        }
 
-      return expr;
-    }
+        case Pending::Kind::CALL: {
+          open.items.push_back(std::move(operand));
+          if (match(TokenType::COMMA)) {
+            if (open.items.size() >= 255) {
+              report.addError(
+                  ReportError{peek(), "Can't have more than 255 arguments."});
+            }
+            return nullptr;
+          }
+
+          auto paren = TRY(
+              consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments."));
+          auto call = make_unique_variant<expr::Expr, expr::Call>(
+              open.target, paren, std::move(open.items));
+          operators.pop_back();
+          return call;
+        }
 
-    auto factor() -> std::unique_ptr<expr::Expr> {
-      auto expr = unary();
+        case Pending::Kind::INDEX: {
+          TRY(consume(TokenType::RIGHT_BRACKET, "Expect ']' after index."));
+          auto index = make_unique_variant<expr::Expr, expr::Index>(
+              open.target, open.token, operand);
+          operators.pop_back();
+          return index;
+        }
 
-      while (match({TokenType::SLASH, TokenType::STAR})) {
-        auto op = previous();
-        auto right = unary();
-        expr = make_unique_variant<expr::Expr, expr::Binary>(expr, op, right);
+        default: {
+          open.items.push_back(std::move(operand));
+          if (match(TokenType::COMMA)) {
+            return nullptr;
+          }
+
+          TRY(consume(TokenType::RIGHT_BRACKET,
+                      "Expect ']' after array elements."));
+          auto array = make_unique_variant<expr::Expr, expr::Array>(
+              open.token, std::move(open.items));
+          operators.pop_back();
+          return array;
+        }
       }
-
-      return expr;
     }
 
-    auto unary() -> std::unique_ptr<expr::Expr> {
-      if (match({TokenType::BANG, TokenType::MINUS})) {
-        auto op = previous();
-        auto right = unary();
-        return make_unique_variant<expr::Expr, expr::Unary>(op, right);
-      }
+    auto expression() -> Result<ExprPtr> {
+      auto operators = std::vector<Pending>{};
+      auto operands = std::vector<ExprPtr>{};
+
+      // Each pass takes one operand and whatever follows it: an infix
+      // operator, a closing bracket or the end of the expression
+      auto expr = TRY(operand(operators));
+      while (true) {
+        expr = TRY(postfix(std::move(expr), operators));
+        if (expr == nullptr) {
+          expr = TRY(operand(operators));
+          continue;
+        }
+        operands.push_back(std::move(expr));
+
+        if (auto const [kind, precedence] = infix(peek().type);
+            precedence != Precedence::NONE) {
+          // Assignment is right-associative, the rest left-associative
+          reduce(operators, operands,
+                 kind == Pending::Kind::ASSIGN ? Precedence::OR : precedence);
+          operators.push_back({kind, advance(), precedence});
+          expr = TRY(operand(operators));
+          continue;
+        }
+
+        reduce(operators, operands, Precedence::ASSIGNMENT);
+        if (operators.empty()) {
+          return pop(operands);
+        }
 
-      return primary();
+        expr = TRY(close(operators, operands));
+        if (expr == nullptr) {
+          expr = TRY(operand(operators));
+        }
+      }
     }
 
-    auto primary() -> std::unique_ptr<expr::Expr> {
+    auto primary() -> Result<ExprPtr> {
       if (match({TokenType::FALSE})) {
         return make_unique_variant<expr::Expr, expr::Literal>(false);
       }
@@ -225,33 +407,41 @@ namespace lox {
             previous().literal);
       }
 
-      if (match({TokenType::IDENTIFIER})) {
-        return make_unique_variant<expr::Expr, expr::Variable>(previous());
+      if (match(TokenType::SUPER)) {
+        auto keyword = previous();
+        TRY(consume(TokenType::DOT, "Expect '.' after 'super'."));
+        auto method = TRY(
+            consume(TokenType::IDENTIFIER, "Expect superclass method name."));
+        return make_unique_variant<expr::Expr, expr::Super>(keyword, method);
+      }
+
+      if (match(TokenType::THIS)) {
+        return make_unique_variant<expr::Expr, expr::This>(previous());
       }
 
-      if (match({TokenType::LEFT_PAREN})) {
-        auto expr = expression();
-        consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
-        return make_unique_variant<expr::Expr, expr::Grouping>(expr);
+      if (match({TokenType::IDENTIFIER})) {
+        return make_unique_variant<expr::Expr, expr::Variable>(previous());
       }
 
-      throw generateParserError(peek(), "Expect expression.");
+      return generateParserError(peek(), "Expect expression.");
     }
     /* #endregion */
 
     /* #region Stmt */
-    auto block() {
+    auto block() -> Result<std::vector<std::unique_ptr<stmt::Stmt>>> {
       std::vector<std::unique_ptr<stmt::Stmt>> statements;
 
+      blockDepth++;
       while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
-        statements.push_back(std::move(declaration()));
+        statements.push_back(declaration());
       }
+      blockDepth--;
 
-      consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+      TRY(consume(TokenType::RIGHT_BRACE, "Expect '}' after block."));
       return statements;
     }
 
-    auto statement() -> std::unique_ptr<stmt::Stmt> {
+    auto statement() -> Result<std::unique_ptr<stmt::Stmt>> {
       if (match(TokenType::IF)) {
         return ifStatement();
       }
@@ -260,76 +450,219 @@ namespace lox {
         return printStatement();
       }
 
+      if (match(TokenType::RETURN)) {
+        return returnStatement();
+      }
+
       if (match(TokenType::WHILE)) {
         return whileStatement();
       }
 
+      if (match(TokenType::YIELD)) {
+        return yieldStatement();
+      }
+
+      if (match(TokenType::IMPORT)) {
+        return importStatement(false);
+      }
+
       if (match(TokenType::LEFT_BRACE)) {
-        return make_unique_variant<stmt::Stmt, stmt::Block>(std::move(block()));
+        return make_unique_variant<stmt::Stmt, stmt::Block>(TRY(block()));
       }
 
       return expressionStatement();
     }
 
-    auto ifStatement() -> std::unique_ptr<stmt::Stmt> {
-      consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
-      auto condition = expression();
-      consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition.");
+    auto ifStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      TRY(consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'."));
+      auto condition = TRY(expression());
+      TRY(consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition."));
 
-      auto thenBranch = statement();
-      auto elseBranch =
-          match(TokenType::ELSE) ? statement() : std::unique_ptr<stmt::Stmt>();
+      auto thenBranch = TRY(statement());
+      auto elseBranch = match(TokenType::ELSE) ? TRY(statement())
+                                               : std::unique_ptr<stmt::Stmt>();
 
       return make_unique_variant<stmt::Stmt, stmt::If>(condition, thenBranch,
                                                        elseBranch);
     }
 
-    auto printStatement() -> std::unique_ptr<stmt::Stmt> {
-      auto value = expression();
-      consume(TokenType::SEMICOLON, "Expect ';' after value.");
+    auto printStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto value = TRY(expression());
+      TRY(consume(TokenType::SEMICOLON, "Expect ';' after value."));
 
       return make_unique_variant<stmt::Stmt, stmt::Print>(value);
     }
 
-    auto expressionStatement() -> std::unique_ptr<stmt::Stmt> {
-      auto expr = expression();
-      consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+    auto returnStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto keyword = previous();
+      if (functionDepth == 0) {
+        report.addError(
+            ReportError{keyword, "Can't return from top-level code."});
+      }
+
+      auto value = check(TokenType::SEMICOLON) ? std::unique_ptr<expr::Expr>()
+                                               : TRY(expression());
+      TRY(consume(TokenType::SEMICOLON, "Expect ';' after return value."));
+
+      return make_unique_variant<stmt::Stmt, stmt::Return>(keyword, value);
+    }
+
+    auto yieldStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto keyword = previous();
+      if (functionDepth == 0) {
+        report.addError(
+            ReportError{keyword, "Can't yield from top-level code."});
+      }
+      functionYields = true;
+
+      auto value = check(TokenType::SEMICOLON) ? std::unique_ptr<expr::Expr>()
+                                               : TRY(expression());
+      TRY(consume(TokenType::SEMICOLON, "Expect ';' after yield value."));
+
+      return make_unique_variant<stmt::Stmt, stmt::Yield>(keyword, value);
+    }
+
+    auto importStatement(bool topLevel)
+        -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto keyword = previous();
+      if (!topLevel) {
+        report.addError(
+            ReportError{keyword, "Can only import at the top level."});
+      }
+
+      auto path =
+          TRY(consume(TokenType::STRING, "Expect module path after 'import'."));
+      TRY(consume(TokenType::SEMICOLON, "Expect ';' after module path."));
+
+      return make_unique_variant<stmt::Stmt, stmt::Import>(keyword, path);
+    }
+
+    auto expressionStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto expr = TRY(expression());
+      TRY(consume(TokenType::SEMICOLON, "Expect ';' after expression."));
 
       return make_unique_variant<stmt::Stmt, stmt::Expression>(expr);
     }
     /* #endregion */
 
     /* #region Declaration */
-    auto varDeclaration() -> std::unique_ptr<stmt::Stmt> {
-      auto name = consume(TokenType::IDENTIFIER, "Expect variable name.");
+    auto classDeclaration() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto name = TRY(consume(TokenType::IDENTIFIER, "Expect class name."));
+
+      auto superclass = std::unique_ptr<expr::Expr>();
+      if (match(TokenType::LESS)) {
+        TRY(consume(TokenType::IDENTIFIER, "Expect superclass name."));
+        superclass = make_unique_variant<expr::Expr, expr::Variable>(previous());
+      }
+
+      TRY(consume(TokenType::LEFT_BRACE, "Expect '{' before class body."));
+
+      std::vector<std::unique_ptr<stmt::Stmt>> methods;
+      while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        methods.push_back(TRY(function("method")));
+      }
+
+      TRY(consume(TokenType::RIGHT_BRACE, "Expect '}' after class body."));
+      return make_unique_variant<stmt::Stmt, stmt::Class>(name, superclass,
+                                                          std::move(methods));
+    }
+
+    auto function(std::string const &kind)
+        -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto name =
+          TRY(consume(TokenType::IDENTIFIER, "Expect " + kind + " name."));
+      TRY(consume(TokenType::LEFT_PAREN,
+                  "Expect '(' after " + kind + " name."));
+
+      std::vector<Token> parameters;
+      if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+          if (parameters.size() >= 255) {
+            report.addError(
+                ReportError{peek(), "Can't have more than 255 parameters."});
+          }
+          parameters.push_back(
+              TRY(consume(TokenType::IDENTIFIER, "Expect parameter name.")));
+        } while (match(TokenType::COMMA));
+      }
+      TRY(consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters."));
+
+      TRY(consume(TokenType::LEFT_BRACE,
+                  "Expect '{' before " + kind + " body."));
+      functionDepth++;
+      auto const enclosingYields = std::exchange(functionYields, false);
+      auto body = TRY(block());
+      auto const isGenerator = std::exchange(functionYields, enclosingYields);
+      functionDepth--;
+
+      if (isGenerator && kind == "method" && name.lexeme == "init") {
+        report.addError(ReportError{name, "Can't yield from an initializer."});
+      }
+
+      return make_unique_variant<stmt::Stmt, stmt::Function>(
+          name, std::move(parameters), std::move(body), isGenerator);
+    }
+
+    auto varDeclaration() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto name = TRY(consume(TokenType::IDENTIFIER, "Expect variable name."));
 
       auto initializer = match({TokenType::EQUAL})
-                             ? expression()
+                             ? TRY(expression())
                              : std::unique_ptr<expr::Expr>();
-      consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+      TRY(consume(TokenType::SEMICOLON,
+                  "Expect ';' after variable declaration."));
       return make_unique_variant<stmt::Stmt, stmt::Var>(name, initializer);
     }
 
-    auto whileStatement() -> std::unique_ptr<stmt::Stmt> {
-      consume(TokenType::LEFT_PAREN, "Expect '() after 'while'.");
-      auto condition = expression();
-      consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
-      auto body = statement();
+    auto whileStatement() -> Result<std::unique_ptr<stmt::Stmt>> {
+      auto keyword = previous();
+      TRY(consume(TokenType::LEFT_PAREN, "Expect '() after 'while'."));
+      auto condition = TRY(expression());
+      TRY(consume(TokenType::RIGHT_PAREN, "Expect ')' after condition."));
+      auto body = TRY(statement());
 
-      return make_unique_variant<stmt::Stmt, stmt::While>(condition, body);
+      return make_unique_variant<stmt::Stmt, stmt::While>(keyword, condition,
+                                                          body);
     }
 
-    auto declaration() -> std::unique_ptr<stmt::Stmt> {
-      try {
-        if (match({TokenType::VAR})) {
-          return varDeclaration();
-        }
+    auto declarationOrError() -> Result<std::unique_ptr<stmt::Stmt>> {
+      if (match(TokenType::CLASS)) {
+        return classDeclaration();
+      }
+
+      if (match(TokenType::FUN)) {
+        return function("function");
+      }
 
-        return statement();
-      } catch (ReportError error) {
+      if (match({TokenType::VAR})) {
+        return varDeclaration();
+      }
+
+      if (match(TokenType::IMPORT)) {
+        return importStatement(blockDepth == 0);
+      }
+
+      return statement();
+    }
+
+    // Recovery point: a syntax error anywhere inside the declaration is
+    // recorded, then parsing resumes at the next statement boundary
+    auto declaration() -> std::unique_ptr<stmt::Stmt> {
+      auto depth = functionDepth;
+      auto blocks = blockDepth;
+      auto yields = functionYields;
+      auto result = declarationOrError();
+
+      if (!result) {
+        report.addError(result.error());
+        functionDepth = depth;
+        blockDepth = blocks;
+        functionYields = yields;
         synchronize();
         return {};
       }
+
+      return std::move(result).value();
     }
     /* #endregion */
 
@@ -342,23 +675,12 @@ namespace lox {
       auto statements = std::vector<std::unique_ptr<stmt::Stmt>>();
 
       while (!isAtEnd()) {
-        statements.push_back(std::move(declaration()));
+        statements.push_back(declaration());
       }
 
-      report.status = ParserStatus::SUCCESS;
+      report.status = report.errors.empty() ? ParserStatus::SUCCESS
+                                            : ParserStatus::HAS_ERRORS;
       return std::make_pair(std::move(statements), report);
-
-      // try {
-      //   auto expr = expression();
-      //   report.status = ParserStatus::SUCCESS;
-
-      //   return std::make_pair(std::make_optional(expr), report);
-      // } catch (ReportError &err) {
-      //   report.status = ParserStatus::HAS_ERRORS;
-      //   report.addError(err);
-
-      //   return std::make_pair(std::nullopt, report);
-      // }
     }
   };
 } // namespace lox
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+// The policy the interpreter is built with, see Tracing.hpp. Picked at
+// compile time, as every callable takes the interpreter by its concrete type.
+#ifndef LOX_INTERPRETER_POLICY
+#define LOX_INTERPRETER_POLICY NoTrace
+#endif
+
+namespace lox {
+  struct NoTrace;
+  struct Trace;
+  struct Checked;
+
+  template <typename Policy> class BasicInterpreter;
+
+  using Interpreter = BasicInterpreter<LOX_INTERPRETER_POLICY>;
+} // namespace lox
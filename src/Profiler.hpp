@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // Source line a statement is attributed to: the first token found walking
+  // it left to right. 0 when it has none (blocks, `print 1;`), in which case
+  // its time stays with the enclosing statement.
+  class LineFinder {
+  private:
+    // An expression's leftmost child, if it has one, and the line of its
+    // own first token, which counts only when nothing left of it has a line
+    struct Edge {
+      expr::Expr const *left;
+      int line;
+    };
+
+    // Walks down the left edge of the expression in a loop; expressions can
+    // nest deeper than recursion would allow
+    auto line(std::unique_ptr<expr::Expr> const &expr) -> int {
+      auto found = 0;
+      for (auto const *node = expr.get(); node != nullptr;) {
+        auto const edge = std::visit(*this, *node);
+        found = edge.line != 0 ? edge.line : found;
+        node = edge.left;
+      }
+      return found;
+    }
+
+  public:
+    /* #region Expr */
+    auto operator()(expr::Array const &expr) -> Edge {
+      return {nullptr, expr.bracket.line};
+    }
+    auto operator()(expr::Assign const &expr) -> Edge {
+      return {nullptr, expr.name.line};
+    }
+    auto operator()(expr::Binary const &expr) -> Edge {
+      return {expr.left.get(), expr.op.line};
+    }
+    auto operator()(expr::Call const &expr) -> Edge {
+      return {expr.callee.get(), expr.paren.line};
+    }
+    auto operator()(expr::Get const &expr) -> Edge {
+      return {expr.object.get(), expr.name.line};
+    }
+    auto operator()(expr::Grouping const &expr) -> Edge {
+      return {expr.expression.get(), 0};
+    }
+    auto operator()(expr::Index const &expr) -> Edge {
+      return {expr.object.get(), expr.bracket.line};
+    }
+    auto operator()(expr::Literal const & /*expr*/) -> Edge {
+      return {nullptr, 0};
+    }
+    auto operator()(expr::Logical const &expr) -> Edge {
+      return {expr.left.get(), expr.op.line};
+    }
+    auto operator()(expr::Set const &expr) -> Edge {
+      return {expr.object.get(), expr.name.line};
+    }
+    auto operator()(expr::SetIndex const &expr) -> Edge {
+      return {expr.object.get(), expr.bracket.line};
+    }
+    auto operator()(expr::Super const &expr) -> Edge {
+      return {nullptr, expr.keyword.line};
+    }
+    auto operator()(expr::This const &expr) -> Edge {
+      return {nullptr, expr.keyword.line};
+    }
+    auto operator()(expr::Unary const &expr) -> Edge {
+      return {nullptr, expr.op.line};
+    }
+    auto operator()(expr::Variable const &expr) -> Edge {
+      return {nullptr, expr.name.line};
+    }
+    /* #endregion */
+
+    /* #region Stmt */
+    auto operator()(stmt::Print const &stmt) -> int {
+      return line(stmt.expression);
+    }
+    auto operator()(stmt::Expression const &stmt) -> int {
+      return line(stmt.expression);
+    }
+    auto operator()(stmt::Var const &stmt) -> int { return stmt.name.line; }
+    auto operator()(stmt::Block const & /*stmt*/) -> int { return 0; }
+    auto operator()(stmt::If const &stmt) -> int {
+      return line(stmt.condition);
+    }
+    auto operator()(stmt::While const &stmt) -> int {
+      return stmt.keyword.line;
+    }
+    auto operator()(stmt::Function const &stmt) -> int {
+      return stmt.name.line;
+    }
+    auto operator()(stmt::Return const &stmt) -> int {
+      return stmt.keyword.line;
+    }
+    auto operator()(stmt::Class const &stmt) -> int { return stmt.name.line; }
+    auto operator()(stmt::Yield const &stmt) -> int {
+      return stmt.keyword.line;
+    }
+    auto operator()(stmt::Import const &stmt) -> int {
+      return stmt.keyword.line;
+    }
+    /* #endregion */
+  };
+
+  // Attributes interpreter time and AST node visits to (call stack, source
+  // line) pairs. Time is self time: the clock is read whenever the running
+  // statement or function changes and the elapsed slice is charged to the one
+  // that was running. Only active when handed to Interpreter::setProfiler.
+  class Profiler {
+  public:
+    struct LineStats {
+      std::uint64_t executions = 0;
+      std::uint64_t nodeVisits = 0;
+      std::uint64_t selfNs = 0;
+    };
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    // One node per distinct call path, so recursion through the same
+    // functions shares nodes instead of growing a list per call
+    struct Frame {
+      int parent;
+      std::string name;
+      std::unordered_map<std::string, int> children;
+    };
+
+    std::vector<Frame> frames{Frame{-1, "<script>", {}}};
+    std::unordered_map<std::uint64_t, LineStats> samples;
+    std::unordered_map<stmt::Stmt const *, int> lines;
+    std::string source;
+
+    int frame = 0;
+    int line = 0;
+    LineStats *current = &samples[key(0, 0)];
+    Clock::time_point lastSwitch = Clock::now();
+
+    static auto key(int frame, int line) -> std::uint64_t {
+      return (static_cast<std::uint64_t>(frame) << 32) |
+             static_cast<std::uint32_t>(line);
+    }
+
+    auto charge() -> void {
+      auto const now = Clock::now();
+      current->selfNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             now - lastSwitch)
+                             .count();
+      lastSwitch = now;
+    }
+
+    auto lineOf(stmt::Stmt const &stmt) -> int {
+      auto [cached, inserted] = lines.try_emplace(&stmt, 0);
+      if (inserted) {
+        cached->second = std::visit(LineFinder{}, stmt);
+      }
+      return cached->second;
+    }
+
+    [[nodiscard]] auto stackOf(int frame) const -> std::string {
+      auto stack = frames.at(frame).name;
+      for (auto parent = frames.at(frame).parent; parent != -1;
+           parent = frames.at(parent).parent) {
+        stack = frames.at(parent).name + ";" + stack;
+      }
+      return stack;
+    }
+
+    [[nodiscard]] auto sourceLine(int number) const -> std::string_view {
+      if (number == 0) {
+        return "<outside any statement>";
+      }
+
+      auto text = std::string_view{source};
+      for (int i = 1; i < number; i++) {
+        auto const newline = text.find('\n');
+        if (newline == std::string_view::npos) {
+          return {};
+        }
+        text.remove_prefix(newline + 1);
+      }
+
+      text = text.substr(0, text.find('\n'));
+      text.remove_prefix(std::min(text.find_first_not_of(" \t"), text.size()));
+      return text;
+    }
+
+  public:
+    // Scope of one statement execution; the interpreter opens one per
+    // executed statement
+    class StatementScope {
+    private:
+      Profiler *profiler = nullptr;
+      int previousLine = 0;
+      LineStats *previous = nullptr;
+
+    public:
+      StatementScope(Profiler &profiler, stmt::Stmt const &stmt) {
+        auto const line = profiler.lineOf(stmt);
+        if (line == 0) {
+          return;
+        }
+
+        this->profiler = &profiler;
+        profiler.charge();
+        previousLine = std::exchange(profiler.line, line);
+        previous = std::exchange(profiler.current,
+                                 &profiler.samples[key(profiler.frame, line)]);
+        profiler.current->executions++;
+      }
+
+      StatementScope(StatementScope const &) = delete;
+      auto operator=(StatementScope const &) -> StatementScope & = delete;
+
+      ~StatementScope() {
+        if (profiler != nullptr) {
+          profiler->charge();
+          profiler->line = previousLine;
+          profiler->current = previous;
+        }
+      }
+    };
+
+    // Scope of one Lox function call, pushed as a frame of the stack
+    class CallScope {
+    private:
+      Profiler *profiler;
+      int previousFrame = 0;
+
+    public:
+      CallScope(Profiler *profiler, std::string const &name)
+          : profiler{profiler} {
+        if (profiler == nullptr) {
+          return;
+        }
+
+        profiler->charge();
+        auto &children = profiler->frames.at(profiler->frame).children;
+        auto [child, inserted] = children.try_emplace(
+            name, static_cast<int>(profiler->frames.size()));
+        auto const childFrame = child->second; // push_back may move `children`
+        if (inserted) {
+          profiler->frames.push_back(Frame{profiler->frame, name, {}});
+        }
+        previousFrame = std::exchange(profiler->frame, childFrame);
+      }
+
+      CallScope(CallScope const &) = delete;
+      auto operator=(CallScope const &) -> CallScope & = delete;
+
+      ~CallScope() {
+        if (profiler != nullptr) {
+          profiler->charge();
+          profiler->frame = previousFrame;
+        }
+      }
+    };
+
+    // Kept for the source text column of the hot-spot table
+    auto setSource(std::string text) -> void { source = std::move(text); }
+
+    auto countVisit() -> void { current->nodeVisits++; }
+
+    // Per-line totals across every stack the line ran under, hottest first
+    [[nodiscard]] auto hotSpots() const
+        -> std::vector<std::pair<int, LineStats>> {
+      auto byLine = std::unordered_map<int, LineStats>{};
+      for (auto const &[sampleKey, stats] : samples) {
+        auto &total = byLine[static_cast<int>(sampleKey & 0xffffffff)];
+        total.executions += stats.executions;
+        total.nodeVisits += stats.nodeVisits;
+        total.selfNs += stats.selfNs;
+      }
+
+      auto sorted = std::vector<std::pair<int, LineStats>>(byLine.begin(),
+                                                           byLine.end());
+      std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+        return a.second.selfNs > b.second.selfNs;
+      });
+      return sorted;
+    }
+
+    // Table of the `limit` hottest lines. Line 0 is time spent outside any
+    // statement (setup, teardown, the gaps between top-level statements).
+    auto printHotSpots(std::ostream &out, std::size_t limit = 20) const
+        -> void {
+      auto const spots = hotSpots();
+      auto totalNs = std::uint64_t{0};
+      for (auto const &[line, stats] : spots) {
+        totalNs += stats.selfNs;
+      }
+
+      out << " line    self ms      %      execs     visits  source\n";
+      for (auto const &[line, stats] : spots) {
+        if (limit-- == 0) {
+          break;
+        }
+
+        auto row = std::array<char, 80>{};
+        std::snprintf(
+            row.data(), row.size(), "%5d %10.3f %6.2f %10llu %10llu  ", line,
+            static_cast<double>(stats.selfNs) / 1e6,
+            totalNs ? 100.0 * static_cast<double>(stats.selfNs) / totalNs : 0,
+            static_cast<unsigned long long>(stats.executions),
+            static_cast<unsigned long long>(stats.nodeVisits));
+        out << row.data() << sourceLine(line) << '\n';
+      }
+    }
+
+    // One `frame;frame;frame:line nanoseconds` line per sample, the format
+    // flamegraph.pl and speedscope read
+    auto writeCollapsed(std::ostream &out) const -> void {
+      auto stacks = std::unordered_map<int, std::string>{};
+      for (auto const &[sampleKey, stats] : samples) {
+        if (stats.selfNs == 0) {
+          continue;
+        }
+
+        auto const frame = static_cast<int>(sampleKey >> 32);
+        auto [stack, inserted] = stacks.try_emplace(frame);
+        if (inserted) {
+          stack->second = stackOf(frame);
+        }
+
+        out << stack->second << ':' << (sampleKey & 0xffffffff) << ' '
+            << stats.selfNs << '\n';
+      }
+    }
+  };
+} // namespace lox
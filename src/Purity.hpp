@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // Finds the functions whose result depends on nothing but their
+  // arguments, so their calls can be memoized (see MemoCache). A pure
+  // function reads and assigns only its parameters and its own locals;
+  // doesn't print, yield, declare functions or classes, or touch arrays,
+  // maps or instances; and calls only pure functions, directly by name.
+  //
+  // Only functions declared once, at the top level of a program, qualify:
+  // their names are globals, which is where a call from a pure function
+  // looks them up. The analysis assumes each of those names keeps
+  // referring to the function declared under it, which a later assignment
+  // or Session submission could change; LoxFunction checks that before
+  // using a memoized result.
+  class Purity {
+  private:
+    std::unordered_map<std::string_view, stmt::Function const *> functions;
+    // The functions each body calls, for the bodies that are otherwise pure
+    std::unordered_map<stmt::Function const *,
+                       std::vector<stmt::Function const *>>
+        calls;
+
+    // Checks one function body. `scopes` holds the names it has declared
+    // so far, innermost last.
+    class Body {
+    private:
+      Purity const &purity;
+      std::vector<std::unordered_set<std::string_view>> scopes;
+      std::vector<stmt::Function const *> &callees;
+
+      [[nodiscard]] auto isLocal(Token const &name) const -> bool {
+        for (auto const &scope : scopes) {
+          if (scope.contains(name.lexeme)) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      // From a work list: expressions can nest deeper than recursion
+      // allows
+      auto expression(expr::Expr const &root) -> bool {
+        auto pending = std::vector<expr::Expr const *>{&root};
+        while (!pending.empty()) {
+          auto const &node = *pending.back();
+          pending.pop_back();
+
+          auto const push = [&](std::unique_ptr<expr::Expr> const &child) {
+            pending.push_back(child.get());
+          };
+          switch (node.index()) {
+            case variant_index_v<expr::Expr, expr::Literal>:
+            case variant_index_v<expr::Expr, expr::Grouping>:
+            case variant_index_v<expr::Expr, expr::Unary>:
+            case variant_index_v<expr::Expr, expr::Binary>:
+            case variant_index_v<expr::Expr, expr::Logical>:
+              expr::forEachChild(node, push);
+              break;
+
+            case variant_index_v<expr::Expr, expr::Variable>:
+              if (!isLocal(std::get_if<expr::Variable>(&node)->name)) {
+                return false;
+              }
+              break;
+
+            case variant_index_v<expr::Expr, expr::Assign>: {
+              auto const &assign = *std::get_if<expr::Assign>(&node);
+              if (!isLocal(assign.name)) {
+                return false;
+              }
+              push(assign.value);
+              break;
+            }
+
+            case variant_index_v<expr::Expr, expr::Call>: {
+              auto const &call = *std::get_if<expr::Call>(&node);
+              auto const *callee = std::get_if<expr::Variable>(&*call.callee);
+              if (callee == nullptr || isLocal(callee->name)) {
+                return false;
+              }
+              auto function = purity.functions.find(callee->name.lexeme);
+              if (function == purity.functions.end()) {
+                return false;
+              }
+              callees.push_back(function->second);
+              for (auto const &argument : call.arguments) {
+                push(argument);
+              }
+              break;
+            }
+
+            default:
+              return false;
+          }
+        }
+        return true;
+      }
+
+      auto statements(std::span<std::unique_ptr<stmt::Stmt> const> body)
+          -> bool {
+        for (auto const &stmt : body) {
+          if (!statement(*stmt)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      auto statement(stmt::Stmt const &stmt) -> bool {
+        switch (stmt.index()) {
+          case variant_index_v<stmt::Stmt, stmt::Expression>:
+            return expression(
+                *std::get_if<stmt::Expression>(&stmt)->expression);
+
+          case variant_index_v<stmt::Stmt, stmt::Var>: {
+            auto const &var = *std::get_if<stmt::Var>(&stmt);
+            if (var.initializer && !expression(*var.initializer)) {
+              return false;
+            }
+            scopes.back().insert(var.name.lexeme);
+            return true;
+          }
+
+          case variant_index_v<stmt::Stmt, stmt::Block>: {
+            scopes.emplace_back();
+            auto const pure =
+                statements(std::get_if<stmt::Block>(&stmt)->statements);
+            scopes.pop_back();
+            return pure;
+          }
+
+          case variant_index_v<stmt::Stmt, stmt::If>: {
+            auto const &branch = *std::get_if<stmt::If>(&stmt);
+            return expression(*branch.condition) &&
+                   statement(*branch.thenBranch) &&
+                   (!branch.elseBranch || statement(*branch.elseBranch));
+          }
+
+          case variant_index_v<stmt::Stmt, stmt::While>: {
+            auto const &loop = *std::get_if<stmt::While>(&stmt);
+            return expression(*loop.condition) && statement(*loop.body);
+          }
+
+          case variant_index_v<stmt::Stmt, stmt::Return>: {
+            auto const &ret = *std::get_if<stmt::Return>(&stmt);
+            return !ret.value || expression(*ret.value);
+          }
+
+          default:
+            return false;
+        }
+      }
+
+    public:
+      Body(Purity const &purity, std::vector<stmt::Function const *> &callees)
+          : purity{purity}, callees{callees} {}
+
+      // Whether the function is pure if everything it calls is
+      auto check(stmt::Function const &function) -> bool {
+        if (function.isGenerator) {
+          return false;
+        }
+        scopes = {{}};
+        for (auto const &param : function.params) {
+          scopes.back().insert(param.lexeme);
+        }
+        return statements(function.body);
+      }
+    };
+
+    // Adds every function `function` may end up calling to `reached`
+    auto reach(stmt::Function const *function,
+               std::unordered_set<stmt::Function const *> &reached) const
+        -> void {
+      auto pending = std::vector{function};
+      while (!pending.empty()) {
+        auto const *next = pending.back();
+        pending.pop_back();
+        for (auto const *callee : calls.at(next)) {
+          if (reached.insert(callee).second) {
+            pending.push_back(callee);
+          }
+        }
+      }
+    }
+
+  public:
+    // Sets pure and callees on each top-level function of `program`
+    static auto annotate(std::ranges::forward_range auto &&program) -> void {
+      auto purity = Purity{};
+      auto declarations = std::unordered_map<std::string_view, std::size_t>{};
+      for (std::unique_ptr<stmt::Stmt> const &stmt : program) {
+        std::visit(
+            [&](auto const &node) {
+              if constexpr (requires { node.name.lexeme; }) {
+                declarations[node.name.lexeme]++;
+              }
+            },
+            *stmt);
+      }
+      for (std::unique_ptr<stmt::Stmt> const &stmt : program) {
+        if (auto const *function = std::get_if<stmt::Function>(&*stmt)) {
+          function->pure = false;
+          function->callees.clear();
+          if (declarations[function->name.lexeme] == 1) {
+            purity.functions.emplace(function->name.lexeme, function);
+          }
+        }
+      }
+
+      for (auto const &[name, function] : purity.functions) {
+        auto callees = std::vector<stmt::Function const *>{};
+        if (Body{purity, callees}.check(*function)) {
+          purity.calls.emplace(function, std::move(callees));
+        }
+      }
+
+      // Drop the functions that call one that isn't pure until none do
+      auto changed = true;
+      while (changed) {
+        changed = false;
+        for (auto it = purity.calls.begin(); it != purity.calls.end();) {
+          if (std::ranges::any_of(it->second, [&](auto const *callee) {
+                return !purity.calls.contains(callee);
+              })) {
+            it = purity.calls.erase(it);
+            changed = true;
+          } else {
+            ++it;
+          }
+        }
+      }
+
+      for (auto const &[function, callees] : purity.calls) {
+        auto reached = std::unordered_set<stmt::Function const *>{};
+        purity.reach(function, reached);
+        function->pure = true;
+        function->callees.assign(reached.begin(), reached.end());
+      }
+    }
+  };
+} // namespace lox
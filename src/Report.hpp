@@ -1,6 +1,6 @@
 #pragma once
 
-#include <exception>
+#include <expected>
 #include <iostream>
 #include <optional>
 #include <string>
@@ -9,7 +9,7 @@
 #include "Token.hpp"
 
 namespace lox {
-  class ReportError : public std::exception {
+  class ReportError {
   private:
     static auto inline formatError(int line, const std::string &where,
                                    const std::string &message) {
@@ -21,6 +21,9 @@ namespace lox {
     std::optional<Token> const token;
     std::optional<int> const line;
     std::string message;
+    // The module the error happened in; empty for the main program, and
+    // unset while that isn't known yet
+    std::optional<std::string> file;
 
     ReportError(std::string message)
         : token{std::nullopt}, line{std::nullopt}, message{std::move(message)} {
@@ -33,29 +36,32 @@ namespace lox {
         : token{std::make_optional(token)}, line{token.line},
           message{std::move(message)} {};
 
-    [[nodiscard]] auto what() const noexcept -> const char * override {
-      return message.c_str();
-    }
+    auto toString() -> std::string {
+      auto const where = file && !file->empty() ? *file + ": " : std::string{};
 
-    auto toString() {
       if (token.has_value()) {
         auto val = token.value();
 
-        return formatError(val.line,
-                           val.type == TokenType::END_OF_FILE
-                               ? " at end"
-                               : " at '" + val.lexeme + "'",
-                           message);
+        return where + formatError(val.line,
+                                   val.type == TokenType::END_OF_FILE
+                                       ? " at end"
+                                       : " at '" + val.lexeme + "'",
+                                   message);
       }
 
       if (line.has_value()) {
-        return "[line " + std::to_string(line.value()) + "] Error:" + message;
+        return where + formatError(line.value(), "", message);
       }
 
-      return message;
+      return where + message;
     }
   };
 
+  // Every fallible step of the pipeline returns its value or the error that
+  // stopped it. Errors travel back up as ordinary return values; nothing in
+  // the scanner, parser or interpreter throws.
+  template <typename T> using Result = std::expected<T, ReportError>;
+
   template <typename T> class Report {
   public:
     T status;
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <memory>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // Marks the variables and assignments that can only refer to a global,
+  // so the interpreter goes straight to the global scope and the slot cached
+  // on the node instead of looking the name up scope by scope.
+  //
+  // Scopes are still looked up by name at run time, and a name declared
+  // later in a scope is visible there from then on, even to a closure
+  // created earlier. So a use only counts as global if no enclosing block
+  // or function declares the name anywhere, before or after the use.
+  class Resolver {
+  private:
+    // Names declared in each enclosing block or function, innermost last
+    std::vector<std::unordered_set<std::string_view>> scopes;
+
+    [[nodiscard]] auto isGlobal(Token const &name) const -> bool {
+      for (auto const &scope : scopes) {
+        if (scope.contains(name.lexeme)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Opens a scope holding everything declared directly in `statements`
+    auto enter(std::span<std::unique_ptr<stmt::Stmt> const> statements)
+        -> void {
+      auto &scope = scopes.emplace_back();
+      for (auto const &stmt : statements) {
+        std::visit(
+            [&](auto const &node) {
+              if constexpr (requires { node.name.lexeme; }) {
+                scope.insert(node.name.lexeme);
+              }
+            },
+            *stmt);
+      }
+    }
+
+    // From a work list: expressions can nest deeper than recursion allows
+    auto expression(expr::Expr const &root) -> void {
+      auto pending = std::vector<expr::Expr const *>{&root};
+      while (!pending.empty()) {
+        auto const &node = *pending.back();
+        pending.pop_back();
+
+        if (auto const *variable = std::get_if<expr::Variable>(&node)) {
+          variable->global = isGlobal(variable->name);
+        } else if (auto const *assign = std::get_if<expr::Assign>(&node)) {
+          assign->global = isGlobal(assign->name);
+        }
+        expr::forEachChild(node,
+                           [&](std::unique_ptr<expr::Expr> const &child) {
+                             pending.push_back(child.get());
+                           });
+      }
+    }
+
+    auto function(stmt::Function const &function) -> void {
+      enter(function.body);
+      for (auto const &param : function.params) {
+        scopes.back().insert(param.lexeme);
+      }
+      for (auto const &stmt : function.body) {
+        statement(*stmt);
+      }
+      scopes.pop_back();
+    }
+
+    auto statement(stmt::Stmt const &stmt) -> void {
+      switch (stmt.index()) {
+        case variant_index_v<stmt::Stmt, stmt::Print>:
+          expression(*std::get_if<stmt::Print>(&stmt)->expression);
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Expression>:
+          expression(*std::get_if<stmt::Expression>(&stmt)->expression);
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Var>:
+          if (auto const &init = std::get_if<stmt::Var>(&stmt)->initializer) {
+            expression(*init);
+          }
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Block>: {
+          auto const &block = *std::get_if<stmt::Block>(&stmt);
+          enter(block.statements);
+          for (auto const &inner : block.statements) {
+            statement(*inner);
+          }
+          scopes.pop_back();
+          break;
+        }
+
+        case variant_index_v<stmt::Stmt, stmt::If>: {
+          auto const &branch = *std::get_if<stmt::If>(&stmt);
+          expression(*branch.condition);
+          statement(*branch.thenBranch);
+          if (branch.elseBranch) {
+            statement(*branch.elseBranch);
+          }
+          break;
+        }
+
+        case variant_index_v<stmt::Stmt, stmt::While>: {
+          auto const &loop = *std::get_if<stmt::While>(&stmt);
+          expression(*loop.condition);
+          statement(*loop.body);
+          break;
+        }
+
+        case variant_index_v<stmt::Stmt, stmt::Function>:
+          function(*std::get_if<stmt::Function>(&stmt));
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Return>:
+          if (auto const &value = std::get_if<stmt::Return>(&stmt)->value) {
+            expression(*value);
+          }
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Class>: {
+          auto const &klass = *std::get_if<stmt::Class>(&stmt);
+          if (klass.superclass) {
+            expression(*klass.superclass);
+          }
+          for (auto const &method : klass.methods) {
+            function(*std::get_if<stmt::Function>(&*method));
+          }
+          break;
+        }
+
+        case variant_index_v<stmt::Stmt, stmt::Yield>:
+          if (auto const &value = std::get_if<stmt::Yield>(&stmt)->value) {
+            expression(*value);
+          }
+          break;
+
+        case variant_index_v<stmt::Stmt, stmt::Import>:
+          break;
+      }
+    }
+
+  public:
+    // Sets global on every Variable and Assign in `program`, which runs in
+    // the global scope
+    static auto annotate(std::ranges::forward_range auto &&program) -> void {
+      auto resolver = Resolver{};
+      for (std::unique_ptr<stmt::Stmt> const &stmt : program) {
+        resolver.statement(*stmt);
+      }
+    }
+  };
+} // namespace lox
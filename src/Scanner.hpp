@@ -1,12 +1,16 @@
 #pragma once
 
-#include "Lox.hpp"
-#include "Parser.hpp"
 #include "Report.hpp"
 #include "Token.hpp"
-#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace lox {
   enum class ScannerStatus { UNPROCESSED, SUCCESS, HAS_ERRORS };
@@ -18,11 +22,16 @@ namespace lox {
 
     Report<ScannerStatus> report{ScannerStatus::UNPROCESSED};
 
-    int start = 0;
-    int current = 0;
+    std::size_t start = 0;
+    std::size_t current = 0;
     int line = 1;
 
-    std::unordered_map<std::string, TokenType> RESERVED_KEYWORDS = {
+    struct Keyword {
+      std::string_view text;
+      TokenType type;
+    };
+
+    static constexpr auto RESERVED_KEYWORDS = std::to_array<Keyword>({
         {"and", lox::TokenType::AND},       {"class", lox::TokenType::CLASS},
         {"else", lox::TokenType::ELSE},     {"false", lox::TokenType::FALSE},
         {"for", lox::TokenType::FOR},       {"fun", lox::TokenType::FUN},
@@ -31,11 +40,64 @@ namespace lox {
         {"return", lox::TokenType::RETURN}, {"super", lox::TokenType::SUPER},
         {"this", lox::TokenType::THIS},     {"true", lox::TokenType::TRUE},
         {"var", lox::TokenType::VAR},       {"while", lox::TokenType::WHILE},
-    };
+        {"yield", lox::TokenType::YIELD},   {"import", lox::TokenType::IMPORT},
+    });
+
+  public:
+    // The keyword `text` spells, or IDENTIFIER. Keywords are told apart by
+    // their first letter and length, then confirmed with one comparison,
+    // rather than hashing every identifier.
+    static constexpr auto keywordType(std::string_view text) -> TokenType {
+      auto const spelled = [&](std::string_view keyword, TokenType type) {
+        return text == keyword ? type : lox::TokenType::IDENTIFIER;
+      };
+      switch (text.empty() ? '\0' : text[0]) {
+        case 'a':
+          return spelled("and", lox::TokenType::AND);
+        case 'c':
+          return spelled("class", lox::TokenType::CLASS);
+        case 'e':
+          return spelled("else", lox::TokenType::ELSE);
+        case 'f':
+          switch (text.size()) {
+            case 3:
+              return text[1] == 'o' ? spelled("for", lox::TokenType::FOR)
+                                    : spelled("fun", lox::TokenType::FUN);
+            default:
+              return spelled("false", lox::TokenType::FALSE);
+          }
+        case 'i':
+          return text.size() == 2 ? spelled("if", lox::TokenType::IF)
+                                  : spelled("import", lox::TokenType::IMPORT);
+        case 'n':
+          return spelled("nil", lox::TokenType::NIL);
+        case 'o':
+          return spelled("or", lox::TokenType::OR);
+        case 'p':
+          return spelled("print", lox::TokenType::PRINT);
+        case 'r':
+          return spelled("return", lox::TokenType::RETURN);
+        case 's':
+          return spelled("super", lox::TokenType::SUPER);
+        case 't':
+          return text.size() > 1 && text[1] == 'h'
+                     ? spelled("this", lox::TokenType::THIS)
+                     : spelled("true", lox::TokenType::TRUE);
+        case 'v':
+          return spelled("var", lox::TokenType::VAR);
+        case 'w':
+          return spelled("while", lox::TokenType::WHILE);
+        case 'y':
+          return spelled("yield", lox::TokenType::YIELD);
+        default:
+          return lox::TokenType::IDENTIFIER;
+      }
+    }
 
+  private:
     inline auto isAtEnd() -> bool { return current >= source.size(); }
 
-    inline auto advance() -> char { return source.at(current++); }
+    inline auto advance() -> char { return source[current++]; }
 
     inline auto addToken(lox::TokenType type) -> void {
       tokens.emplace_back(type, source.substr(start, current - start),
@@ -52,7 +114,7 @@ namespace lox {
       if (isAtEnd()) {
         return false;
       }
-      if (source.at(current) != expected) {
+      if (source[current] != expected) {
         return false;
       }
 
@@ -64,14 +126,14 @@ namespace lox {
       if (isAtEnd()) {
         return '\0';
       }
-      return source.at(current);
+      return source[current];
     }
 
     inline auto peekNext() -> char {
       if (current + 1 >= source.size()) {
         return '\0';
       }
-      return source.at(current + 1);
+      return source[current + 1];
     }
 
     auto string() -> void {
@@ -110,8 +172,10 @@ namespace lox {
         }
       }
 
-      addToken(lox::TokenType::NUMBER,
-               std::stod(source.substr(start, current - start)));
+      // from_chars rather than stod: it reports failure instead of throwing
+      auto value = 0.0;
+      std::from_chars(source.data() + start, source.data() + current, value);
+      addToken(lox::TokenType::NUMBER, value);
     }
 
     auto identifier() -> void {
@@ -119,13 +183,8 @@ namespace lox {
         advance();
       }
 
-      std::string text = source.substr(start, current - start);
-      auto type = RESERVED_KEYWORDS.find(text);
-      if (type == RESERVED_KEYWORDS.end()) {
-        addToken(lox::TokenType::IDENTIFIER);
-      } else {
-        addToken(type->second);
-      }
+      auto const text = std::string_view{source}.substr(start, current - start);
+      addToken(keywordType(text));
     }
 
     auto scanToken() -> void {
@@ -143,6 +202,12 @@ namespace lox {
         case '}':
           addToken(lox::TokenType::RIGHT_BRACE);
           break;
+        case '[':
+          addToken(lox::TokenType::LEFT_BRACKET);
+          break;
+        case ']':
+          addToken(lox::TokenType::RIGHT_BRACKET);
+          break;
         case ',':
           addToken(lox::TokenType::COMMA);
           break;
@@ -228,5 +293,18 @@ namespace lox {
                                             : ScannerStatus::HAS_ERRORS;
       return std::make_pair(tokens, report);
     }
+
+    // Every keyword is found, and nothing that merely looks like one is;
+    // checked as the scanner compiles
+    static consteval auto keywordsResolve() -> bool {
+      return std::ranges::all_of(RESERVED_KEYWORDS, [](Keyword keyword) {
+        return keywordType(keyword.text) == keyword.type &&
+               keywordType(keyword.text.substr(1)) != keyword.type &&
+               keywordType(std::string{keyword.text} + "s") ==
+                   lox::TokenType::IDENTIFIER;
+      });
+    }
   };
+
+  static_assert(Scanner::keywordsResolve());
 } // namespace lox
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AstCache.hpp"
+#include "Budget.hpp"
+#include "Engine.hpp"
+#include "Environment.hpp"
+#include "Interpreter.hpp"
+#include "Native.hpp"
+#include "OutputSink.hpp"
+#include "Snapshot.hpp"
+
+namespace lox {
+  // One long-lived interpreter fed a sequence of snippets, as a REPL or an
+  // embedding host does. Globals, the environments closures hold on to and
+  // the shapes and inline caches of classes all persist from one submit() to
+  // the next; each submission only pays for scanning and parsing itself.
+  class Session {
+  private:
+    Engine compiler;
+    std::shared_ptr<Environment> const globals;
+    Interpreter interpreter;
+
+    // Programs that declared functions or classes. Function values point at
+    // their declarations, so these live as long as the session; programs
+    // without any are freed once they've run.
+    std::vector<Engine::Program> retained;
+
+    RunLimits limits; // Applied to each submission on its own
+
+  public:
+    explicit Session(std::shared_ptr<OutputSink> output,
+                     AstCache const *cache = nullptr)
+        : compiler{output, {.cache = cache}},
+          globals{makeGlobals()},
+          interpreter{std::move(output), globals} {}
+
+    // Continues from a prelude's (or a restored snapshot's) globals
+    Session(std::shared_ptr<OutputSink> output, Prelude prelude,
+            AstCache const *cache = nullptr)
+        : compiler{output, {.cache = cache}},
+          globals{std::move(prelude.globals)},
+          interpreter{std::move(output), globals} {
+      retained.push_back(std::move(prelude.program));
+    }
+
+    auto submit(std::string const &source) -> RunResult {
+      auto program = compiler.compile(source);
+      if (!program) {
+        return {RunStatus::COMPILE_ERROR, std::move(program.error())};
+      }
+
+      interpreter.setLimits(limits);
+      auto report = interpreter.interpret(
+          *program | std::ranges::views::filter(
+                         [](auto &stmt) { return stmt != nullptr; }));
+
+      if (FunctionIndex{*program}.size() > 0) {
+        retained.push_back(std::move(*program));
+      }
+
+      if (report.status == InterpreterStatus::HAS_ERRORS) {
+        return {RunStatus::RUNTIME_ERROR, std::move(report.errors)};
+      }
+      if (report.status == InterpreterStatus::LIMIT_EXCEEDED) {
+        return {RunStatus::LIMIT_EXCEEDED, std::move(report.errors)};
+      }
+      return {};
+    }
+
+    auto setLimits(RunLimits const &limits) -> void { this->limits = limits; }
+
+    // Makes a host function callable from later submissions, e.g.
+    //   session.registerNative<double(double, double)>("hypot", ...);
+    template <typename Signature, typename Function>
+    auto registerNative(std::string const &name, Function function) -> void {
+      lox::registerNative<Signature>(*globals, name, std::move(function));
+    }
+
+    [[nodiscard]] auto globalEnvironment() const
+        -> std::shared_ptr<Environment> const & {
+      return globals;
+    }
+  };
+} // namespace lox
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lox {
+  // A hidden class. Maps field names to indices into LoxInstance::fields.
+  // Instances of the same class that gained the same fields in the same order
+  // end up sharing one Shape, so a shape id alone identifies a field layout.
+  class Shape : public std::enable_shared_from_this<Shape> {
+  private:
+    static auto inline nextId() -> std::uint32_t {
+      static std::atomic<std::uint32_t> counter{0};
+      return ++counter; // 0 is reserved for empty cache entries
+    }
+
+    std::unordered_map<std::string, int> slots;
+    std::unordered_map<std::string, std::shared_ptr<Shape>> transitions;
+
+  public:
+    std::uint32_t const id = nextId();
+
+    Shape() = default;
+    Shape(std::unordered_map<std::string, int> slots)
+        : slots{std::move(slots)} {}
+
+    [[nodiscard]] auto fieldCount() const -> int {
+      return static_cast<int>(slots.size());
+    }
+
+    [[nodiscard]] auto lookup(std::string const &name) const -> int {
+      auto slot = slots.find(name);
+      return slot == slots.end() ? -1 : slot->second;
+    }
+
+    // Field names indexed by slot
+    [[nodiscard]] auto fieldNames() const -> std::vector<std::string> {
+      auto names = std::vector<std::string>(slots.size());
+      for (auto const &[name, slot] : slots) {
+        names[slot] = name;
+      }
+      return names;
+    }
+
+    // Shape reached by appending `name` as a new field. Transitions are kept
+    // alive by their parent so every instance taking the same path lands on
+    // the same child.
+    auto withField(std::string const &name) -> std::shared_ptr<Shape> {
+      if (auto transition = transitions.find(name);
+          transition != transitions.end()) {
+        return transition->second;
+      }
+
+      auto childSlots = slots;
+      childSlots.emplace(name, fieldCount());
+      auto child = std::make_shared<Shape>(std::move(childSlots));
+      transitions.emplace(name, child);
+      return child;
+    }
+  };
+
+  // Polymorphic inline cache stored on a Get/Set node. Each entry remembers a
+  // shape id and the slot the property lives at for that shape. Set entries
+  // may also carry the shape an instance moves to when the field is added;
+  // that shape's parent keeps it alive, so a plain pointer is enough.
+  //
+  // Tasks running the same program share its nodes, so entries sit behind a
+  // sequence lock: readers retry if a write overlapped them, and a writer
+  // that finds another one mid-update skips caching rather than wait.
+  class InlineCache {
+  public:
+    static constexpr int SIZE = 4;
+
+    struct Entry {
+      std::uint32_t shapeId = 0;
+      int slot = -1;
+      Shape *transition = nullptr;
+    };
+
+  private:
+    struct Slot {
+      std::atomic<std::uint64_t> key{0}; // Shape id, then slot
+      std::atomic<Shape *> transition{nullptr};
+    };
+
+    std::array<Slot, SIZE> slots{};
+    std::atomic<std::uint32_t> version{0}; // Odd while a write is under way
+    int next = 0;                          // Only touched by the writer
+
+  public:
+    InlineCache() = default;
+    // A copy starts out empty; the cache is only ever a hint
+    InlineCache(InlineCache const & /*other*/) {}
+    auto operator=(InlineCache const & /*other*/) -> InlineCache & {
+      return *this;
+    }
+    ~InlineCache() = default;
+
+    [[nodiscard]] auto find(std::uint32_t shapeId) const
+        -> std::optional<Entry> {
+      while (true) {
+        auto const before = version.load(std::memory_order_acquire);
+        if ((before & 1U) != 0) {
+          return std::nullopt;
+        }
+
+        // Acquire loads keep the version check below from moving up past
+        // them; on x86 they're plain loads
+        auto found = std::optional<Entry>{};
+        for (auto const &slot : slots) {
+          auto const key = slot.key.load(std::memory_order_acquire);
+          if (key >> 32U == shapeId) {
+            found = Entry{shapeId, static_cast<int>(key & 0xffffffffU),
+                          slot.transition.load(std::memory_order_acquire)};
+            break;
+          }
+        }
+
+        if (version.load(std::memory_order_relaxed) == before) {
+          return found;
+        }
+      }
+    }
+
+    // Once every entry is taken the site is megamorphic; new shapes replace
+    // old ones round-robin.
+    auto insert(std::uint32_t shapeId, int slot, Shape *transition = nullptr)
+        -> void {
+      auto current = version.load(std::memory_order_relaxed);
+      if ((current & 1U) != 0 ||
+          !version.compare_exchange_strong(current, current + 1,
+                                           std::memory_order_acquire)) {
+        return;
+      }
+
+      // Release stores can't become visible before the version went odd
+      auto &target = slots.at(next);
+      target.key.store(static_cast<std::uint64_t>(shapeId) << 32U |
+                           static_cast<std::uint32_t>(slot),
+                       std::memory_order_release);
+      target.transition.store(transition, std::memory_order_release);
+      next = (next + 1) % SIZE;
+
+      version.store(current + 2, std::memory_order_release);
+    }
+  };
+} // namespace lox
@@ -0,0 +1,725 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "AstSerializer.hpp"
+#include "Environment.hpp"
+#include "LoxArray.hpp"
+#include "LoxClass.hpp"
+#include "LoxFunction.hpp"
+#include "LoxInstance.hpp"
+#include "LoxMap.hpp"
+#include "MappedFile.hpp"
+#include "Native.hpp"
+#include "Report.hpp"
+#include "Shape.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  // A program whose top level has run, and the globals it left behind.
+  // Function values point into `program`, so it has to outlive them.
+  struct Prelude {
+    std::vector<std::unique_ptr<stmt::Stmt>> program;
+    std::shared_ptr<Environment> globals;
+  };
+
+  // Numbers the stmt::Function nodes of a program in pre-order, the order
+  // AstWriter writes them in. Snapshots name a function's declaration by it.
+  class FunctionIndex {
+  private:
+    std::vector<stmt::Function const *> functions;
+    std::unordered_map<stmt::Function const *, std::uint32_t> indices;
+
+    auto add(std::unique_ptr<stmt::Stmt> const &stmt) -> void {
+      if (stmt) {
+        std::visit(*this, *stmt);
+      }
+    }
+
+  public:
+    explicit FunctionIndex(
+        std::vector<std::unique_ptr<stmt::Stmt>> const &program) {
+      for (auto const &stmt : program) {
+        add(stmt);
+      }
+    }
+
+    VISIT_STMT(stmt::Block) {
+      for (auto const &child : stmt.statements) {
+        add(child);
+      }
+    }
+    VISIT_STMT(stmt::If) {
+      add(stmt.thenBranch);
+      add(stmt.elseBranch);
+    }
+    VISIT_STMT(stmt::While) { add(stmt.body); }
+    VISIT_STMT(stmt::Function) {
+      indices.emplace(&stmt, static_cast<std::uint32_t>(functions.size()));
+      functions.push_back(&stmt);
+      for (auto const &child : stmt.body) {
+        add(child);
+      }
+    }
+    VISIT_STMT(stmt::Class) {
+      for (auto const &method : stmt.methods) {
+        add(method);
+      }
+    }
+    auto operator()(auto const & /*stmt*/) -> void {}
+
+    [[nodiscard]] auto size() const -> std::size_t { return functions.size(); }
+
+    [[nodiscard]] auto at(std::uint32_t index) const
+        -> stmt::Function const * {
+      return index < functions.size() ? functions[index] : nullptr;
+    }
+
+    [[nodiscard]] auto indexOf(stmt::Function const &function) const
+        -> std::optional<std::uint32_t> {
+      if (auto found = indices.find(&function); found != indices.end()) {
+        return found->second;
+      }
+      return std::nullopt;
+    }
+  };
+
+  // Binary image of a Prelude, restorable without running the prelude again:
+  //
+  //   header   magic "LOXSNAP\0", format version, AST size, checksum of
+  //            everything after the header
+  //   AST      the program, as AstWriter bytes
+  //   objects  environments (enclosing ones first), functions, classes
+  //            (superclasses first), instances, arrays and maps, then each
+  //            environment's variables, each instance's fields, each array's
+  //            elements and each map's entries
+  //
+  // Objects refer to each other by their index within their kind, so cycles
+  // (a function stored in the scope it closes over, an instance holding
+  // itself) need no special handling.
+  class Snapshot {
+  public:
+    // Bump whenever this layout or AstWriter's changes
+    static constexpr std::uint32_t FORMAT_VERSION = 7;
+
+  private:
+    static constexpr auto MAGIC = std::array<char, 8>{'L', 'O', 'X', 'S',
+                                                      'N', 'A', 'P', 0};
+
+    struct Header {
+      std::array<char, 8> magic;
+      std::uint32_t version;
+      std::uint32_t reserved;
+      std::uint64_t astSize;
+      std::uint64_t checksum;
+    };
+
+    enum class ValueTag : std::uint8_t {
+      NIL,
+      STRING,
+      BOOL,
+      NUMBER,
+      FUNCTION,
+      CLASS,
+      INSTANCE,
+      NATIVE, // By name, one of standardNatives()
+      ARRAY,
+      MAP
+    };
+
+    class Writer : public ByteWriter {
+    private:
+      FunctionIndex const &index;
+      std::unordered_map<void const *, std::uint32_t> ids;
+      std::vector<Environment const *> environments;
+      std::vector<LoxFunction const *> functions;
+      std::vector<LoxClass const *> classes;
+      std::vector<LoxInstance const *> instances;
+      std::vector<LoxArray const *> arrays;
+      std::vector<LoxMap const *> maps;
+      // How far the values of each kind have been walked; write() walks the
+      // globals' own values itself
+      std::size_t environmentsDone = 1;
+      std::size_t instancesDone = 0;
+      std::size_t arraysDone = 0;
+      std::size_t mapsDone = 0;
+      // Why the value add() last turned down can't be saved
+      std::string rejected;
+
+      auto reject(std::string reason) -> bool {
+        rejected = std::move(reason);
+        return false;
+      }
+
+      auto add(Environment const *environment) -> void {
+        if (environment == nullptr || ids.contains(environment)) {
+          return;
+        }
+
+        add(environment->enclosing.get());
+        ids.emplace(environment, environments.size());
+        environments.push_back(environment);
+      }
+
+      auto add(LoxFunction const *function) -> bool {
+        if (ids.contains(function)) {
+          return true;
+        }
+        if (!index.indexOf(function->declaration)) {
+          return reject(function->toString() +
+                        " is declared outside the prelude");
+        }
+
+        ids.emplace(function, functions.size());
+        functions.push_back(function);
+        add(function->closure.get());
+        return true;
+      }
+
+      auto add(LoxClass const *klass) -> bool {
+        if (klass == nullptr || ids.contains(klass)) {
+          return true;
+        }
+
+        if (!add(klass->superclass.get())) {
+          return false;
+        }
+        for (auto const &[name, method] : klass->methods) {
+          if (!add(method.get())) {
+            return false;
+          }
+        }
+        ids.emplace(klass, classes.size());
+        classes.push_back(klass);
+        return true;
+      }
+
+      auto add(LoxInstance const *instance) -> bool {
+        if (ids.contains(instance)) {
+          return true;
+        }
+
+        ids.emplace(instance, instances.size());
+        instances.push_back(instance);
+        return add(instance->klass.get());
+      }
+
+      auto add(LoxArray const *array) -> void {
+        if (ids.contains(array)) {
+          return;
+        }
+
+        ids.emplace(array, arrays.size());
+        arrays.push_back(array);
+      }
+
+      auto add(LoxMap const *map) -> void {
+        if (ids.contains(map)) {
+          return;
+        }
+
+        ids.emplace(map, maps.size());
+        maps.push_back(map);
+      }
+
+      // False for values a snapshot can't hold: callables that aren't Lox
+      // functions, classes or standard natives, such as generators, tasks
+      // and channels, and functions declared outside the prelude
+      auto add(LiteralVal const &value) -> bool {
+        if (auto const *callable =
+                std::get_if<std::shared_ptr<LoxCallable>>(&value)) {
+          if (auto const *native =
+                  dynamic_cast<LoxNative const *>(callable->get())) {
+            return findStandardNative(native->nativeName()).get() == native ||
+                   reject(native->toString() + " isn't a standard native");
+          }
+          if (auto const *function =
+                  dynamic_cast<LoxFunction const *>(callable->get())) {
+            return add(function);
+          }
+          if (auto const *klass =
+                  dynamic_cast<LoxClass const *>(callable->get())) {
+            return add(klass);
+          }
+          return reject((*callable)->toString() +
+                        " isn't a function, class or standard native");
+        }
+        if (auto const *instance =
+                std::get_if<std::shared_ptr<LoxInstance>>(&value)) {
+          return add(instance->get());
+        } else if (auto const *array =
+                       std::get_if<std::shared_ptr<LoxArray>>(&value)) {
+          add(array->get());
+        } else if (auto const *map =
+                       std::get_if<std::shared_ptr<LoxMap>>(&value)) {
+          add(map->get());
+        }
+        return true;
+      }
+
+      auto putId(void const *object) -> void {
+        putInt(static_cast<std::uint32_t>(ids.at(object)));
+      }
+
+      // 0 for none, else the index plus one
+      auto putOptionalId(void const *object) -> void {
+        putInt(object == nullptr
+                   ? std::uint32_t{0}
+                   : static_cast<std::uint32_t>(ids.at(object) + 1));
+      }
+
+      auto putValue(LiteralVal const &value) -> void {
+        std::visit(
+            overloaded{
+                [this](std::monostate const &) { putTag(ValueTag::NIL); },
+                [this](std::string const &arg) {
+                  putTag(ValueTag::STRING);
+                  putString(arg);
+                },
+                [this](bool const &arg) {
+                  putTag(ValueTag::BOOL);
+                  putInt(static_cast<std::uint8_t>(arg));
+                },
+                [this](double const &arg) {
+                  putTag(ValueTag::NUMBER);
+                  putInt(arg);
+                },
+                [this](std::shared_ptr<LoxCallable> const &arg) {
+                  if (auto const *native =
+                          dynamic_cast<LoxNative const *>(arg.get())) {
+                    putTag(ValueTag::NATIVE);
+                    putString(native->nativeName());
+                    return;
+                  }
+                  auto const *function =
+                      dynamic_cast<LoxFunction const *>(arg.get());
+                  putTag(function ? ValueTag::FUNCTION : ValueTag::CLASS);
+                  putId(function ? static_cast<void const *>(function)
+                                 : dynamic_cast<LoxClass const *>(arg.get()));
+                },
+                [this](std::shared_ptr<LoxInstance> const &arg) {
+                  putTag(ValueTag::INSTANCE);
+                  putId(arg.get());
+                },
+                [this](std::shared_ptr<LoxArray> const &arg) {
+                  putTag(ValueTag::ARRAY);
+                  putId(arg.get());
+                },
+                [this](std::shared_ptr<LoxMap> const &arg) {
+                  putTag(ValueTag::MAP);
+                  putId(arg.get());
+                }},
+            value);
+      }
+
+      auto putTag(ValueTag tag) -> void {
+        putInt(static_cast<std::uint8_t>(tag));
+      }
+
+      // Adds everything the objects added so far refer to. Values are walked
+      // breadth first so long chains of objects don't recurse.
+      auto addReachable() -> bool {
+        while (environmentsDone < environments.size() ||
+               instancesDone < instances.size() ||
+               arraysDone < arrays.size() || mapsDone < maps.size()) {
+          for (; environmentsDone < environments.size(); environmentsDone++) {
+            for (auto const &value : environments[environmentsDone]->values) {
+              if (!add(value)) {
+                return false;
+              }
+            }
+          }
+          for (; instancesDone < instances.size(); instancesDone++) {
+            for (auto const &value : instances[instancesDone]->fields) {
+              if (!add(value)) {
+                return false;
+              }
+            }
+          }
+          for (; arraysDone < arrays.size(); arraysDone++) {
+            auto const *values = std::get_if<std::vector<LiteralVal>>(
+                &arrays[arraysDone]->elements);
+            if (values == nullptr) {
+              continue; // Unboxed numbers
+            }
+            for (auto const &value : *values) {
+              if (!add(value)) {
+                return false;
+              }
+            }
+          }
+          for (; mapsDone < maps.size(); mapsDone++) {
+            auto representable = true;
+            maps[mapsDone]->forEach(
+                [&](LiteralVal const &key, LiteralVal const &value) {
+                  representable = representable && add(key) && add(value);
+                });
+            if (!representable) {
+              return false;
+            }
+          }
+        }
+        return true;
+      }
+
+    public:
+      explicit Writer(FunctionIndex const &index) : index{index} {}
+
+      // Each global is walked in full before the next, so a value that
+      // can't be saved is reported against the first global reaching it
+      auto write(Environment const &globals) -> Result<std::string> {
+        add(&globals);
+
+        auto unsaved = std::optional<std::string>{};
+        globals.forEach([&](std::string const &name, LiteralVal const &value) {
+          if (!unsaved && (!add(value) || !addReachable())) {
+            unsaved = name;
+          }
+        });
+        if (unsaved) {
+          return std::unexpected(
+              ReportError{"Can't save '" + *unsaved + "': " + rejected + "."});
+        }
+
+        putInt(static_cast<std::uint32_t>(environments.size()));
+        for (auto const *environment : environments) {
+          putOptionalId(environment->enclosing.get());
+        }
+
+        putInt(static_cast<std::uint32_t>(functions.size()));
+        for (auto const *function : functions) {
+          // add() turned down functions declared outside the prelude
+          putInt(*index.indexOf(function->declaration));
+          putId(function->closure.get());
+          putInt(static_cast<std::uint8_t>(function->isInitializer));
+        }
+
+        putInt(static_cast<std::uint32_t>(classes.size()));
+        for (auto const *klass : classes) {
+          putString(klass->name);
+          putOptionalId(klass->superclass.get());
+          putInt(static_cast<std::uint32_t>(klass->methods.size()));
+          for (auto const &[name, method] : klass->methods) {
+            putString(name);
+            putId(method.get());
+          }
+        }
+
+        putInt(static_cast<std::uint32_t>(instances.size()));
+        for (auto const *instance : instances) {
+          putId(instance->klass.get());
+        }
+
+        putInt(static_cast<std::uint32_t>(arrays.size()));
+        putInt(static_cast<std::uint32_t>(maps.size()));
+
+        for (auto const *environment : environments) {
+          putInt(static_cast<std::uint32_t>(environment->size()));
+          environment->forEach(
+              [&](std::string const &name, LiteralVal const &value) {
+                putString(name);
+                putValue(value);
+              });
+        }
+
+        for (auto const *instance : instances) {
+          auto const names = instance->shape->fieldNames();
+          putInt(static_cast<std::uint32_t>(names.size()));
+          for (std::size_t slot = 0; slot < names.size(); slot++) {
+            putString(names[slot]);
+            putValue(instance->fields[slot]);
+          }
+        }
+
+        // Unboxed arrays as raw doubles, the rest value by value
+        for (auto const *array : arrays) {
+          if (auto const *numbers =
+                  std::get_if<std::vector<double>>(&array->elements)) {
+            putInt(std::uint8_t{0});
+            putInt(static_cast<std::uint32_t>(numbers->size()));
+            for (auto const number : *numbers) {
+              putInt(number);
+            }
+          } else {
+            auto const &values =
+                std::get<std::vector<LiteralVal>>(array->elements);
+            putInt(std::uint8_t{1});
+            putInt(static_cast<std::uint32_t>(values.size()));
+            for (auto const &value : values) {
+              putValue(value);
+            }
+          }
+        }
+
+        for (auto const *map : maps) {
+          putInt(static_cast<std::uint32_t>(map->size()));
+          map->forEach([&](LiteralVal const &key, LiteralVal const &value) {
+            putValue(key);
+            putValue(value);
+          });
+        }
+
+        return std::move(out);
+      }
+    };
+
+    class Reader : public ByteReader {
+    private:
+      FunctionIndex const &index;
+      std::vector<std::shared_ptr<Environment>> environments;
+      std::vector<std::shared_ptr<LoxFunction>> functions;
+      std::vector<std::shared_ptr<LoxClass>> classes;
+      std::vector<std::shared_ptr<LoxInstance>> instances;
+      std::vector<std::shared_ptr<LoxArray>> arrays;
+      std::vector<std::shared_ptr<LoxMap>> maps;
+
+      template <typename Object>
+      auto getId(std::vector<std::shared_ptr<Object>> const &objects)
+          -> std::shared_ptr<Object> {
+        auto const id = getInt<std::uint32_t>();
+        if (id >= objects.size()) {
+          fail();
+          return nullptr;
+        }
+        return objects[id];
+      }
+
+      // Only objects already read may be referenced, which also rules out
+      // cycles in enclosing scopes and superclasses
+      template <typename Object>
+      auto getOptionalId(std::vector<std::shared_ptr<Object>> const &objects)
+          -> std::shared_ptr<Object> {
+        auto const id = getInt<std::uint32_t>();
+        if (id > objects.size()) {
+          fail();
+          return nullptr;
+        }
+        return id == 0 ? nullptr : objects[id - 1];
+      }
+
+      auto getValue() -> LiteralVal {
+        switch (static_cast<ValueTag>(getInt<std::uint8_t>())) {
+          case ValueTag::NIL:
+            return {};
+          case ValueTag::STRING:
+            return getString();
+          case ValueTag::BOOL:
+            return getInt<std::uint8_t>() != 0;
+          case ValueTag::NUMBER:
+            return getInt<double>();
+          case ValueTag::FUNCTION:
+            return std::static_pointer_cast<LoxCallable>(getId(functions));
+          case ValueTag::CLASS:
+            return std::static_pointer_cast<LoxCallable>(getId(classes));
+          case ValueTag::INSTANCE:
+            return getId(instances);
+          case ValueTag::ARRAY:
+            return getId(arrays);
+          case ValueTag::MAP:
+            return getId(maps);
+          case ValueTag::NATIVE:
+            if (auto native = findStandardNative(getString())) {
+              return std::static_pointer_cast<LoxCallable>(std::move(native));
+            }
+            fail();
+            return {};
+          default:
+            fail();
+            return {};
+        }
+      }
+
+    public:
+      Reader(std::string_view in, FunctionIndex const &index)
+          : ByteReader{in}, index{index} {}
+
+      auto read() -> std::shared_ptr<Environment> {
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          environments.push_back(
+              std::make_shared<Environment>(getOptionalId(environments)));
+        }
+
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          auto const *declaration = index.at(getInt<std::uint32_t>());
+          auto closure = getId(environments);
+          auto const isInitializer = getInt<std::uint8_t>() != 0;
+          if (declaration == nullptr || !ok()) {
+            fail();
+            break;
+          }
+          functions.push_back(std::make_shared<LoxFunction>(
+              *declaration, std::move(closure), isInitializer));
+        }
+
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          auto name = getString();
+          auto superclass = getOptionalId(classes);
+          auto methods =
+              std::unordered_map<std::string, std::shared_ptr<LoxFunction>>{};
+          for (auto methodCount = getInt<std::uint32_t>();
+               methodCount > 0 && ok(); methodCount--) {
+            auto methodName = getString();
+            methods.emplace(std::move(methodName), getId(functions));
+          }
+          classes.push_back(std::make_shared<LoxClass>(
+              std::move(name), std::move(superclass), std::move(methods)));
+        }
+
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          auto klass = getId(classes);
+          if (klass == nullptr) {
+            break;
+          }
+          instances.push_back(std::make_shared<LoxInstance>(std::move(klass)));
+        }
+
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          arrays.push_back(std::make_shared<LoxArray>());
+        }
+
+        for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+             count--) {
+          maps.push_back(std::make_shared<LoxMap>());
+        }
+
+        for (auto const &environment : environments) {
+          for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+               count--) {
+            auto name = getString();
+            environment->define(name, getValue());
+          }
+        }
+
+        // Replaying the fields in slot order walks each class's shape tree
+        // the same way the original instances did
+        for (auto const &instance : instances) {
+          for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+               count--) {
+            auto name = getString();
+            auto cache = InlineCache{};
+            instance->set(name, getValue(), cache);
+          }
+        }
+
+        for (auto const &array : arrays) {
+          auto const unboxed = getInt<std::uint8_t>() == 0;
+          auto const count = getInt<std::uint32_t>();
+          if (unboxed) {
+            auto numbers = std::vector<double>{};
+            for (std::uint32_t i = 0; i < count && ok(); i++) {
+              numbers.push_back(getInt<double>());
+            }
+            array->elements = std::move(numbers);
+          } else {
+            auto values = std::vector<LiteralVal>{};
+            for (std::uint32_t i = 0; i < count && ok(); i++) {
+              values.push_back(getValue());
+            }
+            array->elements = std::move(values);
+          }
+        }
+
+        for (auto const &map : maps) {
+          for (auto count = getInt<std::uint32_t>(); count > 0 && ok();
+               count--) {
+            auto key = getValue();
+            map->set(key, getValue());
+          }
+        }
+
+        if (!ok() || !atEnd() || environments.empty()) {
+          return nullptr;
+        }
+        return environments.front();
+      }
+    };
+
+  public:
+    // Fails when the globals hold something a snapshot can't represent,
+    // such as a generator or a function declared outside the prelude's
+    // program, or the program is nested too deeply for AstWriter
+    static auto capture(Prelude const &prelude) -> Result<std::string> {
+      auto const index = FunctionIndex{prelude.program};
+      auto const objects = TRY(Writer{index}.write(*prelude.globals));
+
+      auto const ast = AstWriter::write(prelude.program);
+      if (!ast) {
+        return std::unexpected(
+            ReportError{"The prelude is nested too deeply to save."});
+      }
+
+      auto body = *ast + objects;
+      auto const header = Header{MAGIC, FORMAT_VERSION, 0, ast->size(),
+                                 fnv1a(body)};
+
+      auto image = std::string(sizeof header, '\0');
+      std::memcpy(image.data(), &header, sizeof header);
+      return image + body;
+    }
+
+    // Nullopt for anything that isn't an intact image of this version
+    static auto restore(std::string_view image) -> std::optional<Prelude> {
+      auto header = Header{};
+      if (image.size() < sizeof header) {
+        return std::nullopt;
+      }
+      std::memcpy(&header, image.data(), sizeof header);
+
+      auto const body = image.substr(sizeof header);
+      if (header.magic != MAGIC || header.version != FORMAT_VERSION ||
+          header.astSize > body.size() || header.checksum != fnv1a(body)) {
+        return std::nullopt;
+      }
+
+      auto program = AstReader::read(body.substr(0, header.astSize));
+      if (!program) {
+        return std::nullopt;
+      }
+
+      auto const index = FunctionIndex{*program};
+      auto globals = Reader{body.substr(header.astSize), index}.read();
+      if (globals == nullptr) {
+        return std::nullopt;
+      }
+
+      return Prelude{std::move(*program), std::move(globals)};
+    }
+
+    static auto save(std::filesystem::path const &path, Prelude const &prelude)
+        -> Result<void> {
+      auto const image = TRY(capture(prelude));
+
+      auto out = std::ofstream{path, std::ios::binary};
+      out.write(image.data(), static_cast<std::streamsize>(image.size()));
+      if (!out) {
+        return std::unexpected(ReportError{"Could not write the file."});
+      }
+      return {};
+    }
+
+    static auto load(std::filesystem::path const &path)
+        -> std::optional<Prelude> {
+      auto const file = MappedFile::open(path);
+      return file ? restore(file->bytes()) : std::nullopt;
+    }
+  };
+} // namespace lox
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <sys/resource.h>
+#include <variant>
+#include <vector>
+
+#include "AllocationCounter.hpp"
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "utils.hpp"
+
+namespace lox {
+  struct PhaseStats {
+    double wallMs = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocatedBytes = 0;
+    std::int64_t peakHeapBytes = 0; // Counted from the start of the run
+  };
+
+  // Calls to pure functions answered from a MemoCache, and those that had
+  // to run the body
+  struct MemoCounts {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+  };
+
+  // Where the time and memory of one Lox::run went. Only collected when a
+  // RunStats is passed in; otherwise each phase costs one null check.
+  struct RunStats {
+    PhaseStats scanner, parser, interpreter;
+    std::size_t tokenCount = 0;
+    std::size_t astNodeCount = 0;
+    bool cached = false; // The AST came from an AstCache: nothing was scanned
+    MemoCounts memo; // Only counted with RunOptions::memoize
+
+    // Runs `phase` and records it into `stats`, or just runs it when `stats`
+    // is null
+    template <typename Phase>
+    static auto measure(PhaseStats *stats, Phase &&phase) {
+      if (stats == nullptr) {
+        return phase();
+      }
+
+      auto &counter = AllocationCounter::current();
+      auto const allocationsBefore = counter.allocations;
+      auto const bytesBefore = counter.bytes;
+      counter.peakLiveBytes = counter.liveBytes;
+      auto const start = std::chrono::steady_clock::now();
+
+      auto result = phase();
+
+      stats->wallMs = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      stats->allocations = counter.allocations - allocationsBefore;
+      stats->allocatedBytes = counter.bytes - bytesBefore;
+      stats->peakHeapBytes = std::max<std::int64_t>(counter.peakLiveBytes, 0);
+
+      return result;
+    }
+
+    // Live heap tracking brackets the whole run so each phase's peak includes
+    // what earlier phases left allocated (the source, tokens, AST)
+    static auto beginRun() -> void {
+      auto &counter = AllocationCounter::current();
+      counter.trackLiveBytes = true;
+      counter.liveBytes = 0;
+      counter.peakLiveBytes = 0;
+    }
+
+    static auto endRun() -> void {
+      AllocationCounter::current().trackLiveBytes = false;
+    }
+
+    static auto peakRssBytes() -> std::uint64_t {
+      auto usage = rusage{};
+      getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+      return usage.ru_maxrss; // Already bytes on macOS
+#else
+      return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+    auto print(std::ostream &out) const -> void {
+      out << "phase        wall ms     allocs   alloc bytes  peak heap\n";
+      printPhase(out, "scanner", scanner);
+      printPhase(out, "parser", parser);
+      printPhase(out, "interpreter", interpreter);
+      out << "tokens: ";
+      if (cached) {
+        out << "cached";
+      } else {
+        out << tokenCount;
+      }
+      out << ", AST nodes: " << astNodeCount << ", peak RSS: " << peakRssBytes() << " bytes\n"
+          << "memo hits: " << memo.hits << ", misses: " << memo.misses
+          << '\n';
+    }
+
+    auto writeJson(std::ostream &out) const -> void {
+      out << "{\n";
+      writePhase(out, "scanner", scanner);
+      writePhase(out, "parser", parser);
+      writePhase(out, "interpreter", interpreter);
+      out << "  \"tokens\": "
+          << (cached ? "null" : std::to_string(tokenCount)) << ",\n"
+          << "  \"cached\": " << (cached ? "true" : "false") << ",\n"
+          << "  \"ast_nodes\": " << astNodeCount << ",\n"
+          << "  \"memo_hits\": " << memo.hits << ",\n"
+          << "  \"memo_misses\": " << memo.misses << ",\n"
+          << "  \"peak_rss_bytes\": " << peakRssBytes() << "\n}\n";
+    }
+
+  private:
+    static auto printPhase(std::ostream &out, char const *name,
+                           PhaseStats const &phase) -> void {
+      auto line = std::array<char, 96>{};
+      std::snprintf(line.data(), line.size(),
+                    "%-11s %9.3f %10llu %13llu %10lld\n", name, phase.wallMs,
+                    static_cast<unsigned long long>(phase.allocations),
+                    static_cast<unsigned long long>(phase.allocatedBytes),
+                    static_cast<long long>(phase.peakHeapBytes));
+      out << line.data();
+    }
+
+    static auto writePhase(std::ostream &out, char const *name,
+                           PhaseStats const &phase) -> void {
+      out << "  \"" << name << "\": {\"wall_ms\": " << phase.wallMs
+          << ", \"allocations\": " << phase.allocations
+          << ", \"allocated_bytes\": " << phase.allocatedBytes
+          << ", \"peak_heap_bytes\": " << phase.peakHeapBytes << "},\n";
+    }
+  };
+
+  // Counts every Expr and Stmt node reachable from a parsed program
+  class AstNodeCounter {
+  private:
+    std::size_t count = 0;
+
+    // From a work list: expressions can nest deeper than recursion allows
+    auto visit(std::unique_ptr<expr::Expr> const &expr) -> void {
+      auto pending = std::vector<expr::Expr const *>{};
+      if (expr) {
+        pending.push_back(expr.get());
+      }
+
+      while (!pending.empty()) {
+        auto const *node = pending.back();
+        pending.pop_back();
+        count++;
+        expr::forEachChild(
+            *node, [&](std::unique_ptr<expr::Expr> const &child) {
+              if (child) {
+                pending.push_back(child.get());
+              }
+            });
+      }
+    }
+
+    auto visit(std::unique_ptr<stmt::Stmt> const &stmt) -> void {
+      if (stmt) {
+        count++;
+        std::visit([this](auto const &node) { (*this)(node); }, *stmt);
+      }
+    }
+
+    template <typename Node>
+    auto visitAll(std::vector<std::unique_ptr<Node>> const &nodes) -> void {
+      for (auto const &node : nodes) {
+        visit(node);
+      }
+    }
+
+  public:
+    /* #region Stmt */
+    VISIT_STMT(stmt::Print) { visit(stmt.expression); }
+    VISIT_STMT(stmt::Expression) { visit(stmt.expression); }
+    VISIT_STMT(stmt::Var) { visit(stmt.initializer); }
+    VISIT_STMT(stmt::Block) { visitAll(stmt.statements); }
+    VISIT_STMT(stmt::If) {
+      visit(stmt.condition);
+      visit(stmt.thenBranch);
+      visit(stmt.elseBranch);
+    }
+    VISIT_STMT(stmt::While) {
+      visit(stmt.condition);
+      visit(stmt.body);
+    }
+    VISIT_STMT(stmt::Function) { visitAll(stmt.body); }
+    VISIT_STMT(stmt::Return) { visit(stmt.value); }
+    VISIT_STMT(stmt::Yield) { visit(stmt.value); }
+    auto operator()(stmt::Import const & /*stmt*/) -> void {}
+    VISIT_STMT(stmt::Class) {
+      visit(stmt.superclass);
+      visitAll(stmt.methods);
+    }
+    /* #endregion */
+
+    static auto
+    countAll(std::vector<std::unique_ptr<stmt::Stmt>> const &program)
+        -> std::size_t {
+      auto counter = AstNodeCounter{};
+      counter.visitAll(program);
+      return counter.count;
+    }
+  };
+} // namespace lox
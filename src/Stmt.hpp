@@ -9,6 +9,10 @@
 #include "Expr.hpp"
 #include "Token.hpp"
 
+namespace lox {
+  struct Module;
+} // namespace lox
+
 namespace lox::stmt {
   /* #region Forward declarations */
   struct Print;
@@ -17,8 +21,14 @@ namespace lox::stmt {
   struct Block;
   struct If;
   struct While;
-
-  using Stmt = std::variant<Print, Expression, Var, Block, If, While>;
+  struct Function;
+  struct Return;
+  struct Class;
+  struct Yield;
+  struct Import;
+
+  using Stmt = std::variant<Print, Expression, Var, Block, If, While, Function,
+                            Return, Class, Yield, Import>;
   /* #endregion */
 
   struct Print {
@@ -61,12 +71,72 @@ namespace lox::stmt {
   };
 
   struct While {
+    Token const keyword;
     std::unique_ptr<expr::Expr> const condition;
     std::unique_ptr<stmt::Stmt> const body;
 
-    While(std::unique_ptr<expr::Expr> condition,
-          std::unique_ptr<stmt::Stmt> body)
-        : condition{std::move(condition)}, body{std::move(body)} {}
-  }
+    While(Token keyword, std::unique_ptr<expr::Expr> &condition,
+          std::unique_ptr<stmt::Stmt> &body)
+        : keyword{std::move(keyword)}, condition{std::move(condition)},
+          body{std::move(body)} {}
+  };
+
+  struct Function {
+    Token const name;
+    std::vector<Token> const params;
+    std::vector<std::unique_ptr<Stmt>> const body;
+    // The body yields, so calling the function makes a LoxGenerator
+    bool const isGenerator;
+    // Set by Purity: the same arguments always give the same result, as
+    // long as the names of `callees`, every function a call may reach,
+    // still refer to them
+    mutable bool pure = false;
+    mutable std::vector<Function const *> callees;
+    // Set by ModuleCache when declared in an imported module
+    mutable Module const *module = nullptr;
+
+    Function(Token name, std::vector<Token> params,
+             std::vector<std::unique_ptr<Stmt>> body, bool isGenerator = false)
+        : name{std::move(name)}, params{std::move(params)},
+          body{std::move(body)}, isGenerator{isGenerator} {}
+  };
+
+  struct Return {
+    Token const keyword;
+    std::unique_ptr<expr::Expr> const value;
+
+    Return(Token keyword, std::unique_ptr<expr::Expr> &value)
+        : keyword{std::move(keyword)}, value{std::move(value)} {}
+  };
+
+  struct Class {
+    Token const name;
+    std::unique_ptr<expr::Expr> const superclass;
+    std::vector<std::unique_ptr<Stmt>> const methods; // Each a stmt::Function
+
+    Class(Token name, std::unique_ptr<expr::Expr> &superclass,
+          std::vector<std::unique_ptr<Stmt>> methods)
+        : name{std::move(name)}, superclass{std::move(superclass)},
+          methods{std::move(methods)} {}
+  };
+
+  struct Yield {
+    Token const keyword;
+    std::unique_ptr<expr::Expr> const value;
+
+    Yield(Token keyword, std::unique_ptr<expr::Expr> &value)
+        : keyword{std::move(keyword)}, value{std::move(value)} {}
+  };
+
+  // `import "path";`, only at the top level of a program
+  struct Import {
+    Token const keyword;
+    Token const path; // A string literal
+    // Set by ModuleCache::link before the program runs
+    mutable Module const *module = nullptr;
+
+    Import(Token keyword, Token path)
+        : keyword{std::move(keyword)}, path{std::move(path)} {}
+  };
 
 } // namespace lox::stmt
\ No newline at end of file
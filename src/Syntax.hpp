@@ -0,0 +1,455 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+#include "Scanner.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // Whether a program scans and parses without errors, decided without
+  // allocating so it can run at compile time: programs embedded in the
+  // binary are checked with it in a static_assert. It follows the rules of
+  // Scanner and Parser but builds nothing and stops at the first error;
+  // running the program still reports errors the usual way. It recurses
+  // once per level of nesting, which is fine for the short programs it is
+  // meant for but not for arbitrary scripts.
+  class SyntaxCheck {
+  private:
+    struct Lexeme {
+      TokenType type = TokenType::END_OF_FILE;
+      std::string_view text;
+    };
+
+    std::string_view source;
+    std::size_t current = 0;
+    Lexeme next;
+    bool failed = false;
+    int functionDepth = 0;
+    int blockDepth = 0;
+    bool functionYields = false;
+
+    // The <cctype> functions Scanner uses, in the "C" locale
+    static constexpr auto isDigit(char c) -> bool {
+      return c >= '0' && c <= '9';
+    }
+
+    static constexpr auto isAlpha(char c) -> bool {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    constexpr auto peekChar(std::size_t offset = 0) const -> char {
+      return current + offset < source.size() ? source[current + offset]
+                                              : '\0';
+    }
+
+    constexpr auto scan() -> Lexeme {
+      while (current < source.size()) {
+        auto const start = current;
+        auto const lexeme = [&](TokenType type) {
+          return Lexeme{type, source.substr(start, current - start)};
+        };
+        auto const either = [&](TokenType pair, TokenType single) {
+          if (peekChar() == '=') {
+            current++;
+            return lexeme(pair);
+          }
+          return lexeme(single);
+        };
+
+        switch (auto const c = source[current++]) {
+          case '(':
+            return lexeme(TokenType::LEFT_PAREN);
+          case ')':
+            return lexeme(TokenType::RIGHT_PAREN);
+          case '{':
+            return lexeme(TokenType::LEFT_BRACE);
+          case '}':
+            return lexeme(TokenType::RIGHT_BRACE);
+          case '[':
+            return lexeme(TokenType::LEFT_BRACKET);
+          case ']':
+            return lexeme(TokenType::RIGHT_BRACKET);
+          case ',':
+            return lexeme(TokenType::COMMA);
+          case '.':
+            return lexeme(TokenType::DOT);
+          case '-':
+            return lexeme(TokenType::MINUS);
+          case '+':
+            return lexeme(TokenType::PLUS);
+          case ';':
+            return lexeme(TokenType::SEMICOLON);
+          case '*':
+            return lexeme(TokenType::STAR);
+          case '!':
+            return either(TokenType::BANG_EQUAL, TokenType::BANG);
+          case '=':
+            return either(TokenType::EQUAL_EQUAL, TokenType::EQUAL);
+          case '<':
+            return either(TokenType::LESS_EQUAL, TokenType::LESS);
+          case '>':
+            return either(TokenType::GREATER_EQUAL, TokenType::GREATER);
+          case '/':
+            if (peekChar() != '/') {
+              return lexeme(TokenType::SLASH);
+            }
+            while (current < source.size() && source[current] != '\n') {
+              current++;
+            }
+            break;
+          case ' ':
+          case '\r':
+          case '\t':
+          case '\n':
+            break;
+          case '"':
+            while (current < source.size() && source[current] != '"') {
+              current++;
+            }
+            if (current == source.size()) {
+              failed = true; // Unterminated string
+              return {};
+            }
+            current++;
+            return lexeme(TokenType::STRING);
+          default:
+            if (isDigit(c)) {
+              while (isDigit(peekChar())) {
+                current++;
+              }
+              if (peekChar() == '.' && isDigit(peekChar(1))) {
+                current++;
+                while (isDigit(peekChar())) {
+                  current++;
+                }
+              }
+              return lexeme(TokenType::NUMBER);
+            }
+            if (isAlpha(c)) {
+              while (isAlpha(peekChar()) || isDigit(peekChar())) {
+                current++;
+              }
+              auto const text = source.substr(start, current - start);
+              return {Scanner::keywordType(text), text};
+            }
+            failed = true; // Unexpected character
+            break;
+        }
+      }
+      return {};
+    }
+
+    constexpr auto advance() -> Lexeme { return std::exchange(next, scan()); }
+
+    [[nodiscard]] constexpr auto check(TokenType type) const -> bool {
+      return next.type == type;
+    }
+
+    constexpr auto match(TokenType type) -> bool {
+      if (check(type)) {
+        advance();
+        return true;
+      }
+      return false;
+    }
+
+    constexpr auto consume(TokenType type) -> bool {
+      return match(type) || (failed = true, false);
+    }
+
+    /* #region Expr */
+    // Binding power of an infix operator, 0 for anything else. Assignment
+    // is handled on its own: it is right-associative and needs a target.
+    static constexpr auto precedence(TokenType type) -> int {
+      switch (type) {
+        case TokenType::OR:
+          return 1;
+        case TokenType::AND:
+          return 2;
+        case TokenType::BANG_EQUAL:
+        case TokenType::EQUAL_EQUAL:
+          return 3;
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+          return 4;
+        case TokenType::MINUS:
+        case TokenType::PLUS:
+          return 5;
+        case TokenType::SLASH:
+        case TokenType::STAR:
+          return 6;
+        default:
+          return 0;
+      }
+    }
+
+    constexpr auto expression() -> bool {
+      auto assignable = false;
+      if (!binary(1, assignable)) {
+        return false;
+      }
+      if (match(TokenType::EQUAL)) {
+        // A variable, property or index, as in Parser::assignTo
+        return (assignable || (failed = true, false)) && expression();
+      }
+      return true;
+    }
+
+    // `assignable` is whether the whole operand is a valid assignment target
+    constexpr auto binary(int lowest, bool &assignable) -> bool {
+      if (!unary(assignable)) {
+        return false;
+      }
+      while (precedence(next.type) >= lowest) {
+        auto const level = precedence(advance().type);
+        auto right = false;
+        if (!binary(level + 1, right)) {
+          return false;
+        }
+        assignable = false;
+      }
+      return true;
+    }
+
+    constexpr auto unary(bool &assignable) -> bool {
+      if (match(TokenType::BANG) || match(TokenType::MINUS)) {
+        assignable = false;
+        auto operand = false;
+        return unary(operand);
+      }
+      return call(assignable);
+    }
+
+    // Comma-separated expressions up to `close`, at most 255 of them when
+    // `limited` (call arguments)
+    constexpr auto list(TokenType close, bool limited) -> bool {
+      if (match(close)) {
+        return true;
+      }
+      auto count = 0;
+      do {
+        if (limited && count++ >= 255) {
+          failed = true;
+          return false;
+        }
+        if (!expression()) {
+          return false;
+        }
+      } while (match(TokenType::COMMA));
+      return consume(close);
+    }
+
+    constexpr auto call(bool &assignable) -> bool {
+      if (!primary(assignable)) {
+        return false;
+      }
+      while (true) {
+        if (match(TokenType::LEFT_PAREN)) {
+          if (!list(TokenType::RIGHT_PAREN, true)) {
+            return false;
+          }
+          assignable = false;
+        } else if (match(TokenType::LEFT_BRACKET)) {
+          if (!expression() || !consume(TokenType::RIGHT_BRACKET)) {
+            return false;
+          }
+          assignable = true;
+        } else if (match(TokenType::DOT)) {
+          if (!consume(TokenType::IDENTIFIER)) {
+            return false;
+          }
+          assignable = true;
+        } else {
+          return true;
+        }
+      }
+    }
+
+    constexpr auto primary(bool &assignable) -> bool {
+      assignable = false;
+      switch (advance().type) {
+        case TokenType::FALSE:
+        case TokenType::TRUE:
+        case TokenType::NIL:
+        case TokenType::NUMBER:
+        case TokenType::STRING:
+        case TokenType::THIS:
+          return true;
+        case TokenType::SUPER:
+          return consume(TokenType::DOT) && consume(TokenType::IDENTIFIER);
+        case TokenType::IDENTIFIER:
+          assignable = true;
+          return true;
+        case TokenType::LEFT_PAREN:
+          return expression() && consume(TokenType::RIGHT_PAREN);
+        case TokenType::LEFT_BRACKET:
+          return list(TokenType::RIGHT_BRACKET, false);
+        default:
+          failed = true; // Expect expression
+          return false;
+      }
+    }
+    /* #endregion */
+
+    /* #region Stmt */
+    constexpr auto block() -> bool {
+      blockDepth++;
+      while (!check(TokenType::RIGHT_BRACE) &&
+             !check(TokenType::END_OF_FILE)) {
+        if (!declaration()) {
+          return false;
+        }
+      }
+      blockDepth--;
+      return consume(TokenType::RIGHT_BRACE);
+    }
+
+    // The rest of a return or yield, which only a function body may hold
+    constexpr auto returnValue() -> bool {
+      if (functionDepth == 0) {
+        failed = true;
+        return false;
+      }
+      return (check(TokenType::SEMICOLON) || expression()) &&
+             consume(TokenType::SEMICOLON);
+    }
+
+    constexpr auto statement() -> bool {
+      switch (next.type) {
+        case TokenType::IF:
+          advance();
+          return consume(TokenType::LEFT_PAREN) && expression() &&
+                 consume(TokenType::RIGHT_PAREN) && statement() &&
+                 (!match(TokenType::ELSE) || statement());
+        case TokenType::PRINT:
+          advance();
+          return expression() && consume(TokenType::SEMICOLON);
+        case TokenType::RETURN:
+          advance();
+          return returnValue();
+        case TokenType::WHILE:
+          advance();
+          return consume(TokenType::LEFT_PAREN) && expression() &&
+                 consume(TokenType::RIGHT_PAREN) && statement();
+        case TokenType::YIELD:
+          advance();
+          functionYields = true;
+          return returnValue();
+        case TokenType::IMPORT:
+          failed = true; // Only at the top level, see declaration()
+          return false;
+        case TokenType::LEFT_BRACE:
+          advance();
+          return block();
+        default:
+          return expression() && consume(TokenType::SEMICOLON);
+      }
+    }
+    /* #endregion */
+
+    /* #region Declaration */
+    constexpr auto function(bool method) -> bool {
+      auto const name = next.text;
+      if (!consume(TokenType::IDENTIFIER) ||
+          !consume(TokenType::LEFT_PAREN)) {
+        return false;
+      }
+
+      if (!check(TokenType::RIGHT_PAREN)) {
+        auto count = 0;
+        do {
+          if (count++ >= 255 || !consume(TokenType::IDENTIFIER)) {
+            failed = true;
+            return false;
+          }
+        } while (match(TokenType::COMMA));
+      }
+      if (!consume(TokenType::RIGHT_PAREN) ||
+          !consume(TokenType::LEFT_BRACE)) {
+        return false;
+      }
+
+      functionDepth++;
+      auto const enclosingYields = std::exchange(functionYields, false);
+      if (!block()) {
+        return false;
+      }
+      auto const isGenerator = std::exchange(functionYields, enclosingYields);
+      functionDepth--;
+
+      // Can't yield from an initializer
+      return !(isGenerator && method && name == "init") ||
+             (failed = true, false);
+    }
+
+    constexpr auto classDeclaration() -> bool {
+      if (!consume(TokenType::IDENTIFIER) ||
+          (match(TokenType::LESS) && !consume(TokenType::IDENTIFIER)) ||
+          !consume(TokenType::LEFT_BRACE)) {
+        return false;
+      }
+      while (!check(TokenType::RIGHT_BRACE) &&
+             !check(TokenType::END_OF_FILE)) {
+        if (!function(true)) {
+          return false;
+        }
+      }
+      return consume(TokenType::RIGHT_BRACE);
+    }
+
+    constexpr auto declaration() -> bool {
+      if (match(TokenType::CLASS)) {
+        return classDeclaration();
+      }
+      if (match(TokenType::FUN)) {
+        return function(false);
+      }
+      if (match(TokenType::VAR)) {
+        return consume(TokenType::IDENTIFIER) &&
+               (!match(TokenType::EQUAL) || expression()) &&
+               consume(TokenType::SEMICOLON);
+      }
+      if (blockDepth == 0 && match(TokenType::IMPORT)) {
+        return consume(TokenType::STRING) && consume(TokenType::SEMICOLON);
+      }
+      return statement();
+    }
+    /* #endregion */
+
+    constexpr explicit SyntaxCheck(std::string_view source) : source{source} {
+      next = scan();
+    }
+
+  public:
+    static constexpr auto valid(std::string_view source) -> bool {
+      auto checker = SyntaxCheck{source};
+      while (!checker.check(TokenType::END_OF_FILE)) {
+        if (!checker.declaration()) {
+          return false;
+        }
+      }
+      return !checker.failed;
+    }
+  };
+
+  static_assert(SyntaxCheck::valid(R"(
+    class A < B {
+      init(x) { this.x = [x, "y"]; }
+      get() { yield super.get()[0] + -this.x.y; }
+    }
+    import "m.lox";
+    var a = A(1)[0].b = !(2 <= 3.5) or nil and c == d;
+    while (a) { if (a != false) print a; else a = a - 1; }
+  )"));
+  static_assert(!SyntaxCheck::valid("print 1"));
+  static_assert(!SyntaxCheck::valid("a + b = c;"));
+  static_assert(!SyntaxCheck::valid("return 1;"));
+  static_assert(!SyntaxCheck::valid("{ import \"m.lox\"; }"));
+  static_assert(!SyntaxCheck::valid("print \"unterminated;"));
+  static_assert(!SyntaxCheck::valid("print 1 @ 2;"));
+  static_assert(!SyntaxCheck::valid("class A { init() { yield; } }"));
+} // namespace lox
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Environment.hpp"
+#include "LoxArray.hpp"
+#include "LoxCallable.hpp"
+#include "LoxClass.hpp"
+#include "LoxFunction.hpp"
+#include "LoxGenerator.hpp"
+#include "LoxInstance.hpp"
+#include "LoxMap.hpp"
+#include "Report.hpp"
+#include "Shape.hpp"
+#include "ThreadPool.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // Every task spawned by any script in the process runs here
+  inline auto taskPool() -> WorkStealingPool & {
+    static auto pool = WorkStealingPool{};
+    return pool;
+  }
+
+  // Waits under `mutex` until `ready()` holds and returns the lock. While
+  // waiting it runs queued tasks, so tasks blocked on other tasks can't tie
+  // up every worker while the ones they wait for sit in a queue.
+  template <typename Ready>
+  auto helpUntil(std::mutex &mutex, std::condition_variable &changed,
+                 Ready ready) -> std::unique_lock<std::mutex> {
+    auto lock = std::unique_lock{mutex};
+    while (!ready()) {
+      lock.unlock();
+      auto const helped = taskPool().runOne();
+      lock.lock();
+      if (!helped && !ready()) {
+        // Wake up now and then to look for new work to help with
+        changed.wait_for(lock, std::chrono::milliseconds{1});
+      }
+    }
+    return lock;
+  }
+
+  // Copies a value together with every function, class, instance, array,
+  // map, generator and scope it can reach, so the copy shares nothing
+  // mutable with the original. Natives, tasks and channels are shared
+  // instead: they're safe to use from any thread. Scopes, instances, arrays
+  // and maps are filled in from a work list rather than recursively, so long
+  // chains of objects don't exhaust the stack.
+  class DeepCopier {
+  private:
+    std::unordered_map<void const *, std::shared_ptr<void>> copies;
+    std::vector<std::pair<Environment const *, Environment *>> environments;
+    std::vector<std::pair<LoxInstance const *, LoxInstance *>> instances;
+    std::vector<std::pair<LoxArray const *, LoxArray *>> arrays;
+    std::vector<std::pair<LoxMap const *, LoxMap *>> maps;
+
+    template <typename Object>
+    auto copied(std::shared_ptr<Object> const &original)
+        -> std::shared_ptr<Object> {
+      if (auto found = copies.find(original.get()); found != copies.end()) {
+        return std::static_pointer_cast<Object>(found->second);
+      }
+      return nullptr;
+    }
+
+    auto copy(std::shared_ptr<Environment> const &original)
+        -> std::shared_ptr<Environment> {
+      if (original == nullptr) {
+        return nullptr;
+      }
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto environment =
+          std::make_shared<Environment>(copy(original->enclosing));
+      copies.emplace(original.get(), environment);
+      environments.emplace_back(original.get(), environment.get());
+      return environment;
+    }
+
+    auto copy(std::shared_ptr<LoxFunction> const &original)
+        -> std::shared_ptr<LoxFunction> {
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto function = std::make_shared<LoxFunction>(
+          original->declaration, copy(original->closure),
+          original->isInitializer);
+      copies.emplace(original.get(), function);
+      return function;
+    }
+
+    auto copy(std::shared_ptr<LoxClass> const &original)
+        -> std::shared_ptr<LoxClass> {
+      if (original == nullptr) {
+        return nullptr;
+      }
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto methods =
+          std::unordered_map<std::string, std::shared_ptr<LoxFunction>>{};
+      for (auto const &[name, method] : original->methods) {
+        methods.emplace(name, copy(method));
+      }
+      auto klass = std::make_shared<LoxClass>(
+          original->name, copy(original->superclass), std::move(methods));
+      copies.emplace(original.get(), klass);
+      return klass;
+    }
+
+    // A generator mid-way through its body gets copies of its frames' scopes
+    auto copy(std::shared_ptr<LoxGenerator> const &original)
+        -> std::shared_ptr<LoxGenerator> {
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto frames = original->frames;
+      for (auto &frame : frames) {
+        frame.environment = copy(frame.environment);
+      }
+      auto generator =
+          std::make_shared<LoxGenerator>(original->name, std::move(frames));
+      copies.emplace(original.get(), generator);
+      return generator;
+    }
+
+    auto copy(std::shared_ptr<LoxInstance> const &original)
+        -> std::shared_ptr<LoxInstance> {
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto instance = std::make_shared<LoxInstance>(copy(original->klass));
+      copies.emplace(original.get(), instance);
+      instances.emplace_back(original.get(), instance.get());
+      return instance;
+    }
+
+    // Unboxed numbers are copied outright
+    auto copy(std::shared_ptr<LoxArray> const &original)
+        -> std::shared_ptr<LoxArray> {
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto const *numbers =
+          std::get_if<std::vector<double>>(&original->elements);
+      auto array = numbers != nullptr ? std::make_shared<LoxArray>(*numbers)
+                                      : std::make_shared<LoxArray>();
+      copies.emplace(original.get(), array);
+      if (numbers == nullptr) {
+        arrays.emplace_back(original.get(), array.get());
+      }
+      return array;
+    }
+
+    auto copy(std::shared_ptr<LoxMap> const &original)
+        -> std::shared_ptr<LoxMap> {
+      if (auto existing = copied(original)) {
+        return existing;
+      }
+
+      auto map = std::make_shared<LoxMap>();
+      copies.emplace(original.get(), map);
+      maps.emplace_back(original.get(), map.get());
+      return map;
+    }
+
+    auto copy(LiteralVal const &value) -> LiteralVal {
+      if (auto const *callable =
+              std::get_if<std::shared_ptr<LoxCallable>>(&value)) {
+        if (auto function = std::dynamic_pointer_cast<LoxFunction>(*callable)) {
+          return std::static_pointer_cast<LoxCallable>(copy(function));
+        }
+        if (auto klass = std::dynamic_pointer_cast<LoxClass>(*callable)) {
+          return std::static_pointer_cast<LoxCallable>(copy(klass));
+        }
+        if (auto generator =
+                std::dynamic_pointer_cast<LoxGenerator>(*callable)) {
+          return std::static_pointer_cast<LoxCallable>(copy(generator));
+        }
+        return value;
+      }
+
+      if (auto const *instance =
+              std::get_if<std::shared_ptr<LoxInstance>>(&value)) {
+        return copy(*instance);
+      }
+
+      if (auto const *array = std::get_if<std::shared_ptr<LoxArray>>(&value)) {
+        return copy(*array);
+      }
+
+      if (auto const *map = std::get_if<std::shared_ptr<LoxMap>>(&value)) {
+        return copy(*map);
+      }
+
+      return value;
+    }
+
+    auto fillIn() -> void {
+      while (!environments.empty() || !instances.empty() ||
+             !arrays.empty() || !maps.empty()) {
+        while (!environments.empty()) {
+          auto [original, environment] = environments.back();
+          environments.pop_back();
+          original->forEach(
+              [&](std::string const &name, LiteralVal const &value) {
+                environment->define(name, copy(value));
+              });
+        }
+
+        // Replaying the fields in slot order walks the copied class's shape
+        // tree the same way the original instance did
+        while (!instances.empty()) {
+          auto [original, instance] = instances.back();
+          instances.pop_back();
+          auto const names = original->shape->fieldNames();
+          for (std::size_t slot = 0; slot < names.size(); slot++) {
+            auto cache = InlineCache{};
+            instance->set(names[slot], copy(original->fields[slot]), cache);
+          }
+        }
+
+        while (!arrays.empty()) {
+          auto [original, array] = arrays.back();
+          arrays.pop_back();
+          auto values = std::vector<LiteralVal>{};
+          for (auto const &value :
+               std::get<std::vector<LiteralVal>>(original->elements)) {
+            values.push_back(copy(value));
+          }
+          array->elements = std::move(values);
+        }
+
+        // Keys that are objects are copies too, so they hash differently
+        while (!maps.empty()) {
+          auto [original, map] = maps.back();
+          maps.pop_back();
+          original->forEach(
+              [&](LiteralVal const &key, LiteralVal const &value) {
+                map->set(copy(key), copy(value));
+              });
+        }
+      }
+    }
+
+  public:
+    static auto copyOf(LiteralVal const &value) -> LiteralVal {
+      auto copier = DeepCopier{};
+      auto result = copier.copy(value);
+      copier.fillIn();
+      return result;
+    }
+  };
+
+  // Spawned tasks not yet finished, across a run and every task it spawned.
+  // The run waits for all of them before its program can be freed.
+  class TaskGroup {
+  private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t running = 0;
+
+  public:
+    auto started() -> void {
+      auto lock = std::lock_guard{mutex};
+      running++;
+    }
+
+    auto finished() -> void {
+      {
+        auto lock = std::lock_guard{mutex};
+        running--;
+      }
+      changed.notify_all();
+    }
+
+    auto wait() -> void {
+      helpUntil(mutex, changed, [this] { return running == 0; });
+    }
+  };
+
+  // Handle to a spawned function. Calling it waits for the function to
+  // return and gives back a copy of its result, after printing whatever the
+  // task printed; a runtime error in the task is raised in the caller.
+  class LoxTask : public LoxCallable {
+  private:
+    std::mutex mutex;
+    std::condition_variable done;
+    std::optional<Result<LiteralVal>> result;
+    std::string output;
+
+  public:
+    // Called on the worker once the function has returned
+    auto finish(Result<LiteralVal> value, std::string printed) -> void {
+      {
+        auto lock = std::lock_guard{mutex};
+        result.emplace(std::move(value));
+        output = std::move(printed);
+      }
+      done.notify_all();
+    }
+
+    [[nodiscard]] auto arity() const -> int override { return 0; }
+
+    // Defined in Interpreter.hpp, it needs the complete Interpreter
+    auto call(Interpreter &interpreter, std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return "<task>";
+    }
+  };
+
+  // Unbounded queue between tasks. `send` stores a deep copy of the value;
+  // calling the channel waits for the next value and hands it over.
+  class LoxChannel : public LoxCallable {
+  private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<LiteralVal> messages;
+
+  public:
+    auto send(LiteralVal const &value) -> void {
+      auto message = DeepCopier::copyOf(value);
+      {
+        auto lock = std::lock_guard{mutex};
+        messages.push_back(std::move(message));
+      }
+      available.notify_one();
+    }
+
+    [[nodiscard]] auto arity() const -> int override { return 0; }
+
+    // Defined in Interpreter.hpp, it needs the complete Interpreter
+    auto call(Interpreter &interpreter, std::span<LiteralVal const> arguments)
+        -> Result<LiteralVal> override;
+
+    [[nodiscard]] auto toString() const -> std::string override {
+      return "<channel>";
+    }
+  };
+} // namespace lox
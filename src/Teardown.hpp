@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <ranges>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Token.hpp"
+
+namespace lox {
+  // Destroys the values an object held without recursing once per level, so
+  // a long chain of objects each holding the next can't overflow the stack
+  // on its way out. A destructor hands its values to release(); those that
+  // are the last reference to an object go on a per-thread list, which the
+  // outermost release() empties one value at a time. A nested release(),
+  // from the destructor of an object being freed there, only adds to it.
+  class Teardown {
+  private:
+    static inline thread_local std::vector<LiteralVal> pending;
+    static inline thread_local bool draining = false;
+
+    static auto lastReference(LiteralVal const &value) -> bool {
+      return std::visit(
+          [](auto const &alternative) {
+            if constexpr (requires { alternative.use_count(); }) {
+              return alternative.use_count() == 1;
+            } else {
+              return false;
+            }
+          },
+          value);
+    }
+
+  public:
+    static auto release(std::ranges::range auto &&values) -> void {
+      for (LiteralVal &value : values) {
+        if (lastReference(value)) {
+          pending.push_back(std::move(value));
+        }
+      }
+      if (draining || pending.empty()) {
+        return;
+      }
+      draining = true;
+      while (!pending.empty()) {
+        auto value = std::move(pending.back());
+        pending.pop_back();
+      }
+      draining = false;
+    }
+  };
+} // namespace lox
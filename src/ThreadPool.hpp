@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace lox {
+  // Fixed set of workers, one task deque each. A worker takes from the back
+  // of its own deque and, when that is empty, steals from the front of the
+  // others, so uneven tasks (one long script among many short ones) still
+  // keep every core busy. Tasks submitted from a worker go on that worker's
+  // own deque; tasks from outside are dealt round-robin.
+  class WorkStealingPool {
+  public:
+    using Task = std::function<void()>;
+
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::jthread> workers;
+
+    // Counted without a lock; stateMutex only orders going to sleep on the
+    // condition variables against the wakeups meant for the sleeper
+    std::atomic<std::size_t> queued{0};     // Submitted, not yet taken
+    std::atomic<std::size_t> unfinished{0}; // Submitted, not yet finished
+    std::atomic<std::size_t> sleepers{0};   // Workers waiting for a task
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    bool stopping = false; // Under stateMutex
+    std::atomic<std::size_t> nextQueue{0};
+
+    // Index of the calling thread's own queue in the pool it works for
+    static auto inline thread_local currentPool =
+        static_cast<WorkStealingPool *>(nullptr);
+    static auto inline thread_local currentWorker = std::size_t{0};
+
+    auto take(std::size_t self) -> std::optional<Task> {
+      {
+        auto &own = *queues[self];
+        auto lock = std::lock_guard{own.mutex};
+        if (!own.tasks.empty()) {
+          auto task = std::move(own.tasks.back());
+          own.tasks.pop_back();
+          return task;
+        }
+      }
+
+      for (std::size_t offset = 1; offset < queues.size(); offset++) {
+        auto &victim = *queues[(self + offset) % queues.size()];
+        auto lock = std::lock_guard{victim.mutex};
+        if (!victim.tasks.empty()) {
+          auto task = std::move(victim.tasks.front());
+          victim.tasks.pop_front();
+          return task;
+        }
+      }
+
+      return std::nullopt;
+    }
+
+    // Claims one of the queued tasks for the caller, if there are any
+    auto reserve() -> bool {
+      auto count = queued.load();
+      while (count > 0) {
+        if (queued.compare_exchange_weak(count, count - 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Once the accounting has reserved a task for `self`, waits for it to
+    // show up (a racing thief may hold it for a moment) and runs it
+    auto runReserved(std::size_t self) -> void {
+      auto task = take(self);
+      while (!task) {
+        std::this_thread::yield();
+        task = take(self);
+      }
+
+      (*task)();
+
+      if (--unfinished == 0) {
+        // A waiter checks `unfinished` under the mutex before it sleeps
+        {
+          auto lock = std::lock_guard{stateMutex};
+        }
+        allDone.notify_all();
+      }
+    }
+
+    auto work(std::size_t self) -> void {
+      currentPool = this;
+      currentWorker = self;
+
+      while (true) {
+        if (reserve()) {
+          runReserved(self);
+          continue;
+        }
+
+        auto lock = std::unique_lock{stateMutex};
+        sleepers++;
+        workAvailable.wait(lock, [&] { return stopping || queued > 0; });
+        sleepers--;
+        if (stopping && queued == 0) {
+          return; // Stopping and drained
+        }
+      }
+    }
+
+  public:
+    explicit WorkStealingPool(
+        std::size_t threads = std::max(1U,
+                                       std::thread::hardware_concurrency())) {
+      for (std::size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Queue>());
+      }
+      for (std::size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this, i] { work(i); });
+      }
+    }
+
+    WorkStealingPool(WorkStealingPool const &) = delete;
+    auto operator=(WorkStealingPool const &) -> WorkStealingPool & = delete;
+
+    // Finishes every queued task before joining
+    ~WorkStealingPool() {
+      {
+        auto lock = std::lock_guard{stateMutex};
+        stopping = true;
+      }
+      workAvailable.notify_all();
+      workers.clear(); // Join while the state they use is still alive
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return workers.size(); }
+
+    auto submit(Task task) -> void {
+      auto const target = currentPool == this
+                              ? currentWorker
+                              : nextQueue++ % queues.size();
+      {
+        auto lock = std::lock_guard{queues[target]->mutex};
+        queues[target]->tasks.push_back(std::move(task));
+      }
+      unfinished++;
+      queued++;
+
+      // A worker going to sleep counts itself in `sleepers`, then checks
+      // `queued`, all under the mutex. Taking the mutex here means it has
+      // either seen the task or is waiting and gets the notify.
+      if (sleepers > 0) {
+        {
+          auto lock = std::lock_guard{stateMutex};
+        }
+        workAvailable.notify_one();
+      }
+    }
+
+    // Runs one queued task on the calling thread, if there is one, so a
+    // thread blocked on other tasks can help finish them instead of idling.
+    // Returns whether it ran anything.
+    auto runOne() -> bool {
+      if (!reserve()) {
+        return false;
+      }
+
+      runReserved(currentPool == this ? currentWorker : 0);
+      return true;
+    }
+
+    // Blocks until every task submitted so far, and any they submitted, has
+    // finished. Not for use from inside a task.
+    auto wait() -> void {
+      auto lock = std::unique_lock{stateMutex};
+      allDone.wait(lock, [&] { return unfinished == 0; });
+    }
+  };
+} // namespace lox
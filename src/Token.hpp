@@ -1,12 +1,15 @@
 #pragma once
 
 #include <any>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
 
-#include "Expr.hpp"
-
 // helper type for the visitor #4
 template <class... Ts> struct overloaded : Ts... {
   using Ts::operator()...;
@@ -15,7 +18,38 @@ template <class... Ts> struct overloaded : Ts... {
 template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
 namespace lox {
-  using LiteralVal = std::variant<std::monostate, std::string, bool, double>;
+  class LoxArray;
+  class LoxCallable;
+  class LoxInstance;
+  class LoxMap;
+
+  using LiteralVal =
+      std::variant<std::monostate, std::string, bool, double,
+                   std::shared_ptr<LoxCallable>, std::shared_ptr<LoxInstance>,
+                   std::shared_ptr<LoxArray>, std::shared_ptr<LoxMap>>;
+
+  // Defined alongside the runtime object types (LoxCallable.hpp,
+  // LoxInstance.hpp, LoxArray.hpp, LoxMap.hpp)
+  [[nodiscard]] inline auto to_string(LoxCallable const &callable)
+      -> std::string;
+  [[nodiscard]] inline auto to_string(LoxInstance const &instance)
+      -> std::string;
+  [[nodiscard]] inline auto to_string(LoxArray const &array) -> std::string;
+  [[nodiscard]] inline auto to_string(LoxMap const &map) -> std::string;
+
+  // Whole numbers print without a fraction or exponent ("100000"), anything
+  // else in the shortest form that reads back as the same double ("0.1")
+  inline auto formatNumber(double value, std::array<char, 32> &buffer)
+      -> std::string_view {
+    auto [end, error] =
+        std::trunc(value) == value && std::abs(value) < 1e15
+            ? std::to_chars(buffer.begin(), buffer.end(), value,
+                            std::chars_format::fixed)
+            : std::to_chars(buffer.begin(), buffer.end(), value);
+
+    return {buffer.data(), end};
+  }
+
   [[nodiscard]] static auto to_string(LiteralVal const &literal)
       -> std::string {
     using namespace std::string_literals;
@@ -23,7 +57,22 @@ namespace lox {
         overloaded{[](std::monostate const &arg) { return "nil"s; },
                    [](std::string const &arg) { return arg; },
                    [](bool const &arg) { return arg ? "true"s : "false"s; },
-                   [](double const &arg) { return std::to_string(arg); }},
+                   [](double const &arg) {
+                     auto buffer = std::array<char, 32>{};
+                     return std::string{formatNumber(arg, buffer)};
+                   },
+                   [](std::shared_ptr<LoxCallable> const &arg) {
+                     return to_string(*arg);
+                   },
+                   [](std::shared_ptr<LoxInstance> const &arg) {
+                     return to_string(*arg);
+                   },
+                   [](std::shared_ptr<LoxArray> const &arg) {
+                     return to_string(*arg);
+                   },
+                   [](std::shared_ptr<LoxMap> const &arg) {
+                     return to_string(*arg);
+                   }},
         literal);
   }
 
@@ -33,6 +82,8 @@ namespace lox {
     RIGHT_PAREN,
     LEFT_BRACE,
     RIGHT_BRACE,
+    LEFT_BRACKET,
+    RIGHT_BRACKET,
     COMMA,
     DOT,
     MINUS,
@@ -64,6 +115,7 @@ namespace lox {
     FUN,
     FOR,
     IF,
+    IMPORT,
     NIL,
     OR,
     PRINT,
@@ -73,6 +125,7 @@ namespace lox {
     TRUE,
     VAR,
     WHILE,
+    YIELD,
 
     END_OF_FILE
   };
@@ -116,6 +169,12 @@ namespace lox {
         case TokenType::RIGHT_BRACE:
           typeString = "RIGHT_BRACE";
           break;
+        case TokenType::LEFT_BRACKET:
+          typeString = "LEFT_BRACKET";
+          break;
+        case TokenType::RIGHT_BRACKET:
+          typeString = "RIGHT_BRACKET";
+          break;
         case TokenType::COMMA:
           typeString = "COMMA";
           break;
@@ -218,6 +277,12 @@ namespace lox {
         case TokenType::WHILE:
           typeString = "WHILE";
           break;
+        case TokenType::IMPORT:
+          typeString = "IMPORT";
+          break;
+        case TokenType::YIELD:
+          typeString = "YIELD";
+          break;
         case TokenType::END_OF_FILE:
           typeString = "END_OF_FILE";
           break;
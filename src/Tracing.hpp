@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include "Expr.hpp"
+#include "Policy.hpp"
+#include "Profiler.hpp"
+#include "Report.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // The name of a node's type, for trace events
+  struct NodeName {
+    /* #region Expr */
+    auto operator()(expr::Array const &) const { return "Array"; }
+    auto operator()(expr::Assign const &) const { return "Assign"; }
+    auto operator()(expr::Binary const &) const { return "Binary"; }
+    auto operator()(expr::Call const &) const { return "Call"; }
+    auto operator()(expr::Get const &) const { return "Get"; }
+    auto operator()(expr::Grouping const &) const { return "Grouping"; }
+    auto operator()(expr::Index const &) const { return "Index"; }
+    auto operator()(expr::Literal const &) const { return "Literal"; }
+    auto operator()(expr::Logical const &) const { return "Logical"; }
+    auto operator()(expr::Set const &) const { return "Set"; }
+    auto operator()(expr::SetIndex const &) const { return "SetIndex"; }
+    auto operator()(expr::Super const &) const { return "Super"; }
+    auto operator()(expr::This const &) const { return "This"; }
+    auto operator()(expr::Unary const &) const { return "Unary"; }
+    auto operator()(expr::Variable const &) const { return "Variable"; }
+    /* #endregion */
+
+    /* #region Stmt */
+    auto operator()(stmt::Print const &) const { return "Print"; }
+    auto operator()(stmt::Expression const &) const { return "Expression"; }
+    auto operator()(stmt::Var const &) const { return "Var"; }
+    auto operator()(stmt::Block const &) const { return "Block"; }
+    auto operator()(stmt::If const &) const { return "If"; }
+    auto operator()(stmt::While const &) const { return "While"; }
+    auto operator()(stmt::Function const &) const { return "Function"; }
+    auto operator()(stmt::Return const &) const { return "Return"; }
+    auto operator()(stmt::Class const &) const { return "Class"; }
+    auto operator()(stmt::Yield const &) const { return "Yield"; }
+    auto operator()(stmt::Import const &) const { return "Import"; }
+    /* #endregion */
+  };
+
+  // Hooks BasicInterpreter calls around every node it visits, on every
+  // variable it reads or writes, on every failed operand type check, and
+  // at the shortcuts it takes on the strength of Resolver and
+  // TypeInference. Each call sits behind `if constexpr (Policy::ENABLED)`,
+  // so with NoTrace none of them, nor their arguments, are compiled in.
+  //
+  // Every hook here does nothing; a policy hides the ones it uses.
+  struct Hooks {
+    static constexpr bool ENABLED = true;
+
+    static auto enter(expr::Expr const & /*node*/) -> void {}
+    static auto enter(stmt::Stmt const & /*node*/) -> void {}
+    static auto exit(expr::Expr const & /*node*/, bool /*failed*/) -> void {}
+    static auto exit(stmt::Stmt const & /*node*/, bool /*failed*/) -> void {}
+    static auto read(Token const & /*name*/, LiteralVal const & /*value*/)
+        -> void {}
+    static auto write(Token const & /*name*/, LiteralVal const & /*value*/)
+        -> void {}
+    static auto typeError(ReportError const & /*error*/) -> void {}
+    // `holds` is what the shortcut at `at` assumes
+    static auto verify(bool /*holds*/, Token const & /*at*/,
+                       char const * /*assumption*/) -> void {}
+  };
+
+  // The production build: no hooks
+  struct NoTrace : Hooks {
+    static constexpr bool ENABLED = false;
+  };
+
+  // Writes every hook as an event to a log, one JSON object per line, e.g.
+  // {"event":"enter","node":"Binary","line":3,"depth":2}. Events from
+  // tasks on other threads are interleaved line by line.
+  struct Trace : Hooks {
+  private:
+    static inline std::mutex mutex;
+    static inline std::ostream *log = &std::clog;
+    static inline thread_local int depth = 0;
+
+    static auto quoted(std::ostream &out, std::string_view text) -> void {
+      out << '"';
+      for (auto const c : text) {
+        if (c == '"' || c == '\\') {
+          out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          auto escape = std::array<char, 8>{};
+          std::snprintf(escape.data(), escape.size(), "\\u%04x", c);
+          out << escape.data();
+        } else {
+          out << c;
+        }
+      }
+      out << '"';
+    }
+
+    template <typename Node>
+    static auto node(char const *event, Node const &node, int depth,
+                     std::string_view rest) -> void {
+      auto const line = [&] {
+        if constexpr (std::is_same_v<Node, expr::Expr>) {
+          return std::visit(LineFinder{}, node).line;
+        } else {
+          return std::visit(LineFinder{}, node);
+        }
+      }();
+      auto lock = std::lock_guard{mutex};
+      *log << R"({"event":")" << event << R"(","node":")"
+           << std::visit(NodeName{}, node) << R"(","line":)" << line
+           << R"(,"depth":)" << depth << rest;
+    }
+
+    static auto variable(char const *event, Token const &name,
+                         LiteralVal const &value) -> void {
+      auto lock = std::lock_guard{mutex};
+      *log << R"({"event":")" << event << R"(","name":)";
+      quoted(*log, name.lexeme);
+      *log << R"(,"line":)" << name.line << R"(,"value":)";
+      quoted(*log, to_string(value));
+      *log << "}\n";
+    }
+
+  public:
+    // Where events go; stderr until set. It must outlive the runs traced.
+    static auto setLog(std::ostream &out) -> void {
+      auto lock = std::lock_guard{mutex};
+      log = &out;
+    }
+
+    static auto enter(auto const &visited) -> void {
+      node("enter", visited, depth++, "}\n");
+    }
+
+    static auto exit(auto const &visited, bool failed) -> void {
+      node("exit", visited, --depth,
+           failed ? R"(,"failed":true})" "\n" : R"(,"failed":false})" "\n");
+    }
+
+    static auto read(Token const &name, LiteralVal const &value) -> void {
+      variable("read", name, value);
+    }
+
+    static auto write(Token const &name, LiteralVal const &value) -> void {
+      variable("write", name, value);
+    }
+
+    static auto typeError(ReportError const &error) -> void {
+      auto lock = std::lock_guard{mutex};
+      *log << R"({"event":"type_error","line":)" << error.line.value_or(0)
+           << R"(,"message":)";
+      quoted(*log, error.message);
+      *log << "}\n";
+    }
+  };
+
+  // Aborts as soon as a shortcut's assumption doesn't hold: a global slot
+  // cached on a node that isn't the variable's, or a value TypeInference
+  // proved is a number that isn't one. For testing the analyses.
+  struct Checked : Hooks {
+    static auto verify(bool holds, Token const &at, char const *assumption)
+        -> void {
+      if (!holds) [[unlikely]] {
+        std::cerr << "[line " << at.line << "] Interpreter check failed at '"
+                  << at.lexeme << "': " << assumption << '\n';
+        std::abort();
+      }
+    }
+  };
+} // namespace lox
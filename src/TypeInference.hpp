@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Token.hpp"
+
+namespace lox {
+  // Finds the arithmetic whose operands are sure to be numbers and marks it
+  // (Binary::numberOperands, Unary::numberOperand), so the interpreter can
+  // evaluate it as plain doubles without checking types. The analysis
+  // follows the program's control flow: a variable is a number from an
+  // assignment of a number until something may assign it anything else.
+  // Where paths meet, after an if or around a loop, a variable is only a
+  // number if it is one along every path.
+  //
+  // Each function body is analyzed on its own, knowing nothing of the
+  // variables it closes over, since it may run long after they've changed.
+  // A call, or a yield handing control back to the caller, may run code
+  // that assigns the globals (a function from a prelude or an earlier
+  // Session submission, say) or a local some nested function assigns, so it
+  // forgets what was known about those.
+  class TypeInference {
+  private:
+    // Every variable declared in one scope, and whether it's sure to hold
+    // a number. Declared ones that aren't still hide outer variables.
+    using Scope = std::unordered_map<std::string_view, bool>;
+    // The scopes being analyzed, innermost last
+    using Facts = std::vector<Scope>;
+
+    Facts facts;
+    // Whether facts[0] is the global scope rather than a function's
+    bool const global;
+    // Variables some function nested in the one being analyzed assigns
+    std::unordered_set<std::string_view> const captured;
+    // The facts each loop's condition was last analyzed under. A loop
+    // analyzed again, inside an outer loop that hasn't settled, starts from
+    // here instead of from scratch.
+    std::unordered_map<stmt::While const *, Facts> loops;
+
+    TypeInference(bool global, std::ranges::forward_range auto &&body)
+        : facts(1), global{global}, captured{assignedByFunctionsIn(body)} {}
+
+    static auto assignedByFunctionsIn(std::ranges::forward_range auto &&body)
+        -> std::unordered_set<std::string_view> {
+      auto names = std::unordered_set<std::string_view>{};
+      for (std::unique_ptr<stmt::Stmt> const &stmt : body) {
+        collectAssigned(*stmt, false, names);
+      }
+      return names;
+    }
+
+    // Adds the variables `stmt` assigns inside functions to `names`, or
+    // all it assigns if it is itself inside one
+    static auto collectAssigned(stmt::Stmt const &stmt, bool inFunction,
+                                std::unordered_set<std::string_view> &names)
+        -> void {
+      auto const expression = [&](std::unique_ptr<expr::Expr> const &root) {
+        if (!inFunction || root == nullptr) {
+          return;
+        }
+        auto pending = std::vector<expr::Expr const *>{root.get()};
+        while (!pending.empty()) {
+          auto const *node = pending.back();
+          pending.pop_back();
+          if (auto const *assign = std::get_if<expr::Assign>(node)) {
+            names.insert(assign->name.lexeme);
+          }
+          expr::forEachChild(
+              *node, [&](std::unique_ptr<expr::Expr> const &child) {
+                pending.push_back(child.get());
+              });
+        }
+      };
+      auto const statements =
+          [&](std::span<std::unique_ptr<stmt::Stmt> const> body,
+              bool inBody) {
+            for (auto const &child : body) {
+              collectAssigned(*child, inBody, names);
+            }
+          };
+
+      std::visit(
+          overloaded{
+              [&](stmt::Print const &print) { expression(print.expression); },
+              [&](stmt::Expression const &statement) {
+                expression(statement.expression);
+              },
+              [&](stmt::Var const &var) { expression(var.initializer); },
+              [&](stmt::Block const &block) {
+                statements(block.statements, inFunction);
+              },
+              [&](stmt::If const &branch) {
+                expression(branch.condition);
+                collectAssigned(*branch.thenBranch, inFunction, names);
+                if (branch.elseBranch) {
+                  collectAssigned(*branch.elseBranch, inFunction, names);
+                }
+              },
+              [&](stmt::While const &loop) {
+                expression(loop.condition);
+                collectAssigned(*loop.body, inFunction, names);
+              },
+              [&](stmt::Function const &function) {
+                statements(function.body, true);
+              },
+              [&](stmt::Return const &ret) { expression(ret.value); },
+              [&](stmt::Class const &klass) {
+                expression(klass.superclass);
+                for (auto const &method : klass.methods) {
+                  collectAssigned(*method, true, names);
+                }
+              },
+              [&](stmt::Yield const &yield) { expression(yield.value); },
+              [](stmt::Import const & /*import*/) {},
+          },
+          stmt);
+    }
+
+    // Where the two paths meet
+    static auto merge(Facts const &a, Facts const &b) -> Facts {
+      auto merged = a;
+      for (std::size_t i = 0; i < merged.size(); i++) {
+        for (auto &[name, number] : merged[i]) {
+          auto const other = b[i].find(name);
+          number = number && other != b[i].end() && other->second;
+        }
+        for (auto const &entry : b[i]) {
+          merged[i].try_emplace(entry.first, false);
+        }
+      }
+      return merged;
+    }
+
+    [[nodiscard]] auto isNumber(Token const &name) const -> bool {
+      for (auto scope = facts.rbegin(); scope != facts.rend(); ++scope) {
+        if (auto found = scope->find(name.lexeme); found != scope->end()) {
+          return found->second;
+        }
+      }
+      return false;
+    }
+
+    auto assign(Token const &name, bool number) -> void {
+      for (auto scope = facts.rbegin(); scope != facts.rend(); ++scope) {
+        if (auto found = scope->find(name.lexeme); found != scope->end()) {
+          found->second = number;
+          return;
+        }
+      }
+    }
+
+    auto declare(Token const &name, bool number) -> void {
+      facts.back()[name.lexeme] = number;
+    }
+
+    // Other code may have run: forget what it could have changed
+    auto forgetAssignable() -> void {
+      for (std::size_t i = 0; i < facts.size(); i++) {
+        for (auto &[name, number] : facts[i]) {
+          if ((global && i == 0) || captured.contains(name)) {
+            number = false;
+          }
+        }
+      }
+    }
+
+    static auto function(stmt::Function const &declaration) -> void {
+      auto inference = TypeInference{false, declaration.body};
+      for (auto const &param : declaration.params) {
+        inference.declare(param, false);
+      }
+      inference.statements(declaration.body);
+    }
+
+    auto statements(std::span<std::unique_ptr<stmt::Stmt> const> body)
+        -> void {
+      for (auto const &stmt : body) {
+        execute(*stmt);
+      }
+    }
+
+    auto execute(stmt::Stmt const &stmt) -> void {
+      std::visit([this](auto const &node) { (*this)(node); }, stmt);
+    }
+
+    // Whether `root` evaluates to a number that evaluateNumber() can
+    // compute: a number literal, a variable holding one, or arithmetic on
+    // those. Walks the tree from a work list, like evaluateDeep(), taking a
+    // step per child in the order the interpreter evaluates them.
+    auto expression(expr::Expr const &root) -> bool {
+      struct Pending {
+        expr::Expr const *expr;
+        std::size_t step = 0;
+        std::size_t children = 0;
+      };
+      auto pending = std::vector<Pending>{{&root}};
+      auto numbers = std::vector<bool>{};
+      auto beforeRight = std::vector<Facts>{}; // One per Logical underway
+
+      while (!pending.empty()) {
+        auto const index = pending.size() - 1;
+        auto const &node = *pending[index].expr;
+        auto const step = pending[index].step++;
+
+        if (auto const *logical = std::get_if<expr::Logical>(&node)) {
+          // The right operand may not run at all
+          if (step == 0) {
+            pending.push_back({logical->left.get()});
+          } else if (step == 1) {
+            numbers.pop_back();
+            beforeRight.push_back(facts);
+            pending.push_back({logical->right.get()});
+          } else {
+            numbers.back() = false;
+            facts = merge(beforeRight.back(), facts);
+            beforeRight.pop_back();
+            pending.pop_back();
+          }
+          continue;
+        }
+
+        if (step == 0) {
+          expr::forEachChild(
+              node, [&](std::unique_ptr<expr::Expr> const &child) {
+                pending.push_back({child.get()});
+              });
+          auto const children = pending.size() - index - 1;
+          pending[index].children = children;
+          // Last pushed runs first, so reverse them to go left to right
+          std::ranges::reverse(pending | std::views::drop(index + 1));
+          if (children > 0) {
+            continue;
+          }
+        }
+
+        auto const children = pending[index].children;
+        auto const first = numbers.size() - children;
+        auto const number =
+            visitNode(node, children > 0 && numbers[first],
+                      children > 1 && numbers[first + 1]);
+        numbers.resize(first);
+        numbers.push_back(number);
+        pending.pop_back();
+      }
+
+      return numbers.back();
+    }
+
+    // `first` and `second` are whether the node's first two children are
+    // numbers; no node that can be one has more
+    auto visitNode(expr::Expr const &node, bool first, bool second) -> bool {
+      switch (node.index()) {
+        case variant_index_v<expr::Expr, expr::Literal>:
+          return std::holds_alternative<double>(
+              std::get_if<expr::Literal>(&node)->value);
+
+        case variant_index_v<expr::Expr, expr::Variable>:
+          return isNumber(std::get_if<expr::Variable>(&node)->name);
+
+        case variant_index_v<expr::Expr, expr::Grouping>:
+          return first;
+
+        case variant_index_v<expr::Expr, expr::Assign>:
+          assign(std::get_if<expr::Assign>(&node)->name, first);
+          return false; // Assigning can fail, which evaluateNumber() can't
+
+        case variant_index_v<expr::Expr, expr::Unary>: {
+          auto const &unary = *std::get_if<expr::Unary>(&node);
+          unary.numberOperand = first;
+          return first && unary.op.type == TokenType::MINUS;
+        }
+
+        case variant_index_v<expr::Expr, expr::Binary>: {
+          auto const &binary = *std::get_if<expr::Binary>(&node);
+          binary.numberOperands = first && second;
+          switch (binary.op.type) {
+            case TokenType::PLUS:
+            case TokenType::MINUS:
+            case TokenType::STAR:
+            case TokenType::SLASH:
+              return binary.numberOperands;
+            default:
+              return false;
+          }
+        }
+
+        case variant_index_v<expr::Expr, expr::Call>:
+          forgetAssignable();
+          return false;
+
+        default:
+          return false;
+      }
+    }
+
+    /* #region Stmt */
+    VISIT_STMT(stmt::Expression) { expression(*stmt.expression); }
+    VISIT_STMT(stmt::Print) { expression(*stmt.expression); }
+    VISIT_STMT(stmt::Var) {
+      auto const number = stmt.initializer && expression(*stmt.initializer);
+      declare(stmt.name, number);
+    }
+    VISIT_STMT(stmt::Block) {
+      facts.emplace_back();
+      statements(stmt.statements);
+      facts.pop_back();
+    }
+    VISIT_STMT(stmt::If) {
+      expression(*stmt.condition);
+      auto const beforeBranches = facts;
+      execute(*stmt.thenBranch);
+      auto const afterThen = std::exchange(facts, beforeBranches);
+      if (stmt.elseBranch) {
+        execute(*stmt.elseBranch);
+      }
+      facts = merge(afterThen, facts);
+    }
+    // The condition is analyzed under what holds both on entry and after
+    // the body, which needs what holds after the body: starting from the
+    // entry, analyze the body and merge until nothing changes. Facts only
+    // ever weaken, so that ends, and the last pass marked the nodes under
+    // the settled facts.
+    VISIT_STMT(stmt::While) {
+      auto const entry = facts;
+      auto const previous = loops.find(&stmt);
+      auto head =
+          previous != loops.end() ? merge(previous->second, entry) : entry;
+
+      while (true) {
+        facts = head;
+        expression(*stmt.condition);
+        auto const exit = facts;
+        execute(*stmt.body);
+
+        auto next = merge(entry, facts);
+        if (next == head) {
+          facts = exit;
+          break;
+        }
+        head = std::move(next);
+      }
+
+      loops.insert_or_assign(&stmt, std::move(head));
+    }
+    VISIT_STMT(stmt::Function) {
+      declare(stmt.name, false);
+      function(stmt);
+    }
+    VISIT_STMT(stmt::Return) {
+      if (stmt.value) {
+        expression(*stmt.value);
+      }
+    }
+    VISIT_STMT(stmt::Class) {
+      if (stmt.superclass) {
+        expression(*stmt.superclass);
+      }
+      declare(stmt.name, false);
+      for (auto const &method : stmt.methods) {
+        function(std::get<stmt::Function>(*method));
+      }
+    }
+    VISIT_STMT(stmt::Yield) {
+      if (stmt.value) {
+        expression(*stmt.value);
+      }
+      forgetAssignable(); // The caller runs until the generator resumes
+    }
+    auto operator()(stmt::Import const & /*stmt*/) -> void {
+      forgetAssignable(); // The module may assign any global
+    }
+    /* #endregion */
+
+  public:
+    // Marks a program's nodes. Marking the same program again marks it the
+    // same way.
+    static auto annotate(std::ranges::forward_range auto &&program) -> void {
+      auto inference = TypeInference{true, program};
+      for (std::unique_ptr<stmt::Stmt> const &stmt : program) {
+        inference.execute(*stmt);
+      }
+    }
+  };
+} // namespace lox
@@ -1,15 +1,30 @@
+#include "AstCache.hpp"
 #include "Lox.hpp"
-#include "Token.hpp"
+#include "Profiler.hpp"
+#include "Snapshot.hpp"
+#include "Stats.hpp"
+#include "Syntax.hpp"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
-auto main(int argc, char **argv) -> int {
-  lox::Lox::run("(print 1 + 3 * (4 + 8); print \"yuhh\"; print true;)");
-  std::cout << "\n\n--------------------------\n";
-  lox::Lox::run(R"(var a = 1; print a;)");
-  std::cout << "\n\n--------------------------\n";
-  lox::Lox::run(R"(var a = "global a";
+namespace {
+  // Run by --demo. A syntax error in any of them fails the build.
+  constexpr auto DEMOS = std::to_array<std::string_view>({
+      R"(print 1 + 3 * (4 + 8); print "yuhh"; print true;)",
+      R"(var a = 1; print a;)",
+      R"(var a = "global a";
 var b = "global b";
 var c = "global c";
 {
@@ -28,18 +43,190 @@ var c = "global c";
 print a;
 print b;
 print c;
-)");
-  std::cout << "\n\n--------------------------\n";
-  lox::Lox::run(R"(print "hi" or 2; print nil or "yes"; print nil)");
-
-  // if (argc > 2) {
-  //   std::cout << "Usage: cpp_lox [script]\n";
-  //   return 64;
-  // } else if (argc == 2) {
-  //   lox::Lox::runFile(argv[1]);
-  // } else {
-  //   lox::Lox::runPrompt();
-  // }
-
-  return 0;
+)",
+      R"(print "hi" or 2; print nil or "yes"; print nil;)",
+  });
+
+  static_assert(std::ranges::all_of(DEMOS, lox::SyntaxCheck::valid));
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  auto const args = std::vector<std::string_view>(argv + 1, argv + argc);
+  auto scripts = std::vector<std::string>{};
+  auto batch = false;
+  auto demo = false;
+  auto badArgument = false;
+  auto jobs = std::size_t{std::max(1U, std::thread::hardware_concurrency())};
+  auto printStats = false;
+  auto statsJson = std::optional<std::string>{};
+  auto printProfile = false;
+  auto profileOut = std::optional<std::string>{};
+  auto useCache = false;
+  auto memoize = false;
+  auto limits = lox::RunLimits{};
+  auto cacheDir = lox::AstCache::defaultDirectory();
+  auto preludePath = std::optional<std::string>{};
+  auto snapshotIn = std::optional<std::string>{};
+  auto snapshotOut = std::optional<std::string>{};
+
+  for (std::size_t i = 0; i < args.size(); i++) {
+    if (args[i] == "--stats") {
+      printStats = true;
+    } else if (args[i] == "--stats-json" && i + 1 < args.size()) {
+      statsJson = args[++i];
+    } else if (args[i] == "--profile") {
+      printProfile = true;
+    } else if (args[i] == "--profile-out" && i + 1 < args.size()) {
+      profileOut = args[++i];
+    } else if (args[i] == "--memoize") {
+      memoize = true;
+    } else if (args[i].starts_with("--max-") && i + 1 < args.size()) {
+      auto const option = args[i];
+      auto const value = args[++i];
+      auto number = std::uint64_t{};
+      if (std::from_chars(value.begin(), value.end(), number).ec !=
+          std::errc{}) {
+        badArgument = true;
+      } else if (option == "--max-steps") {
+        limits.steps = number;
+      } else if (option == "--max-time") {
+        limits.time = std::chrono::milliseconds{number};
+      } else if (option == "--max-heap") {
+        limits.heapBytes = number;
+      } else if (option == "--max-output") {
+        limits.outputBytes = number;
+      } else {
+        badArgument = true;
+      }
+    } else if (args[i] == "--cache") {
+      useCache = true;
+    } else if (args[i] == "--no-cache") {
+      useCache = false;
+    } else if (args[i] == "--cache-dir" && i + 1 < args.size()) {
+      useCache = true;
+      cacheDir = args[++i];
+    } else if (args[i] == "--prelude" && i + 1 < args.size()) {
+      preludePath = args[++i];
+    } else if (args[i] == "--snapshot" && i + 1 < args.size()) {
+      snapshotIn = args[++i];
+    } else if (args[i] == "--save-snapshot" && i + 1 < args.size()) {
+      snapshotOut = args[++i];
+    } else if (args[i] == "--demo") {
+      demo = true;
+    } else if (args[i] == "--batch") {
+      batch = true;
+    } else if (args[i] == "--jobs" && i + 1 < args.size()) {
+      auto const count = args[++i];
+      if (std::from_chars(count.begin(), count.end(), jobs).ec != std::errc{}) {
+        jobs = 0;
+      }
+    } else if (!args[i].starts_with("--")) {
+      scripts.emplace_back(args[i]);
+    } else {
+      badArgument = true;
+    }
+  }
+
+  // Scripts in a batch share nothing, so they can't build on a prelude
+  if (badArgument || jobs == 0 || (scripts.size() > 1 && !batch) ||
+      (batch && (scripts.empty() || preludePath || snapshotIn))) {
+    std::cout << "Usage: cpp_lox [--stats] [--stats-json file] [--profile] "
+                 "[--profile-out file] [--memoize] [limits] [--cache] "
+                 "[--cache-dir dir] [--prelude file | --snapshot file] "
+                 "[--save-snapshot file] [script]\n"
+                 "       cpp_lox --batch [--jobs n] [limits] [--cache] "
+                 "[--cache-dir dir] script...\n"
+                 "Limits: [--max-steps n] [--max-time ms] [--max-heap bytes] "
+                 "[--max-output bytes]\n"
+                 "       cpp_lox --demo\n";
+    return 64;
+  }
+
+  if (demo) {
+    for (auto const source : DEMOS) {
+      lox::Lox::run(std::string{source});
+      std::cout << "\n--------------------------\n";
+    }
+    return 0;
+  }
+
+  // A prelude's globals carry over into the script. A snapshot restores
+  // them without running the prelude again.
+  auto prelude = std::optional<lox::Prelude>{};
+  if (snapshotIn) {
+    prelude = lox::Snapshot::load(*snapshotIn);
+    if (!prelude) {
+      std::cerr << "Could not load snapshot: " << *snapshotIn << '\n';
+      return 66;
+    }
+  } else if (preludePath) {
+    auto const source = lox::Lox::readFile(*preludePath);
+    prelude = source ? lox::Lox::runPrelude(*source, *preludePath)
+                     : std::nullopt;
+    if (!prelude) {
+      return 65;
+    }
+  }
+
+  if (snapshotOut) {
+    auto saved = prelude ? lox::Snapshot::save(*snapshotOut, *prelude)
+                         : lox::Result<void>{std::unexpect,
+                                             "There is no prelude to save."};
+    if (!saved) {
+      std::cerr << "Could not save snapshot: " << *snapshotOut << ": "
+                << saved.error().toString() << '\n';
+      return 74;
+    }
+  }
+
+  if (scripts.empty()) {
+    if (!snapshotOut) {
+      lox::Lox::runPrompt(std::move(prelude));
+    }
+    return 0;
+  }
+
+  auto cache = std::optional<lox::AstCache>{};
+  if (useCache && cacheDir) {
+    cache.emplace(*cacheDir);
+  }
+
+  if (batch) {
+    return lox::Lox::runBatch(scripts, jobs, cache ? &*cache : nullptr,
+                              limits)
+               ? 0
+               : 70;
+  }
+
+  auto stats = lox::RunStats{};
+  auto const wantStats = printStats || statsJson;
+  auto profiler = lox::Profiler{};
+  auto const wantProfile = printProfile || profileOut;
+  auto const status = lox::Lox::runFile(
+      scripts.front(), {.stats = wantStats ? &stats : nullptr,
+                        .profiler = wantProfile ? &profiler : nullptr,
+                        .cache = cache ? &*cache : nullptr,
+                        .memoize = memoize,
+                        .limits = limits,
+                        .globals = prelude ? prelude->globals : nullptr});
+
+  if (printStats) {
+    stats.print(std::cerr);
+  }
+
+  if (statsJson) {
+    auto out = std::ofstream{*statsJson};
+    stats.writeJson(out);
+  }
+
+  if (printProfile) {
+    profiler.printHotSpots(std::cerr);
+  }
+
+  if (profileOut) {
+    auto out = std::ofstream{*profileOut};
+    profiler.writeCollapsed(out);
+  }
+
+  return lox::Lox::exitStatus(status);
 }
@@ -1,13 +1,50 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <expected>
 #include <memory>
+#include <type_traits>
 #include <variant>
 
 #define VISIT_STMT(arg) auto operator()(arg const &stmt)->void
 #define VISIT_EXPR(arg) auto operator()(arg const &expr)->LiteralVal
 
+#define VISIT_STMT_RESULT(arg) auto operator()(arg const &stmt)->Result<void>
+#define VISIT_EXPR_RESULT(arg)                                                 \
+  auto operator()(arg const &expr)->Result<LiteralVal>
+
+// Unwraps a Result, or returns its error from the enclosing function. Written
+// as a statement expression (GCC/Clang) so it can sit inside a larger
+// expression, e.g. `auto left = TRY(evaluate(*expr.left));`
+#define TRY(...)                                                               \
+  ({                                                                           \
+    auto &&tryResult = (__VA_ARGS__);                                          \
+    if (!tryResult) {                                                          \
+      return std::unexpected(std::move(tryResult).error());                    \
+    }                                                                          \
+    std::move(tryResult).value();                                              \
+  })
+
 template <typename Variant, typename Child, typename... Args>
 auto constexpr inline make_unique_variant(Args &&...args) {
   return std::make_unique<Variant>(std::in_place_type<Child>,
                                    std::forward<Args>(args)...);
 }
+
+// Index of alternative `T` in `Variant`, usable as a case label
+template <typename Variant, typename T> struct variant_index;
+template <typename T, typename... Ts>
+struct variant_index<std::variant<Ts...>, T> {
+  static constexpr std::size_t value = [] {
+    constexpr auto matches = std::array<bool, sizeof...(Ts)>{
+        std::is_same_v<T, Ts>...};
+    std::size_t index = 0;
+    while (index < matches.size() && !matches[index]) {
+      index++;
+    }
+    return index;
+  }();
+};
+template <typename Variant, typename T>
+constexpr auto variant_index_v = variant_index<Variant, T>::value;
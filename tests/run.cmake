@@ -0,0 +1,26 @@
+# Runs one script and compares what it prints, stdout then stderr, with the
+# .expected file next to it. Invoked by ctest, see CMakeLists.txt. A line
+# `// args: ...` in the script passes those arguments before it, and a line
+# `// exit: n` expects that exit status instead of 0.
+file(STRINGS ${SCRIPT} args_line REGEX "^// args: " LIMIT_COUNT 1)
+string(REGEX REPLACE "^// args: " "" args "${args_line}")
+separate_arguments(args)
+file(STRINGS ${SCRIPT} exit_line REGEX "^// exit: " LIMIT_COUNT 1)
+string(REGEX REPLACE "^// exit: " "" expected_status "${exit_line}")
+if(expected_status STREQUAL "")
+  set(expected_status 0)
+endif()
+execute_process(
+  COMMAND ${LOX} --no-cache ${args} ${SCRIPT}
+  RESULT_VARIABLE status
+  OUTPUT_VARIABLE out
+  ERROR_VARIABLE err)
+if(NOT status EQUAL expected_status)
+  message(FATAL_ERROR "${SCRIPT} exited with ${status}\n${out}${err}")
+endif()
+string(REGEX REPLACE "\\.lox$" ".expected" expected_file ${SCRIPT})
+file(READ ${expected_file} expected)
+if(NOT "${out}${err}" STREQUAL expected)
+  message(FATAL_ERROR
+          "${SCRIPT} printed:\n${out}${err}\nexpected:\n${expected}")
+endif()